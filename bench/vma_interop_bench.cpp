@@ -0,0 +1,702 @@
+#include "third_party_setup.h" // IWYU pragma: export
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "capability_registry.h"
+#include "command_context.h"
+#include "device.h"
+#include "image.h"
+#include "image_cache.h"
+#include "readback_engine.h"
+#include "upload_engine.h"
+#include "vulkan_utils.h"
+
+/**
+ * Microbenchmarks of the allocation and export paths of Image and the subsystems around it.
+ * Everything runs offscreen, so it works headless, e.g. on lavapipe (select it with -d or
+ * VK_DRIVER_FILES). Results go to vma_interop_bench.json unless --benchmark_out says otherwise,
+ * the console keeps the readable table
+ */
+namespace
+{
+struct BenchFormat
+{
+    VkFormat format;
+    const char* name;
+};
+
+const BenchFormat formats[] = {
+    { VK_FORMAT_R8G8B8A8_UNORM, "R8G8B8A8_UNORM" },
+    { VK_FORMAT_R16G16B16A16_SFLOAT, "R16G16B16A16_SFLOAT" },
+    { VK_FORMAT_R32G32B32A32_SFLOAT, "R32G32B32A32_SFLOAT" },
+};
+
+const int64_t sideLengths[] = { 16, 64, 256, 1024, 4096, 8192 };
+
+const VkImageUsageFlags usageFlags = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+
+DeviceOptions deviceOptions;
+/** shared by all benchmarks, created in main */
+std::unique_ptr<Device> sharedDevice;
+
+Device& getDevice()
+{
+    return *sharedDevice;
+}
+
+/**
+ * Registers every side length for every format
+ */
+void imageSweep(benchmark::internal::Benchmark* benchmark)
+{
+    benchmark->ArgNames({ "extent", "format" });
+    for (int64_t sideLength : sideLengths)
+    {
+        for (size_t format = 0; format < std::size(formats); format++)
+        {
+            benchmark->Args({ sideLength, static_cast<int64_t>(format) });
+        }
+    }
+}
+
+/**
+ * @returns the description of the sweep's current image, the format's name becomes the label
+ */
+ImageDesc getImageDesc(benchmark::State& state, VkImageUsageFlags usage = usageFlags)
+{
+    const BenchFormat& format = formats[state.range(1)];
+    state.SetLabel(format.name);
+
+    ImageDesc desc;
+    desc.width = desc.height = static_cast<uint32_t>(state.range(0));
+    desc.format = format.format;
+    desc.usageFlags = usage;
+    return desc;
+}
+
+VkDeviceSize getImageBytes(const ImageDesc& desc)
+{
+    return VkDeviceSize(desc.width) * desc.height * VulkanUtils::getFormatTexelSize(desc.format);
+}
+
+/**
+ * Destroys what the destructors of images retired. The benchmarks only destroy images
+ * the GPU is done with, so there is no need to wait for frames in flight
+ */
+void collectRetired(Device& device)
+{
+    device.collectRetired(device.getFrameIndex());
+}
+
+/**
+ * Runs the benchmark body and skips the benchmark if it throws, e.g. if the largest
+ * images don't fit into the memory (budget) of the device, instead of aborting the whole run
+ */
+void guarded(benchmark::State& state, const std::function<void()>& body)
+{
+    try
+    {
+        body();
+    }
+    catch (const std::exception& e)
+    {
+        state.SkipWithError(e.what());
+    }
+}
+
+/**
+ * The allocation Image::createImage makes for a description, prepared up front so that
+ * only VMA is timed. The path can be forced, unless the driver insists on dedicated memory
+ */
+struct AllocationSetup
+{
+    AllocationSetup(Device& device, const ImageDesc& desc, std::optional<AllocationPath> path = std::nullopt)
+        : device(device)
+    {
+        createInfo = Image::makeImageCreateInfo(desc, device.getQueueFamilies(), externalInfo);
+        decision = device.getAllocationPolicy().decide(createInfo);
+        if (path)
+        {
+            if (*path == AllocationPath::Pooled && decision.path == AllocationPath::Dedicated
+                && decision.reason != AllocationReason::AboveThreshold)
+            {
+                throw std::runtime_error("The driver needs dedicated memory for this image!");
+            }
+            decision.path = *path;
+        }
+
+        allocInfo.usage = VMA_MEMORY_USAGE_AUTO;
+        allocInfo.pool = device.getInteropPool(createInfo, decision);
+        if (decision.path == AllocationPath::Dedicated)
+        {
+            allocInfo.flags |= VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
+        }
+    }
+
+    AllocationSetup(const AllocationSetup&) = delete;
+    AllocationSetup& operator=(const AllocationSetup&) = delete;
+
+    VkImage create(VmaAllocation& allocation) const
+    {
+        VkImage image = VK_NULL_HANDLE;
+        VkResult result = vmaCreateImage(device.getAllocator(), &createInfo, &allocInfo,
+            &image, &allocation, nullptr);
+        if (result != VK_SUCCESS)
+        {
+            throw std::runtime_error("VMA could not create image!");
+        }
+        return image;
+    }
+
+    void destroy(VkImage image, VmaAllocation allocation) const
+    {
+        vmaDestroyImage(device.getAllocator(), image, allocation);
+    }
+
+    Device& device;
+    /** createInfo points to it */
+    VkExternalMemoryImageCreateInfo externalInfo{};
+    VkImageCreateInfo createInfo{};
+    VmaAllocationCreateInfo allocInfo{};
+    AllocationDecision decision;
+};
+
+// ==========================
+// === image construction ===
+// ==========================
+
+void BM_ImageConstruction(benchmark::State& state)
+{
+    guarded(state, [&]
+    {
+        Device& device = getDevice();
+        const ImageDesc desc = getImageDesc(state);
+        for (auto _ : state)
+        {
+            auto image = std::make_unique<Image>(&device, desc);
+            state.PauseTiming();
+            image.reset();
+            collectRetired(device);
+            state.ResumeTiming();
+        }
+    });
+}
+BENCHMARK(BM_ImageConstruction)->Apply(imageSweep)->Unit(benchmark::kMicrosecond);
+
+void BM_Allocation(benchmark::State& state, AllocationPath path)
+{
+    guarded(state, [&]
+    {
+        const AllocationSetup setup(getDevice(), getImageDesc(state), path);
+        for (auto _ : state)
+        {
+            VmaAllocation allocation = VK_NULL_HANDLE;
+            VkImage image = setup.create(allocation);
+            state.PauseTiming();
+            setup.destroy(image, allocation);
+            state.ResumeTiming();
+        }
+    });
+}
+BENCHMARK_CAPTURE(BM_Allocation, pooled, AllocationPath::Pooled)->Apply(imageSweep)->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_Allocation, dedicated, AllocationPath::Dedicated)->Apply(imageSweep)->Unit(benchmark::kMicrosecond);
+
+/**
+ * Exports the memory of a fresh allocation, i.e. always the first export of its block
+ */
+void BM_Export(benchmark::State& state)
+{
+    guarded(state, [&]
+    {
+        Device& device = getDevice();
+        const AllocationSetup setup(device, getImageDesc(state));
+        for (auto _ : state)
+        {
+            state.PauseTiming();
+            VmaAllocation allocation = VK_NULL_HANDLE;
+            VkImage image = setup.create(allocation);
+            VmaAllocationInfo allocationInfo;
+            vmaGetAllocationInfo(device.getAllocator(), allocation, &allocationInfo);
+            state.ResumeTiming();
+
+            benchmark::DoNotOptimize(device.acquireExportedMemory(allocationInfo.deviceMemory));
+
+            state.PauseTiming();
+            device.releaseExportedMemory(allocationInfo.deviceMemory);
+            setup.destroy(image, allocation);
+            state.ResumeTiming();
+        }
+    });
+}
+BENCHMARK(BM_Export)->Apply(imageSweep)->Unit(benchmark::kMicrosecond);
+
+void BM_ViewCreation(benchmark::State& state)
+{
+    guarded(state, [&]
+    {
+        Device& device = getDevice();
+        Image image(&device, getImageDesc(state));
+
+        VkImageViewCreateInfo createInfo{};
+        createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        createInfo.image = image.getImage();
+        createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        createInfo.format = image.getDesc().format;
+        createInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        createInfo.subresourceRange.levelCount = 1;
+        createInfo.subresourceRange.layerCount = 1;
+        for (auto _ : state)
+        {
+            VkImageView view = VK_NULL_HANDLE;
+            VkResult result = vkCreateImageView(device.getDevice(), &createInfo, nullptr, &view);
+            if (result != VK_SUCCESS)
+            {
+                throw std::runtime_error("Could not create image view!");
+            }
+            state.PauseTiming();
+            vkDestroyImageView(device.getDevice(), view, nullptr);
+            state.ResumeTiming();
+        }
+    });
+    collectRetired(getDevice());
+}
+BENCHMARK(BM_ViewCreation)->Apply(imageSweep);
+
+/**
+ * A sampler created from scratch, what every image did before the sampler cache
+ */
+void BM_SamplerCreation(benchmark::State& state)
+{
+    guarded(state, [&]
+    {
+        Device& device = getDevice();
+        const VkSamplerCreateInfo createInfo = SamplerDesc{}.toCreateInfo();
+        for (auto _ : state)
+        {
+            VkSampler sampler = VK_NULL_HANDLE;
+            VkResult result = vkCreateSampler(device.getDevice(), &createInfo, nullptr, &sampler);
+            if (result != VK_SUCCESS)
+            {
+                throw std::runtime_error("Could not create sampler!");
+            }
+            state.PauseTiming();
+            vkDestroySampler(device.getDevice(), sampler, nullptr);
+            state.ResumeTiming();
+        }
+    });
+}
+BENCHMARK(BM_SamplerCreation);
+
+/**
+ * A sampler that is already in use by another image, what Image::createSampler costs usually
+ */
+void BM_SamplerCacheAcquire(benchmark::State& state)
+{
+    SamplerCache& cache = getDevice().getSamplerCache();
+    const VkSamplerCreateInfo createInfo = SamplerDesc{}.toCreateInfo();
+    VkSampler held = cache.acquire(createInfo);
+    for (auto _ : state)
+    {
+        VkSampler sampler = cache.acquire(createInfo);
+        cache.release(sampler);
+    }
+    cache.release(held);
+}
+BENCHMARK(BM_SamplerCacheAcquire);
+
+void BM_ImageDestruction(benchmark::State& state)
+{
+    guarded(state, [&]
+    {
+        Device& device = getDevice();
+        const ImageDesc desc = getImageDesc(state);
+        for (auto _ : state)
+        {
+            state.PauseTiming();
+            auto image = std::make_unique<Image>(&device, desc);
+            state.ResumeTiming();
+
+            image.reset();
+            collectRetired(device);
+        }
+    });
+}
+BENCHMARK(BM_ImageDestruction)->Apply(imageSweep)->Unit(benchmark::kMicrosecond);
+
+// ===========================
+// === recycling, batching ===
+// ===========================
+
+/**
+ * The hit path of the image cache, to compare against BM_ImageConstruction
+ */
+void BM_ImageCacheHit(benchmark::State& state)
+{
+    guarded(state, [&]
+    {
+        const ImageDesc desc = getImageDesc(state);
+        // room for the one image, whatever the alignment of small images adds to their size
+        ImageCache cache(&getDevice(), std::max<VkDeviceSize>(2 * getImageBytes(desc), 64 * 1024 * 1024));
+        cache.release(cache.acquire(desc));
+        for (auto _ : state)
+        {
+            cache.release(cache.acquire(desc));
+        }
+    });
+    collectRetired(getDevice());
+}
+BENCHMARK(BM_ImageCacheHit)->Apply(imageSweep);
+
+void BM_CreateImages(benchmark::State& state, bool batched)
+{
+    guarded(state, [&]
+    {
+        Device& device = getDevice();
+        ImageDesc desc;
+        desc.width = desc.height = 64;
+        desc.format = VK_FORMAT_R8G8B8A8_UNORM;
+        desc.usageFlags = usageFlags;
+        const std::vector<ImageDesc> descs(static_cast<size_t>(state.range(0)), desc);
+
+        for (auto _ : state)
+        {
+            std::vector<std::unique_ptr<Image>> images;
+            if (batched)
+            {
+                images = device.createImages(descs);
+            }
+            else
+            {
+                for (const ImageDesc& imageDesc : descs)
+                {
+                    images.push_back(std::make_unique<Image>(&device, imageDesc));
+                }
+            }
+            state.PauseTiming();
+            images.clear();
+            collectRetired(device);
+            state.ResumeTiming();
+        }
+        state.SetItemsProcessed(state.iterations() * state.range(0));
+    });
+}
+BENCHMARK_CAPTURE(BM_CreateImages, one_by_one, false)->ArgName("count")->Arg(16)->Arg(128)->Arg(1024)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_CreateImages, batched, true)->ArgName("count")->Arg(16)->Arg(128)->Arg(1024)
+    ->Unit(benchmark::kMillisecond);
+
+// ==========================
+// === transfers, command ===
+// ==========================
+
+/**
+ * Uploads count images of the given side length per flush, the throughput ends up in bytes_per_second
+ */
+void BM_Upload(benchmark::State& state)
+{
+    guarded(state, [&]
+    {
+        Device& device = getDevice();
+        UploadEngine engine(&device);
+
+        ImageDesc desc;
+        desc.width = desc.height = static_cast<uint32_t>(state.range(0));
+        desc.format = VK_FORMAT_R8G8B8A8_UNORM;
+        desc.usageFlags = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+        std::vector<std::unique_ptr<Image>> images;
+        for (int64_t i = 0; i < state.range(1); i++)
+        {
+            images.push_back(std::make_unique<Image>(&device, desc));
+        }
+        const std::vector<std::byte> data(getImageBytes(desc));
+
+        for (auto _ : state)
+        {
+            for (std::unique_ptr<Image>& image : images)
+            {
+                engine.upload(*image, data.data(), data.size());
+            }
+            engine.wait(engine.flush());
+        }
+        state.SetBytesProcessed(state.iterations() * state.range(1) * static_cast<int64_t>(data.size()));
+    });
+    collectRetired(getDevice());
+}
+BENCHMARK(BM_Upload)->ArgNames({ "extent", "count" })
+    ->Args({ 64, 1 })->Args({ 256, 1 })->Args({ 1024, 1 })->Args({ 2048, 1 })
+    ->Args({ 64, 64 })->Args({ 256, 16 })
+    ->UseRealTime()->Unit(benchmark::kMicrosecond);
+
+/**
+ * One readback at a time, i.e. the latency from recording the copy to having the data
+ */
+void BM_ReadbackLatency(benchmark::State& state)
+{
+    guarded(state, [&]
+    {
+        Device& device = getDevice();
+        ReadbackEngine engine(&device);
+
+        ImageDesc desc;
+        desc.width = desc.height = static_cast<uint32_t>(state.range(0));
+        desc.format = VK_FORMAT_R8G8B8A8_UNORM;
+        desc.usageFlags = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+        Image image(&device, desc);
+
+        for (auto _ : state)
+        {
+            std::future<std::vector<std::byte>> data = engine.readback(image);
+            engine.flush();
+            benchmark::DoNotOptimize(data.get());
+        }
+        state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(getImageBytes(desc)));
+    });
+    collectRetired(getDevice());
+}
+BENCHMARK(BM_ReadbackLatency)->ArgName("extent")->Arg(64)->Arg(256)->Arg(1024)->Arg(2048)
+    ->UseRealTime()->Unit(benchmark::kMicrosecond);
+
+/**
+ * One readback per frame for several frames before waiting for the first,
+ * so copies and the consumption of their results overlap
+ */
+void BM_ReadbackThroughput(benchmark::State& state)
+{
+    constexpr uint32_t FRAMES = 8;
+    guarded(state, [&]
+    {
+        Device& device = getDevice();
+        ReadbackEngine engine(&device);
+
+        ImageDesc desc;
+        desc.width = desc.height = static_cast<uint32_t>(state.range(0));
+        desc.format = VK_FORMAT_R8G8B8A8_UNORM;
+        desc.usageFlags = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+        std::vector<std::unique_ptr<Image>> images;
+        for (uint32_t i = 0; i < FRAMES; i++)
+        {
+            images.push_back(std::make_unique<Image>(&device, desc));
+        }
+
+        for (auto _ : state)
+        {
+            std::vector<std::future<std::vector<std::byte>>> results;
+            for (std::unique_ptr<Image>& image : images)
+            {
+                results.push_back(engine.readback(*image));
+                engine.flush();
+            }
+            for (std::future<std::vector<std::byte>>& result : results)
+            {
+                benchmark::DoNotOptimize(result.get());
+            }
+        }
+        state.SetBytesProcessed(state.iterations() * FRAMES * static_cast<int64_t>(getImageBytes(desc)));
+    });
+    collectRetired(getDevice());
+}
+BENCHMARK(BM_ReadbackThroughput)->ArgName("extent")->Arg(64)->Arg(256)->Arg(1024)->Arg(2048)
+    ->UseRealTime()->Unit(benchmark::kMicrosecond);
+
+/**
+ * Command buffers of the calling thread, with a new frame every 64 acquisitions
+ * so the pools get recycled like in a real frame loop
+ */
+void BM_CommandBufferAcquire(benchmark::State& state)
+{
+    constexpr uint32_t ACQUISITIONS_PER_FRAME = 64;
+    Device& device = getDevice();
+    CommandContextManager& contexts = device.getCommandContexts();
+    uint32_t acquisitions = 0;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(contexts.acquire(QueueType::Graphics));
+        if (++acquisitions % ACQUISITIONS_PER_FRAME == 0)
+        {
+            state.PauseTiming();
+            device.advanceFrame();
+            state.ResumeTiming();
+        }
+    }
+}
+BENCHMARK(BM_CommandBufferAcquire);
+
+// =========================
+// === startup, lookups ===
+// =========================
+
+/**
+ * 300+ extension names, the usual size of a desktop driver's list,
+ * with a few real ones mixed in
+ */
+std::vector<std::string> makeSyntheticExtensions()
+{
+    std::vector<std::string> names;
+    for (uint32_t i = 0; i < 320; i++)
+    {
+        names.push_back("VK_SYNTHETIC_extension_" + std::to_string(i));
+    }
+    names.push_back(VK_KHR_EXTERNAL_MEMORY_FD_EXTENSION_NAME);
+    names.push_back(VK_KHR_EXTERNAL_SEMAPHORE_FD_EXTENSION_NAME);
+    names.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    return names;
+}
+
+const std::vector<const char*> requestedExtensions = {
+    VK_KHR_EXTERNAL_MEMORY_FD_EXTENSION_NAME,
+    VK_KHR_EXTERNAL_SEMAPHORE_FD_EXTENSION_NAME,
+    VK_EXT_MEMORY_BUDGET_EXTENSION_NAME,
+    VK_KHR_SWAPCHAIN_EXTENSION_NAME,
+};
+
+void BM_ExtensionLookupHashed(benchmark::State& state)
+{
+    const CapabilitySet extensions(makeSyntheticExtensions());
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(extensions.findMissing(requestedExtensions));
+    }
+}
+BENCHMARK(BM_ExtensionLookupHashed);
+
+/**
+ * The nested strcmp loops the capability registry replaced
+ */
+void BM_ExtensionLookupLinear(benchmark::State& state)
+{
+    std::vector<VkExtensionProperties> extensions;
+    for (const std::string& name : makeSyntheticExtensions())
+    {
+        VkExtensionProperties properties{};
+        strncpy(properties.extensionName, name.c_str(), VK_MAX_EXTENSION_NAME_SIZE - 1);
+        extensions.push_back(properties);
+    }
+    for (auto _ : state)
+    {
+        std::vector<const char*> missing;
+        for (const char* requested : requestedExtensions)
+        {
+            bool found = false;
+            for (const VkExtensionProperties& extension : extensions)
+            {
+                if (strcmp(requested, extension.extensionName) == 0)
+                {
+                    found = true;
+                    break;
+                }
+            }
+            if (!found)
+            {
+                missing.push_back(requested);
+            }
+        }
+        benchmark::DoNotOptimize(missing);
+    }
+}
+BENCHMARK(BM_ExtensionLookupLinear);
+
+/**
+ * A complete Device::createAsync with the time per phase as counters,
+ * next to the time the calling thread was blocked
+ */
+void BM_DeviceStartup(benchmark::State& state)
+{
+    guarded(state, [&]
+    {
+        DeviceStartupTimings sum;
+        std::chrono::microseconds blocked{ 0 };
+        for (auto _ : state)
+        {
+            const auto start = std::chrono::steady_clock::now();
+            std::future<std::unique_ptr<Device>> pending = Device::createAsync(deviceOptions);
+            blocked += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+            std::unique_ptr<Device> device = pending.get();
+
+            const DeviceStartupTimings& timings = device->getStartupTimings();
+            sum.loader += timings.loader;
+            sum.instance += timings.instance;
+            sum.physicalDevice += timings.physicalDevice;
+            sum.logicalDevice += timings.logicalDevice;
+            sum.allocator += timings.allocator;
+
+            state.PauseTiming();
+            device.reset();
+            state.ResumeTiming();
+        }
+
+        auto average = [](std::chrono::microseconds time)
+        {
+            return benchmark::Counter(static_cast<double>(time.count()), benchmark::Counter::kAvgIterations);
+        };
+        state.counters["loader_us"] = average(sum.loader);
+        state.counters["instance_us"] = average(sum.instance);
+        state.counters["physical_device_us"] = average(sum.physicalDevice);
+        state.counters["logical_device_us"] = average(sum.logicalDevice);
+        state.counters["allocator_us"] = average(sum.allocator);
+        state.counters["blocked_us"] = average(blocked);
+    });
+}
+BENCHMARK(BM_DeviceStartup)->Iterations(5)->UseRealTime()->Unit(benchmark::kMillisecond);
+}
+
+int main(int argc, char** argv)
+{
+    // JSON for tracking regressions by default, the flags given by the user come later and win
+    std::string defaultOut = "--benchmark_out=vma_interop_bench.json";
+    std::string defaultOutFormat = "--benchmark_out_format=json";
+    std::vector<char*> args(argv, argv + argc);
+    args.insert(args.begin() + 1, { defaultOut.data(), defaultOutFormat.data() });
+    args.push_back(nullptr);
+    int argCount = static_cast<int>(args.size()) - 1;
+    benchmark::Initialize(&argCount, args.data());
+
+    // everything benchmark did not recognize is ours
+    deviceOptions.enableValidation = false;
+    for (int i = 1; i < argCount; i++)
+    {
+        if (i + 1 < argCount &&
+            (strcmp(args[i], "-d") == 0
+            || strcmp(args[i], "--device") == 0))
+        {
+            deviceOptions.deviceId = std::atoi(args[++i]);
+        }
+        else if (strcmp(args[i], "-v") == 0
+            || strcmp(args[i], "--validation") == 0)
+        {
+            // the layers distort every timing, only for debugging the benchmarks themselves
+            deviceOptions.enableValidation = true;
+        }
+        else
+        {
+            std::cout << "There are unknown parameters. Besides the --benchmark_* flags, "
+                << "-d <id> || --device <id> and -v || --validation are supported." << std::endl;
+            return -1;
+        }
+    }
+
+    sharedDevice = std::make_unique<Device>(deviceOptions);
+    const VkPhysicalDeviceProperties& properties = sharedDevice->getPhysicalDeviceProperties();
+    benchmark::AddCustomContext("vulkan_device", properties.deviceName);
+    benchmark::AddCustomContext("vulkan_driver_version", std::to_string(properties.driverVersion));
+
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+
+    sharedDevice->flushRetired();
+    sharedDevice.reset();
+    return 0;
+}
@@ -0,0 +1,114 @@
+#include "allocation_policy.h"
+
+#include "handle.h"
+
+AllocationPolicy::AllocationPolicy(VkDevice device, VkPhysicalDevice physicalDevice,
+    AllocationPolicySettings settings)
+    : device(device), physicalDevice(physicalDevice), settings(settings)
+{
+}
+
+AllocationDecision AllocationPolicy::decide(const VkImageCreateInfo& createInfo)
+{
+    VkDeviceImageMemoryRequirements requirementsInfo{};
+    requirementsInfo.sType = VK_STRUCTURE_TYPE_DEVICE_IMAGE_MEMORY_REQUIREMENTS;
+    requirementsInfo.pCreateInfo = &createInfo;
+
+    VkMemoryDedicatedRequirements dedicatedRequirements{};
+    dedicatedRequirements.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS;
+
+    VkMemoryRequirements2 requirements{};
+    requirements.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
+    requirements.pNext = &dedicatedRequirements;
+    vkGetDeviceImageMemoryRequirements(device, &requirementsInfo, &requirements);
+
+    const AllocationPolicySettings currentSettings = getSettings();
+
+    AllocationDecision decision;
+    decision.size = requirements.memoryRequirements.size;
+
+    if (dedicatedRequirements.requiresDedicatedAllocation)
+    {
+        decision.path = AllocationPath::Dedicated;
+        decision.reason = AllocationReason::DriverRequiresDedicated;
+    }
+    else if (isDedicatedRequiredForExport(createInfo))
+    {
+        decision.path = AllocationPath::Dedicated;
+        decision.reason = AllocationReason::ExportRequiresDedicated;
+    }
+    else if (currentSettings.honorDriverPreference && dedicatedRequirements.prefersDedicatedAllocation)
+    {
+        decision.path = AllocationPath::Dedicated;
+        decision.reason = AllocationReason::DriverPrefersDedicated;
+    }
+    else if (decision.size >= currentSettings.dedicatedThreshold)
+    {
+        decision.path = AllocationPath::Dedicated;
+        decision.reason = AllocationReason::AboveThreshold;
+    }
+    else
+    {
+        decision.path = AllocationPath::Pooled;
+        decision.reason = AllocationReason::BelowThreshold;
+    }
+    return decision;
+}
+
+AllocationPolicySettings AllocationPolicy::getSettings() const
+{
+    std::lock_guard lock(mutex);
+    return settings;
+}
+
+void AllocationPolicy::setSettings(const AllocationPolicySettings& settings)
+{
+    std::lock_guard lock(mutex);
+    this->settings = settings;
+}
+
+bool AllocationPolicy::isDedicatedRequiredForExport(const VkImageCreateInfo& createInfo)
+{
+    FormatKey key{ createInfo.format, createInfo.tiling, createInfo.usage, createInfo.flags };
+    {
+        std::lock_guard lock(mutex);
+        auto it = exportRequiresDedicated.find(key);
+        if (it != exportRequiresDedicated.end())
+        {
+            return it->second;
+        }
+    }
+
+    VkPhysicalDeviceExternalImageFormatInfo externalInfo{};
+    externalInfo.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_IMAGE_FORMAT_INFO;
+    externalInfo.handleType = EXTERNAL_MEMORY_HANDLE_TYPE;
+
+    VkPhysicalDeviceImageFormatInfo2 formatInfo{};
+    formatInfo.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_IMAGE_FORMAT_INFO_2;
+    formatInfo.pNext = &externalInfo;
+    formatInfo.format = createInfo.format;
+    formatInfo.type = createInfo.imageType;
+    formatInfo.tiling = createInfo.tiling;
+    formatInfo.usage = createInfo.usage;
+    formatInfo.flags = createInfo.flags;
+
+    VkExternalImageFormatProperties externalProps{};
+    externalProps.sType = VK_STRUCTURE_TYPE_EXTERNAL_IMAGE_FORMAT_PROPERTIES;
+
+    VkImageFormatProperties2 formatProps{};
+    formatProps.sType = VK_STRUCTURE_TYPE_IMAGE_FORMAT_PROPERTIES_2;
+    formatProps.pNext = &externalProps;
+
+    bool required = false;
+    VkResult result = vkGetPhysicalDeviceImageFormatProperties2(physicalDevice, &formatInfo, &formatProps);
+    if (result == VK_SUCCESS)
+    {
+        required = (externalProps.externalMemoryProperties.externalMemoryFeatures
+            & VK_EXTERNAL_MEMORY_FEATURE_DEDICATED_ONLY_BIT) != 0;
+    }
+
+    // querying twice from two threads is harmless, the answer is the same
+    std::lock_guard lock(mutex);
+    exportRequiresDedicated.emplace(key, required);
+    return required;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <compare>
+#include <map>
+#include <mutex>
+
+#include <volk.h>
+
+/**
+ * How the memory of an exportable image is obtained
+ */
+enum class AllocationPath
+{
+    /** sub-allocated from a shared block of an interop pool */
+    Pooled,
+    /** the image gets a VkDeviceMemory of its own */
+    Dedicated
+};
+
+/**
+ * Why the policy chose the path it did
+ */
+enum class AllocationReason
+{
+    BelowThreshold,
+    AboveThreshold,
+    DriverRequiresDedicated,
+    DriverPrefersDedicated,
+    ExportRequiresDedicated
+};
+
+struct AllocationDecision
+{
+    AllocationPath path = AllocationPath::Pooled;
+    AllocationReason reason = AllocationReason::BelowThreshold;
+    /** size of the image's memory as reported by the driver */
+    VkDeviceSize size = 0;
+};
+
+struct AllocationPolicySettings
+{
+    /** images of at least this size get a dedicated allocation */
+    VkDeviceSize dedicatedThreshold = 32 * 1024 * 1024;
+    /**
+     * Whether to follow VkMemoryDedicatedRequirements::prefersDedicatedAllocation.
+     * Required dedicated allocations are always honored
+     */
+    bool honorDriverPreference = false;
+};
+
+/**
+ * Decides whether an exportable image is placed in a shared interop pool or
+ * gets a dedicated allocation. The driver is asked for its dedicated requirements
+ * (both for the image and for exporting it), everything else is decided by size.
+ * Thread safe
+ */
+class AllocationPolicy
+{
+public:
+    AllocationPolicy(VkDevice device, VkPhysicalDevice physicalDevice,
+        AllocationPolicySettings settings = {});
+
+    /**
+     * @param createInfo the image create info including the external memory setup
+     */
+    AllocationDecision decide(const VkImageCreateInfo& createInfo);
+
+    AllocationPolicySettings getSettings() const;
+    void setSettings(const AllocationPolicySettings& settings);
+
+private:
+    /**
+     * Some implementations only allow exporting images from dedicated memory.
+     * This depends on the format and usage only, so the answer is cached
+     */
+    bool isDedicatedRequiredForExport(const VkImageCreateInfo& createInfo);
+
+private:
+    struct FormatKey
+    {
+        VkFormat format;
+        VkImageTiling tiling;
+        VkImageUsageFlags usage;
+        VkImageCreateFlags flags;
+
+        auto operator<=>(const FormatKey&) const = default;
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+    AllocationPolicySettings settings;
+
+    std::map<FormatKey, bool> exportRequiresDedicated;
+    /** guards the settings and the format cache */
+    mutable std::mutex mutex;
+};
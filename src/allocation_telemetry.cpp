@@ -0,0 +1,209 @@
+#include "allocation_telemetry.h"
+
+#include <algorithm>
+#include <bit>
+#include <fstream>
+#include <sstream>
+
+size_t LatencyHistogram::getBucket(std::chrono::nanoseconds latency)
+{
+    const uint64_t us = static_cast<uint64_t>(std::max<int64_t>(latency.count(), 0)) / 1000;
+    // bucket i holds everything below 2^i us, i.e. the bit width of the value
+    return std::min<size_t>(std::bit_width(us), BUCKET_COUNT - 1);
+}
+
+uint64_t LatencyHistogram::getBucketLimitUs(size_t bucket)
+{
+    return bucket + 1 < BUCKET_COUNT ? uint64_t(1) << bucket : UINT64_MAX;
+}
+
+double LatencyHistogram::getMeanUs() const
+{
+    return count > 0 ? double(totalNs) / double(count) / 1000.0 : 0.0;
+}
+
+uint64_t LatencyHistogram::getPercentileUs(double percentile) const
+{
+    const uint64_t target = static_cast<uint64_t>(percentile * double(count));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKET_COUNT; i++)
+    {
+        seen += buckets[i];
+        if (seen > target)
+        {
+            return getBucketLimitUs(i);
+        }
+    }
+    return count > 0 ? getBucketLimitUs(BUCKET_COUNT - 1) : 0;
+}
+
+void AllocationTelemetry::recordAllocation(const AllocationDecision& decision, VkDeviceSize size,
+    std::chrono::nanoseconds latency)
+{
+    imagesCreated++;
+    bytesAllocated += size;
+    if (decision.path == AllocationPath::Dedicated)
+    {
+        dedicatedAllocations++;
+    }
+    else
+    {
+        pooledAllocations++;
+    }
+
+    latencyBuckets[LatencyHistogram::getBucket(latency)]++;
+    const uint64_t ns = static_cast<uint64_t>(std::max<int64_t>(latency.count(), 0));
+    latencyTotalNs += ns;
+    uint64_t max = latencyMaxNs;
+    while (ns > max && !latencyMaxNs.compare_exchange_weak(max, ns))
+    {
+    }
+}
+
+void AllocationTelemetry::recordImageDestroyed(VkDeviceSize size)
+{
+    imagesDestroyed++;
+    bytesFreed += size;
+}
+
+void AllocationTelemetry::recordHandleExported()
+{
+    handlesExported++;
+    handlesOpen++;
+}
+
+void AllocationTelemetry::recordHandleClosed()
+{
+    handlesOpen--;
+}
+
+DeviceStats AllocationTelemetry::getStats() const
+{
+    DeviceStats stats;
+    stats.imagesCreated = imagesCreated;
+    stats.imagesDestroyed = imagesDestroyed;
+    stats.bytesAllocated = bytesAllocated;
+    stats.bytesFreed = bytesFreed;
+    stats.dedicatedAllocations = dedicatedAllocations;
+    stats.pooledAllocations = pooledAllocations;
+    stats.handlesExported = handlesExported;
+    stats.handlesOpen = handlesOpen;
+
+    // the counters are not read at the same instant, good enough for monitoring
+    for (size_t i = 0; i < LatencyHistogram::BUCKET_COUNT; i++)
+    {
+        stats.allocationLatency.buckets[i] = latencyBuckets[i];
+        stats.allocationLatency.count += stats.allocationLatency.buckets[i];
+    }
+    stats.allocationLatency.totalNs = latencyTotalNs;
+    stats.allocationLatency.maxNs = latencyMaxNs;
+    return stats;
+}
+
+std::string AllocationTelemetry::toJson(const DeviceStats& stats)
+{
+    std::ostringstream json;
+    json << "{\"ImagesCreated\": " << stats.imagesCreated
+        << ", \"ImagesDestroyed\": " << stats.imagesDestroyed
+        << ", \"BytesAllocated\": " << stats.bytesAllocated
+        << ", \"BytesFreed\": " << stats.bytesFreed
+        << ", \"DedicatedAllocations\": " << stats.dedicatedAllocations
+        << ", \"PooledAllocations\": " << stats.pooledAllocations
+        << ", \"HandlesExported\": " << stats.handlesExported
+        << ", \"HandlesOpen\": " << stats.handlesOpen;
+
+    const LatencyHistogram& latency = stats.allocationLatency;
+    json << ", \"AllocationLatency\": {\"Count\": " << latency.count
+        << ", \"MeanUs\": " << latency.getMeanUs()
+        << ", \"MaxUs\": " << latency.maxNs / 1000
+        << ", \"P50Us\": " << latency.getPercentileUs(0.5)
+        << ", \"P99Us\": " << latency.getPercentileUs(0.99)
+        << ", \"Buckets\": [";
+    for (size_t i = 0; i < LatencyHistogram::BUCKET_COUNT; i++)
+    {
+        const uint64_t limit = LatencyHistogram::getBucketLimitUs(i);
+        json << (i > 0 ? ", " : "") << "{\"BelowUs\": ";
+        if (limit == UINT64_MAX)
+        {
+            json << "null";
+        }
+        else
+        {
+            json << limit;
+        }
+        json << ", \"Count\": " << latency.buckets[i] << "}";
+    }
+    json << "]}";
+
+    json << ", \"Pools\": [";
+    for (size_t i = 0; i < stats.pools.size(); i++)
+    {
+        const InteropPoolStats& pool = stats.pools[i];
+        // pool names are our own and never need escaping
+        json << (i > 0 ? ", " : "") << "{\"Name\": \"" << pool.name << "\""
+            << ", \"UsageFlags\": " << pool.usageFlags
+            << ", \"MemoryTypeIndex\": " << pool.memoryTypeIndex
+            << ", \"BlockCount\": " << pool.blockCount
+            << ", \"AllocationCount\": " << pool.allocationCount
+            << ", \"BlockBytes\": " << pool.blockBytes
+            << ", \"AllocationBytes\": " << pool.allocationBytes
+            << ", \"Utilization\": " << pool.utilization << "}";
+    }
+    json << "]}";
+    return json.str();
+}
+
+StatsDumper::StatsDumper(std::filesystem::path file, std::chrono::milliseconds interval,
+    std::function<std::string()> buildJson)
+    : file(std::move(file)), interval(interval), buildJson(std::move(buildJson))
+{
+    thread = std::thread(&StatsDumper::run, this);
+}
+
+StatsDumper::~StatsDumper()
+{
+    {
+        std::lock_guard lock(mutex);
+        stop = true;
+    }
+    condition.notify_all();
+    thread.join();
+    dump();
+}
+
+bool StatsDumper::dump()
+{
+    std::lock_guard lock(dumpMutex);
+    const std::string json = buildJson();
+
+    std::error_code error;
+    if (file.has_parent_path())
+    {
+        std::filesystem::create_directories(file.parent_path(), error);
+    }
+
+    // replace the file at once, so a reader never sees half a dump
+    std::filesystem::path tempPath = file;
+    tempPath += ".tmp";
+    {
+        std::ofstream out(tempPath, std::ios::trunc);
+        out << json;
+        if (!out)
+        {
+            return false;
+        }
+    }
+    std::filesystem::rename(tempPath, file, error);
+    return !error;
+}
+
+void StatsDumper::run()
+{
+    std::unique_lock lock(mutex);
+    while (!condition.wait_for(lock, interval, [this] { return stop; }))
+    {
+        lock.unlock();
+        dump();
+        lock.lock();
+    }
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <volk.h>
+
+#include "allocation_policy.h"
+#include "interop_pool_manager.h"
+
+/**
+ * Distribution of latencies in power of two buckets:
+ * bucket i counts latencies below 2^i microseconds, the last bucket everything above
+ */
+struct LatencyHistogram
+{
+    static constexpr size_t BUCKET_COUNT = 20;
+
+    std::array<uint64_t, BUCKET_COUNT> buckets{};
+    uint64_t count = 0;
+    uint64_t totalNs = 0;
+    uint64_t maxNs = 0;
+
+    static size_t getBucket(std::chrono::nanoseconds latency);
+    /** @returns the exclusive upper bound of the bucket in microseconds, UINT64_MAX for the last one */
+    static uint64_t getBucketLimitUs(size_t bucket);
+
+    double getMeanUs() const;
+    /** @returns the upper bound of the bucket containing the given percentile (0 to 1) */
+    uint64_t getPercentileUs(double percentile) const;
+};
+
+/**
+ * Snapshot of the allocation counters of a device, see Device::getStats
+ */
+struct DeviceStats
+{
+    uint64_t imagesCreated = 0;
+    uint64_t imagesDestroyed = 0;
+    uint64_t bytesAllocated = 0;
+    uint64_t bytesFreed = 0;
+    uint64_t dedicatedAllocations = 0;
+    uint64_t pooledAllocations = 0;
+    /** export handles (FDs on Linux) created so far and currently open */
+    uint64_t handlesExported = 0;
+    uint64_t handlesOpen = 0;
+    /** time spent in the allocation and binding of an image's memory */
+    LatencyHistogram allocationLatency;
+    std::vector<InteropPoolStats> pools;
+};
+
+/**
+ * Live counters of the allocations of a device. Recording only touches atomics,
+ * so it is cheap enough for every allocation. Thread safe
+ */
+class AllocationTelemetry
+{
+public:
+    void recordAllocation(const AllocationDecision& decision, VkDeviceSize size, std::chrono::nanoseconds latency);
+    void recordImageDestroyed(VkDeviceSize size);
+    void recordHandleExported();
+    void recordHandleClosed();
+
+    /** @returns everything but the pool stats, which the device adds */
+    DeviceStats getStats() const;
+
+    /**
+     * @returns the stats as JSON object
+     */
+    static std::string toJson(const DeviceStats& stats);
+
+private:
+    std::atomic<uint64_t> imagesCreated = 0;
+    std::atomic<uint64_t> imagesDestroyed = 0;
+    std::atomic<uint64_t> bytesAllocated = 0;
+    std::atomic<uint64_t> bytesFreed = 0;
+    std::atomic<uint64_t> dedicatedAllocations = 0;
+    std::atomic<uint64_t> pooledAllocations = 0;
+    std::atomic<uint64_t> handlesExported = 0;
+    std::atomic<uint64_t> handlesOpen = 0;
+
+    std::array<std::atomic<uint64_t>, LatencyHistogram::BUCKET_COUNT> latencyBuckets{};
+    std::atomic<uint64_t> latencyTotalNs = 0;
+    std::atomic<uint64_t> latencyMaxNs = 0;
+};
+
+/**
+ * Writes the JSON built by the given function to a file in a fixed interval,
+ * from its own thread. The file is replaced at once, so readers never see half a dump.
+ * The last dump is written when the dumper is destroyed
+ */
+class StatsDumper
+{
+public:
+    StatsDumper(std::filesystem::path file, std::chrono::milliseconds interval,
+        std::function<std::string()> buildJson);
+    ~StatsDumper();
+
+    StatsDumper(const StatsDumper&) = delete;
+    StatsDumper& operator=(const StatsDumper&) = delete;
+
+    /** @returns false if the file could not be written */
+    bool dump();
+
+private:
+    void run();
+
+private:
+    std::filesystem::path file;
+    std::chrono::milliseconds interval;
+    std::function<std::string()> buildJson;
+    /** the periodic dumps and explicit ones share the temporary file */
+    std::mutex dumpMutex;
+
+    bool stop = false;
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::thread thread;
+};
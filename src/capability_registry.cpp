@@ -0,0 +1,168 @@
+#include "capability_registry.h"
+
+#include <algorithm>
+#include <bit>
+#include <stdexcept>
+
+CapabilitySet::CapabilitySet(std::vector<std::string> names)
+    : names(std::move(names))
+{
+    // at most half full, so probe sequences stay short
+    const uint64_t slotCount = std::bit_ceil(std::max<uint64_t>(2 * this->names.size(), 8));
+    slotMask = slotCount - 1;
+    slotHashes.resize(slotCount);
+    slots.resize(slotCount, 0);
+
+    for (uint32_t i = 0; i < this->names.size(); i++)
+    {
+        const uint64_t nameHash = hash(this->names[i]);
+        uint64_t slot = nameHash & slotMask;
+        while (slots[slot] != 0)
+        {
+            if (slotHashes[slot] == nameHash && this->names[slots[slot] - 1] == this->names[i])
+            {
+                // duplicate name, e.g. an extension reported by several layers
+                break;
+            }
+            slot = (slot + 1) & slotMask;
+        }
+        if (slots[slot] == 0)
+        {
+            slotHashes[slot] = nameHash;
+            slots[slot] = i + 1;
+        }
+    }
+}
+
+CapabilitySet CapabilitySet::fromExtensions(const std::vector<VkExtensionProperties>& extensions)
+{
+    std::vector<std::string> names;
+    names.reserve(extensions.size());
+    for (const VkExtensionProperties& extension : extensions)
+    {
+        names.push_back(extension.extensionName);
+    }
+    return CapabilitySet(std::move(names));
+}
+
+CapabilitySet CapabilitySet::fromLayers(const std::vector<VkLayerProperties>& layers)
+{
+    std::vector<std::string> names;
+    names.reserve(layers.size());
+    for (const VkLayerProperties& layer : layers)
+    {
+        names.push_back(layer.layerName);
+    }
+    return CapabilitySet(std::move(names));
+}
+
+bool CapabilitySet::contains(std::string_view name) const
+{
+    if (slots.empty())
+    {
+        return false;
+    }
+    const uint64_t nameHash = hash(name);
+    for (uint64_t slot = nameHash & slotMask; slots[slot] != 0; slot = (slot + 1) & slotMask)
+    {
+        if (slotHashes[slot] == nameHash && names[slots[slot] - 1] == name)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool CapabilitySet::containsAll(const std::vector<const char*>& requested) const
+{
+    for (const char* name : requested)
+    {
+        if (!contains(name))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::vector<const char*> CapabilitySet::findMissing(const std::vector<const char*>& requested) const
+{
+    std::vector<const char*> missing;
+    for (const char* name : requested)
+    {
+        if (!contains(name))
+        {
+            missing.push_back(name);
+        }
+    }
+    return missing;
+}
+
+const std::vector<std::string>& CapabilitySet::getNames() const
+{
+    return names;
+}
+
+size_t CapabilitySet::size() const
+{
+    return names.size();
+}
+
+uint64_t CapabilitySet::hash(std::string_view name)
+{
+    // FNV-1a, names are short
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (char c : name)
+    {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+CapabilityRegistry& CapabilityRegistry::get()
+{
+    static CapabilityRegistry registry;
+    return registry;
+}
+
+CapabilityRegistry::CapabilityRegistry()
+{
+    uint32_t layerCount = 0;
+    vkEnumerateInstanceLayerProperties(&layerCount, nullptr);
+    std::vector<VkLayerProperties> layers(layerCount);
+    vkEnumerateInstanceLayerProperties(&layerCount, layers.data());
+    instanceLayers = CapabilitySet::fromLayers(layers);
+
+    uint32_t extensionCount = 0;
+    vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
+    std::vector<VkExtensionProperties> extensions(extensionCount);
+    vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, extensions.data());
+    instanceExtensions = CapabilitySet::fromExtensions(extensions);
+}
+
+const CapabilitySet& CapabilityRegistry::getInstanceLayers() const
+{
+    return instanceLayers;
+}
+
+const CapabilitySet& CapabilityRegistry::getInstanceExtensions() const
+{
+    return instanceExtensions;
+}
+
+const CapabilitySet& CapabilityRegistry::getDeviceExtensions(VkPhysicalDevice physicalDevice)
+{
+    std::lock_guard lock(mutex);
+    auto it = deviceExtensions.find(physicalDevice);
+    if (it != deviceExtensions.end())
+    {
+        return it->second;
+    }
+
+    uint32_t extensionCount = 0;
+    vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+    std::vector<VkExtensionProperties> extensions(extensionCount);
+    vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, extensions.data());
+    return deviceExtensions.emplace(physicalDevice, CapabilitySet::fromExtensions(extensions)).first->second;
+}
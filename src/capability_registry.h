@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <volk.h>
+
+/**
+ * An immutable set of extension or layer names. The names are hashed once into a flat,
+ * open addressing table, so lookups are O(1) without allocating
+ */
+class CapabilitySet
+{
+public:
+    CapabilitySet() = default;
+    explicit CapabilitySet(std::vector<std::string> names);
+
+    static CapabilitySet fromExtensions(const std::vector<VkExtensionProperties>& extensions);
+    static CapabilitySet fromLayers(const std::vector<VkLayerProperties>& layers);
+
+    bool contains(std::string_view name) const;
+    bool containsAll(const std::vector<const char*>& requested) const;
+    /**
+     * @returns every requested name that is not in the set, in the order of the request
+     */
+    std::vector<const char*> findMissing(const std::vector<const char*>& requested) const;
+
+    const std::vector<std::string>& getNames() const;
+    size_t size() const;
+
+    static uint64_t hash(std::string_view name);
+
+private:
+    std::vector<std::string> names;
+    /** per slot: hash and index + 1 into names, 0 marks an empty slot */
+    std::vector<uint64_t> slotHashes;
+    std::vector<uint32_t> slots;
+    uint64_t slotMask = 0;
+};
+
+/**
+ * Snapshots the instance layers and extensions on first use and the extensions of every
+ * physical device it is asked about, so repeated checks never enumerate again.
+ * Use it only after volkInitialize. Thread safe
+ */
+class CapabilityRegistry
+{
+public:
+    static CapabilityRegistry& get();
+
+    const CapabilitySet& getInstanceLayers() const;
+    const CapabilitySet& getInstanceExtensions() const;
+    const CapabilitySet& getDeviceExtensions(VkPhysicalDevice physicalDevice);
+
+private:
+    CapabilityRegistry();
+
+private:
+    CapabilitySet instanceLayers;
+    CapabilitySet instanceExtensions;
+    /** map nodes are stable, so references handed out stay valid */
+    std::map<VkPhysicalDevice, CapabilitySet> deviceExtensions;
+    std::mutex mutex;
+};
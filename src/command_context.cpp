@@ -0,0 +1,160 @@
+#include "command_context.h"
+
+#include <stdexcept>
+#include <string>
+
+#include "device.h"
+
+CommandContextManager::CommandContextManager(Device* device)
+    : device(device)
+{
+}
+
+CommandContextManager::~CommandContextManager()
+{
+    for (auto& [threadId, pools] : threadPools)
+    {
+        for (std::vector<FramePool>& framePools : pools)
+        {
+            for (FramePool& framePool : framePools)
+            {
+                // destroying the pool frees its command buffers
+                vkDestroyCommandPool(device->getDevice(), framePool.pool, nullptr);
+            }
+        }
+    }
+}
+
+VkCommandBuffer CommandContextManager::acquire(QueueType type)
+{
+    ThreadPools& pools = getThreadPools();
+
+    const uint64_t frame = device->getFrameIndex();
+    std::vector<FramePool>& framePools = pools[static_cast<size_t>(type)];
+    if (framePools.empty())
+    {
+        framePools.resize(device->getFramesInFlight());
+    }
+    FramePool& framePool = framePools[frame % framePools.size()];
+
+    if (framePool.pool == VK_NULL_HANDLE)
+    {
+        createPool(framePool, type);
+        framePool.frame = frame;
+    }
+    else if (framePool.frame != frame)
+    {
+        // the pool was last used framesInFlight (or more) frames ago, which advanceFrame usually
+        // waited for already. Its command buffers were submitted in that frame, so once the
+        // frame timelines passed its end, the GPU is done with them
+        device->waitForFrame(framePool.frame);
+        vkResetCommandPool(device->getDevice(), framePool.pool, 0);
+        framePool.used = 0;
+        framePool.frame = frame;
+        poolResets++;
+    }
+
+    if (framePool.used == framePool.commandBuffers.size())
+    {
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = framePool.pool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = 1;
+
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        VkResult result = vkAllocateCommandBuffers(device->getDevice(), &allocInfo, &commandBuffer);
+        if (result != VK_SUCCESS)
+        {
+            throw std::runtime_error("Could not allocate command buffer!");
+        }
+        framePool.commandBuffers.push_back(commandBuffer);
+        commandBuffersAllocated++;
+    }
+
+    acquired++;
+    return framePool.commandBuffers[framePool.used++];
+}
+
+void CommandContextManager::enqueue(QueueType type, CommandSubmission submission)
+{
+    std::lock_guard lock(pendingMutex);
+    pending[static_cast<size_t>(type)].push_back(std::move(submission));
+    submissions++;
+}
+
+VkResult CommandContextManager::submitPending(QueueType type, VkFence fence)
+{
+    std::vector<CommandSubmission> batch;
+    {
+        std::lock_guard lock(pendingMutex);
+        batch.swap(pending[static_cast<size_t>(type)]);
+    }
+    if (batch.empty() && fence == VK_NULL_HANDLE)
+    {
+        return VK_SUCCESS;
+    }
+
+    // the submit infos point into these, so they must not reallocate while filling
+    std::vector<std::vector<VkCommandBufferSubmitInfo>> commandBufferInfos(batch.size());
+    std::vector<VkSubmitInfo2> submitInfos(batch.size());
+    for (size_t i = 0; i < batch.size(); i++)
+    {
+        const CommandSubmission& submission = batch[i];
+        for (VkCommandBuffer commandBuffer : submission.commandBuffers)
+        {
+            VkCommandBufferSubmitInfo& info = commandBufferInfos[i].emplace_back();
+            info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO;
+            info.commandBuffer = commandBuffer;
+        }
+
+        VkSubmitInfo2& submitInfo = submitInfos[i];
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2;
+        submitInfo.commandBufferInfoCount = static_cast<uint32_t>(commandBufferInfos[i].size());
+        submitInfo.pCommandBufferInfos = commandBufferInfos[i].data();
+        submitInfo.waitSemaphoreInfoCount = static_cast<uint32_t>(submission.waitSemaphores.size());
+        submitInfo.pWaitSemaphoreInfos = submission.waitSemaphores.data();
+        submitInfo.signalSemaphoreInfoCount = static_cast<uint32_t>(submission.signalSemaphores.size());
+        submitInfo.pSignalSemaphoreInfos = submission.signalSemaphores.data();
+    }
+
+    queueSubmits++;
+    return device->submit2(type, submitInfos, fence);
+}
+
+CommandContextManager::Stats CommandContextManager::getStats() const
+{
+    Stats stats;
+    stats.acquired = acquired;
+    stats.poolsCreated = poolsCreated;
+    stats.poolResets = poolResets;
+    stats.commandBuffersAllocated = commandBuffersAllocated;
+    stats.submissions = submissions;
+    stats.queueSubmits = queueSubmits;
+    return stats;
+}
+
+CommandContextManager::ThreadPools& CommandContextManager::getThreadPools()
+{
+    // map nodes are stable, so the reference stays valid after unlocking
+    std::lock_guard lock(threadPoolsMutex);
+    return threadPools[std::this_thread::get_id()];
+}
+
+void CommandContextManager::createPool(FramePool& framePool, QueueType type)
+{
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    // short lived command buffers, and they are only ever reset together with the pool
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolInfo.queueFamilyIndex = device->getQueueFamily(type);
+
+    VkResult result = vkCreateCommandPool(device->getDevice(), &poolInfo, nullptr, &framePool.pool);
+    if (result != VK_SUCCESS)
+    {
+        throw std::runtime_error("Could not create command pool!");
+    }
+    VulkanUtils::setDebugName(device->getDevice(), (uint64_t)framePool.pool, VK_OBJECT_TYPE_COMMAND_POOL,
+        "Command Pool (queue type " + std::to_string(static_cast<int>(type)) + ")");
+    poolsCreated++;
+}
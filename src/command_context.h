@@ -0,0 +1,107 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <volk.h>
+
+#include "vulkan_utils.h"
+
+class Device;
+
+/**
+ * A batch of command buffers and semaphores that goes into a single VkSubmitInfo2
+ */
+struct CommandSubmission
+{
+    std::vector<VkCommandBuffer> commandBuffers;
+    std::vector<VkSemaphoreSubmitInfo> waitSemaphores;
+    std::vector<VkSemaphoreSubmitInfo> signalSemaphores;
+};
+
+/**
+ * Hands out command buffers from one pool per thread, queue type and frame in flight.
+ * Command buffers are never freed individually: once the frame that last used a pool
+ * completed on the GPU, see Device::waitForFrame, all of its command buffers are recycled
+ * at once with vkResetCommandPool. A command buffer is therefore only valid during the
+ * frame it was acquired in, and has to be submitted before that frame ends.
+ *
+ * Submissions are collected per queue and go to the GPU with a single vkQueueSubmit2.
+ * Thread safe, the pools of a thread live until the manager is destroyed
+ */
+class CommandContextManager
+{
+public:
+    struct Stats
+    {
+        uint64_t acquired = 0;
+        uint64_t poolsCreated = 0;
+        uint64_t poolResets = 0;
+        uint64_t commandBuffersAllocated = 0;
+        uint64_t submissions = 0;
+        uint64_t queueSubmits = 0;
+    };
+
+    CommandContextManager(Device* device);
+    ~CommandContextManager();
+
+    CommandContextManager(const CommandContextManager&) = delete;
+    CommandContextManager& operator=(const CommandContextManager&) = delete;
+
+    /**
+     * @returns a primary command buffer of the calling thread for the current frame,
+     * ready to be begun
+     */
+    VkCommandBuffer acquire(QueueType type = QueueType::Graphics);
+
+    /**
+     * Queues the submission, it is submitted with the next submitPending for the same queue
+     */
+    void enqueue(QueueType type, CommandSubmission submission);
+    /**
+     * Submits everything queued for the queue in one vkQueueSubmit2
+     * @returns VK_SUCCESS if there was nothing to submit
+     */
+    VkResult submitPending(QueueType type, VkFence fence = VK_NULL_HANDLE);
+
+    Stats getStats() const;
+
+private:
+    struct FramePool
+    {
+        VkCommandPool pool = VK_NULL_HANDLE;
+        std::vector<VkCommandBuffer> commandBuffers;
+        /** number of command buffers handed out in the current frame */
+        size_t used = 0;
+        /** the frame the pool was last used in, its end on the frame timelines guards the reset */
+        uint64_t frame = UINT64_MAX;
+    };
+    static constexpr size_t QUEUE_TYPE_COUNT = 3;
+    /** per queue type, one pool per frame in flight */
+    using ThreadPools = std::array<std::vector<FramePool>, QUEUE_TYPE_COUNT>;
+
+    ThreadPools& getThreadPools();
+    void createPool(FramePool& framePool, QueueType type);
+
+private:
+    Device* device = nullptr;
+
+    /** only the owning thread touches its pools, the mutex guards the map itself */
+    std::map<std::thread::id, ThreadPools> threadPools;
+    std::mutex threadPoolsMutex;
+
+    std::array<std::vector<CommandSubmission>, QUEUE_TYPE_COUNT> pending;
+    std::mutex pendingMutex;
+
+    std::atomic<uint64_t> acquired = 0;
+    std::atomic<uint64_t> poolsCreated = 0;
+    std::atomic<uint64_t> poolResets = 0;
+    std::atomic<uint64_t> commandBuffersAllocated = 0;
+    std::atomic<uint64_t> submissions = 0;
+    std::atomic<uint64_t> queueSubmits = 0;
+};
@@ -0,0 +1,159 @@
+#include "compute_pipelines.h"
+
+#include <sstream>
+#include <stdexcept>
+
+#include "device.h"
+#include "vulkan_utils.h"
+
+ComputePipelines::ComputePipelines(Device* device, std::filesystem::path cacheDirectory)
+    : device(device), spirvCache(cacheDirectory / "spirv")
+{
+    const VkPhysicalDeviceProperties& properties = device->getPhysicalDeviceProperties();
+
+    // one file per device, so switching between graphics cards does not throw the cache away
+    std::ostringstream fileName;
+    fileName << "pipeline_cache_" << std::hex << properties.vendorID << "_" << properties.deviceID << ".bin";
+    pipelineCache = std::make_unique<PipelineCache>(device->getDevice(), properties,
+        cacheDirectory / fileName.str());
+}
+
+ComputePipelines::~ComputePipelines()
+{
+    for (const auto& [name, pipeline] : pipelines)
+    {
+        destroyPipeline(pipeline);
+    }
+}
+
+const ComputePipeline& ComputePipelines::getPipeline(const ComputePipelineDesc& desc)
+{
+    {
+        std::lock_guard lock(mutex);
+        auto it = pipelines.find(desc.name);
+        if (it != pipelines.end())
+        {
+            return it->second;
+        }
+    }
+
+    // compile without holding the lock, other pipelines may be requested in the meantime
+    ComputePipeline pipeline = createPipeline(desc);
+
+    std::lock_guard lock(mutex);
+    auto [it, inserted] = pipelines.emplace(desc.name, pipeline);
+    if (!inserted)
+    {
+        // another thread was faster
+        destroyPipeline(pipeline);
+    }
+    return it->second;
+}
+
+PipelineCache& ComputePipelines::getPipelineCache()
+{
+    return *pipelineCache;
+}
+
+SpirvCache& ComputePipelines::getSpirvCache()
+{
+    return spirvCache;
+}
+
+std::filesystem::path ComputePipelines::getDefaultCacheDirectory()
+{
+    std::error_code error;
+    std::filesystem::path tempDirectory = std::filesystem::temp_directory_path(error);
+    if (error)
+    {
+        tempDirectory = std::filesystem::current_path();
+    }
+    return tempDirectory / "VmaSharedTexBug";
+}
+
+ComputePipeline ComputePipelines::createPipeline(const ComputePipelineDesc& desc)
+{
+    const std::vector<uint32_t> spirv = !desc.spirv.empty() ? desc.spirv
+        : spirvCache.getOrCompile(desc.name, desc.glslSource, shaderc_glsl_compute_shader, desc.entryPoint);
+
+    VkDevice vkDevice = device->getDevice();
+    ComputePipeline pipeline;
+
+    VkDescriptorSetLayoutCreateInfo setLayoutInfo{};
+    setLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    setLayoutInfo.bindingCount = static_cast<uint32_t>(desc.bindings.size());
+    setLayoutInfo.pBindings = desc.bindings.data();
+    VkResult result = vkCreateDescriptorSetLayout(vkDevice, &setLayoutInfo, nullptr, &pipeline.descriptorSetLayout);
+    if (result != VK_SUCCESS)
+    {
+        throw std::runtime_error("Could not create descriptor set layout for " + desc.name + "!");
+    }
+
+    VkPushConstantRange pushConstantRange{};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = desc.pushConstantSize;
+
+    VkPipelineLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    layoutInfo.setLayoutCount = 1;
+    layoutInfo.pSetLayouts = &pipeline.descriptorSetLayout;
+    layoutInfo.pushConstantRangeCount = desc.pushConstantSize > 0 ? 1 : 0;
+    layoutInfo.pPushConstantRanges = &pushConstantRange;
+    result = vkCreatePipelineLayout(vkDevice, &layoutInfo, nullptr, &pipeline.layout);
+    if (result != VK_SUCCESS)
+    {
+        destroyPipeline(pipeline);
+        throw std::runtime_error("Could not create pipeline layout for " + desc.name + "!");
+    }
+
+    VkShaderModuleCreateInfo moduleInfo{};
+    moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    moduleInfo.codeSize = spirv.size() * sizeof(uint32_t);
+    moduleInfo.pCode = spirv.data();
+    VkShaderModule shaderModule = VK_NULL_HANDLE;
+    result = vkCreateShaderModule(vkDevice, &moduleInfo, nullptr, &shaderModule);
+    if (result != VK_SUCCESS)
+    {
+        destroyPipeline(pipeline);
+        throw std::runtime_error("Could not create shader module for " + desc.name + "!");
+    }
+
+    VkComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = shaderModule;
+    pipelineInfo.stage.pName = desc.entryPoint.c_str();
+    pipelineInfo.layout = pipeline.layout;
+
+    result = vkCreateComputePipelines(vkDevice, pipelineCache->getPipelineCache(), 1,
+        &pipelineInfo, nullptr, &pipeline.pipeline);
+    // the module is only needed for creating the pipeline
+    vkDestroyShaderModule(vkDevice, shaderModule, nullptr);
+    if (result != VK_SUCCESS)
+    {
+        destroyPipeline(pipeline);
+        throw std::runtime_error("Could not create compute pipeline " + desc.name + "!");
+    }
+
+    VulkanUtils::setDebugName(vkDevice, (uint64_t)pipeline.pipeline, VK_OBJECT_TYPE_PIPELINE, desc.name);
+    return pipeline;
+}
+
+void ComputePipelines::destroyPipeline(const ComputePipeline& pipeline)
+{
+    VkDevice vkDevice = device->getDevice();
+    if (pipeline.pipeline != VK_NULL_HANDLE)
+    {
+        vkDestroyPipeline(vkDevice, pipeline.pipeline, nullptr);
+    }
+    if (pipeline.layout != VK_NULL_HANDLE)
+    {
+        vkDestroyPipelineLayout(vkDevice, pipeline.layout, nullptr);
+    }
+    if (pipeline.descriptorSetLayout != VK_NULL_HANDLE)
+    {
+        vkDestroyDescriptorSetLayout(vkDevice, pipeline.descriptorSetLayout, nullptr);
+    }
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <volk.h>
+
+#include "pipeline_cache.h"
+#include "spirv_cache.h"
+
+class Device;
+
+struct ComputePipelineDesc
+{
+    /** identifies the pipeline, requesting the same name again returns the same pipeline */
+    std::string name;
+    std::string glslSource;
+    /** already compiled code, e.g. from a ShaderCompiler. If set, glslSource is ignored */
+    std::vector<uint32_t> spirv;
+    std::string entryPoint = "main";
+    /** bindings of descriptor set 0 */
+    std::vector<VkDescriptorSetLayoutBinding> bindings;
+    uint32_t pushConstantSize = 0;
+};
+
+struct ComputePipeline
+{
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    VkPipelineLayout layout = VK_NULL_HANDLE;
+    VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+};
+
+/**
+ * Creates compute pipelines from GLSL. SPIR-V and the VkPipelineCache are both persisted
+ * in the cache directory, so on a warm start neither shaderc nor the driver compiler
+ * have to do much. Pipelines live as long as this object. Thread safe
+ */
+class ComputePipelines
+{
+public:
+    ComputePipelines(Device* device, std::filesystem::path cacheDirectory = getDefaultCacheDirectory());
+    ~ComputePipelines();
+
+    ComputePipelines(const ComputePipelines&) = delete;
+    ComputePipelines& operator=(const ComputePipelines&) = delete;
+
+    /**
+     * @returns the pipeline of the given name, creating it on first use.
+     * Throws if the shader does not compile
+     */
+    const ComputePipeline& getPipeline(const ComputePipelineDesc& desc);
+
+    PipelineCache& getPipelineCache();
+    SpirvCache& getSpirvCache();
+
+    static std::filesystem::path getDefaultCacheDirectory();
+
+private:
+    ComputePipeline createPipeline(const ComputePipelineDesc& desc);
+    void destroyPipeline(const ComputePipeline& pipeline);
+
+private:
+    Device* device = nullptr;
+
+    SpirvCache spirvCache;
+    std::unique_ptr<PipelineCache> pipelineCache;
+
+    /** map nodes are stable, so references handed out stay valid */
+    std::map<std::string, ComputePipeline> pipelines;
+    std::mutex mutex;
+};
@@ -1,6 +1,7 @@
 
 #include "device.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 #include <iostream>
@@ -8,6 +9,12 @@
 #include <set>
 #include <stdexcept>
 
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include "trace.h"
+
 namespace //debugging
 {
 VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
@@ -45,18 +52,62 @@ VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
 }
 }
 
-Device::Device(uint32_t deviceId /*= UINT32_MAX*/) : deviceId(deviceId)
+namespace
 {
-	VkResult result = volkInitialize();
-	if (result != VK_SUCCESS)
-	{
-		throw std::runtime_error("Could not initialize volk!");
-	}
-    setupInstance();
-    volkLoadInstance(instance);
-    choosePhysicalDevice();
-    createLogicalDevice();
-    setupVma();
+template<typename Function>
+std::chrono::microseconds measure(Function&& function)
+{
+    const auto start = std::chrono::steady_clock::now();
+    function();
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+}
+}
+
+Device::Device(uint32_t deviceId /*= UINT32_MAX*/)
+    : Device(DeviceOptions{ deviceId })
+{
+}
+
+Device::Device(const DeviceOptions& options)
+    : Device(options, DeferredStartup{})
+{
+    finishStartup();
+}
+
+Device::Device(const DeviceOptions& options, DeferredStartup)
+    : enableValidationLayers(options.enableValidation), deviceId(options.deviceId)
+{
+    startupTimings.loader = measure([]
+    {
+        VkResult result = volkInitialize();
+        if (result != VK_SUCCESS)
+        {
+            throw std::runtime_error("Could not initialize volk!");
+        }
+    });
+}
+
+std::future<std::unique_ptr<Device>> Device::createAsync(const DeviceOptions& options)
+{
+    // a missing loader is reported right away, on the calling thread
+    std::unique_ptr<Device> device(new Device(options, DeferredStartup{}));
+    return std::async(std::launch::async, [device = std::move(device)]() mutable
+    {
+        device->finishStartup();
+        return std::move(device);
+    });
+}
+
+void Device::finishStartup()
+{
+    startupTimings.instance = measure([this]
+    {
+        setupInstance();
+        volkLoadInstance(instance);
+    });
+    startupTimings.physicalDevice = measure([this] { choosePhysicalDevice(); });
+    startupTimings.logicalDevice = measure([this] { createLogicalDevice(); });
+    startupTimings.allocator = measure([this] { setupVma(); });
 }
 
 Device::Device(bool minimal)
@@ -76,6 +127,36 @@ Device::Device(bool minimal)
 
 Device::~Device()
 {
+    // the dumper reads the allocator until it is gone
+    stopStatsDump();
+    if(device)
+    {
+        // nothing may outlive the device, whether an importer still uses it or not
+        vkDeviceWaitIdle(device);
+        retirementQueue.flush();
+    }
+    for(const auto& [memory, exported] : exportedMemory)
+    {
+        closeHandle(exported.handle);
+    }
+    for(VkSemaphore timeline : frameTimelines)
+    {
+        if(timeline)
+        {
+            vkDestroySemaphore(device, timeline, nullptr);
+        }
+    }
+    computePipelines.reset();
+    gpuTimers.reset();
+    commandContexts.reset();
+    samplerCache.reset();
+    memoryBudget.reset();
+    // pools have to be gone before the allocator
+    interopPools.reset();
+    if(memoryAllocator)
+    {
+        vmaDestroyAllocator(memoryAllocator);
+    }
     if(device)
     {
         vkDestroyDevice(device, nullptr);
@@ -96,9 +177,663 @@ VmaAllocator Device::getAllocator() const
     return memoryAllocator;
 }
 
-VmaPool Device::getSharedPool() const
+const DeviceStartupTimings& Device::getStartupTimings() const
+{
+    return startupTimings;
+}
+
+const VkPhysicalDeviceProperties& Device::getPhysicalDeviceProperties() const
+{
+    return physicalDeviceProperties.properties;
+}
+
+const PhysicalDeviceInfo& Device::getPhysicalDeviceInfo() const
+{
+    return *physicalDeviceInfo;
+}
+
+VkQueue Device::getQueue(QueueType type) const
+{
+    return queues[static_cast<size_t>(type)].queue;
+}
+
+uint32_t Device::getQueueFamily(QueueType type) const
+{
+    return queues[static_cast<size_t>(type)].family;
+}
+
+bool Device::hasDedicatedQueue(QueueType type) const
+{
+    return type != QueueType::Graphics && getQueue(type) != graphicsQueue;
+}
+
+std::span<const uint32_t> Device::getQueueFamilies() const
+{
+    return usedQueueFamilies;
+}
+
+VkResult Device::submit(QueueType type, const VkSubmitInfo& submitInfo, VkFence fence)
+{
+    const QueueSlot& slot = queues[static_cast<size_t>(type)];
+    std::lock_guard lock(queueMutexes[slot.mutexIndex]);
+    return vkQueueSubmit(slot.queue, 1, &submitInfo, fence);
+}
+
+VkResult Device::submit2(QueueType type, std::span<const VkSubmitInfo2> submitInfos, VkFence fence)
+{
+    const QueueSlot& slot = queues[static_cast<size_t>(type)];
+    std::lock_guard lock(queueMutexes[slot.mutexIndex]);
+    return vkQueueSubmit2(slot.queue, static_cast<uint32_t>(submitInfos.size()), submitInfos.data(), fence);
+}
+
+VkQueue Device::getGraphicsQueue() const
+{
+    return graphicsQueue;
+}
+
+uint32_t Device::getGraphicsQueueFamily() const
+{
+    return qfIndices.GraphicsFamily.value();
+}
+
+VkResult Device::submitGraphics(const VkSubmitInfo& submitInfo, VkFence fence)
+{
+    return submit(QueueType::Graphics, submitInfo, fence);
+}
+
+VmaPool Device::getInteropPool(const VkImageCreateInfo& createInfo, const AllocationDecision& decision)
+{
+    return interopPools->getPool(createInfo, decision);
+}
+
+AllocationPolicy& Device::getAllocationPolicy()
+{
+    return *allocationPolicy;
+}
+
+SamplerCache& Device::getSamplerCache()
+{
+    return *samplerCache;
+}
+
+MemoryBudgetMonitor& Device::getMemoryBudget()
+{
+    return *memoryBudget;
+}
+
+CommandContextManager& Device::getCommandContexts()
+{
+    return *commandContexts;
+}
+
+GpuTimers& Device::getGpuTimers()
+{
+    return *gpuTimers;
+}
+
+ComputePipelines& Device::getComputePipelines()
+{
+    // loading the caches touches the disk, which most users of the device never need
+    std::call_once(computePipelinesOnce, [this]
+    {
+        computePipelines = std::make_unique<ComputePipelines>(this);
+    });
+    return *computePipelines;
+}
+
+std::vector<InteropPoolStats> Device::getInteropPoolStats() const
 {
-    return imageInteropPool;
+    return interopPools->getStats();
+}
+
+std::vector<VmaPool> Device::getDefragmentableInteropPools() const
+{
+    return interopPools->getDefragmentablePools();
+}
+
+AllocationTelemetry& Device::getTelemetry()
+{
+    return telemetry;
+}
+
+DeviceStats Device::getStats() const
+{
+    DeviceStats stats = telemetry.getStats();
+    stats.pools = interopPools->getStats();
+    return stats;
+}
+
+std::string Device::buildStatsJson(bool detailedMap) const
+{
+    char* vmaStats = nullptr;
+    vmaBuildStatsString(memoryAllocator, &vmaStats, detailedMap ? VK_TRUE : VK_FALSE);
+    std::string json = "{\"Telemetry\": " + AllocationTelemetry::toJson(getStats())
+        + ", \"Vma\": " + vmaStats + "}";
+    vmaFreeStatsString(memoryAllocator, vmaStats);
+    return json;
+}
+
+void Device::startStatsDump(const std::filesystem::path& file, std::chrono::milliseconds interval)
+{
+    std::lock_guard lock(statsDumperMutex);
+    // the old dumper writes its last dump before the new one starts
+    statsDumper.reset();
+    statsDumper = std::make_unique<StatsDumper>(file, interval, [this] { return buildStatsJson(); });
+}
+
+void Device::stopStatsDump()
+{
+    std::lock_guard lock(statsDumperMutex);
+    statsDumper.reset();
+}
+
+Handle Device::acquireExportedMemory(VkDeviceMemory memory)
+{
+    std::lock_guard lock(exportedMemoryMutex);
+    ExportedMemory& exported = exportedMemory[memory];
+    if(exported.refCount == 0)
+    {
+        exported.handle = exportMemory(memory);
+        telemetry.recordHandleExported();
+    }
+    exported.refCount++;
+    return exported.handle;
+}
+
+void Device::releaseExportedMemory(VkDeviceMemory memory)
+{
+    std::lock_guard lock(exportedMemoryMutex);
+    auto it = exportedMemory.find(memory);
+    assert(it != exportedMemory.end() && "Releasing memory that has never been exported!");
+    if(it == exportedMemory.end())
+    {
+        return;
+    }
+
+    it->second.refCount--;
+    if(it->second.refCount == 0)
+    {
+        closeHandle(it->second.handle);
+        telemetry.recordHandleClosed();
+        exportedMemory.erase(it);
+    }
+}
+
+size_t Device::getExportedMemoryCount() const
+{
+    std::lock_guard lock(exportedMemoryMutex);
+    return exportedMemory.size();
+}
+
+std::unique_ptr<Image> Device::createImageWithFallback(ImageDesc desc)
+{
+    while (true)
+    {
+        try
+        {
+            return std::make_unique<Image>(this, desc);
+        }
+        catch (const MemoryPressureError&)
+        {
+            std::optional<VkFormat> smallerFormat = VulkanUtils::getSmallerFormat(desc.format);
+            if (!smallerFormat)
+            {
+                throw;
+            }
+            desc.format = *smallerFormat;
+        }
+    }
+}
+
+std::vector<std::unique_ptr<Image>> Device::createImages(std::span<const ImageDesc> descs)
+{
+    TRACE_SCOPE("Device::createImages");
+    std::vector<std::unique_ptr<Image>> images(descs.size());
+
+    struct PendingImage
+    {
+        size_t index = 0;
+        VkImage image = VK_NULL_HANDLE;
+        VmaAllocation allocation = VK_NULL_HANDLE;
+        AllocationDecision decision;
+        /** this image's share of its group's allocation call */
+        std::chrono::nanoseconds latency{ 0 };
+    };
+    std::vector<PendingImage> pending;
+    pending.reserve(descs.size());
+
+    // allocations can only be done in one go for identical requirements in the same pool
+    struct GroupKey
+    {
+        VmaPool pool;
+        VkDeviceSize size;
+        VkDeviceSize alignment;
+        uint32_t memoryTypeBits;
+
+        auto operator<=>(const GroupKey&) const = default;
+    };
+    std::map<GroupKey, std::vector<size_t>> groups;
+
+    auto destroyPending = [&]()
+    {
+        for (const PendingImage& p : pending)
+        {
+            vkDestroyImage(device, p.image, nullptr);
+            if (p.allocation)
+            {
+                vmaFreeMemory(memoryAllocator, p.allocation);
+            }
+        }
+    };
+
+    try
+    {
+        // the pooled images are only allocated after the loop, so their sizes add up for the budget
+        VkDeviceSize batchBytes = 0;
+        // create the image objects and gather their memory requirements
+        for (size_t i = 0; i < descs.size(); i++)
+        {
+            VkExternalMemoryImageCreateInfo externalInfo{};
+            VkImageCreateInfo createInfo = Image::makeImageCreateInfo(descs[i], getQueueFamilies(), externalInfo);
+
+            AllocationDecision decision = allocationPolicy->decide(createInfo);
+            memoryBudget->checkAllocation(batchBytes + decision.size, descs[i].priority);
+            if (decision.path == AllocationPath::Dedicated)
+            {
+                // needs VkMemoryDedicatedAllocateInfo for the image, which the page allocation can't do
+                images[i] = std::make_unique<Image>(this, descs[i]);
+                continue;
+            }
+            batchBytes += decision.size;
+
+            VkImage image = VK_NULL_HANDLE;
+            VkResult result = vkCreateImage(device, &createInfo, nullptr, &image);
+            if (result != VK_SUCCESS)
+            {
+                throw std::runtime_error("Could not create image!");
+            }
+            pending.push_back({ i, image, VK_NULL_HANDLE, decision });
+
+            VkMemoryRequirements requirements;
+            vkGetImageMemoryRequirements(device, image, &requirements);
+
+            GroupKey key{ interopPools->getPool(createInfo, decision),
+                requirements.size, requirements.alignment, requirements.memoryTypeBits };
+            groups[key].push_back(pending.size() - 1);
+        }
+
+        // one allocation call per group
+        for (const auto& [key, members] : groups)
+        {
+            VkMemoryRequirements requirements{ key.size, key.alignment, key.memoryTypeBits };
+
+            VmaAllocationCreateInfo allocInfo{};
+            allocInfo.usage = VMA_MEMORY_USAGE_AUTO;
+            allocInfo.pool = key.pool;
+
+            std::vector<VmaAllocation> allocations(members.size());
+            const auto start = std::chrono::steady_clock::now();
+            VkResult result = vmaAllocateMemoryPages(memoryAllocator, &requirements, &allocInfo,
+                allocations.size(), allocations.data(), nullptr);
+            if (result != VK_SUCCESS)
+            {
+                throw std::runtime_error("VMA could not allocate memory for images!");
+            }
+            const std::chrono::nanoseconds latency = (std::chrono::steady_clock::now() - start) / members.size();
+            for (size_t m = 0; m < members.size(); m++)
+            {
+                pending[members[m]].allocation = allocations[m];
+                pending[members[m]].latency = latency;
+            }
+        }
+
+        // bind everything at once
+        std::vector<VkBindImageMemoryInfo> bindInfos;
+        bindInfos.reserve(pending.size());
+        for (const PendingImage& p : pending)
+        {
+            VmaAllocationInfo allocInfo;
+            vmaGetAllocationInfo(memoryAllocator, p.allocation, &allocInfo);
+
+            VkBindImageMemoryInfo& bindInfo = bindInfos.emplace_back();
+            bindInfo.sType = VK_STRUCTURE_TYPE_BIND_IMAGE_MEMORY_INFO;
+            bindInfo.image = p.image;
+            bindInfo.memory = allocInfo.deviceMemory;
+            bindInfo.memoryOffset = allocInfo.offset;
+        }
+        if (!bindInfos.empty())
+        {
+            VkResult result = vkBindImageMemory2(device, static_cast<uint32_t>(bindInfos.size()),
+                bindInfos.data());
+            if (result != VK_SUCCESS)
+            {
+                throw std::runtime_error("Could not bind image memory!");
+            }
+        }
+    }
+    catch (...)
+    {
+        destroyPending();
+        throw;
+    }
+
+    // the images take over ownership here, views, samplers and exports are created per image,
+    // while images in the same block share the export
+    for (size_t p = 0; p < pending.size(); p++)
+    {
+        const PendingImage& img = pending[p];
+        try
+        {
+            images[img.index] = std::unique_ptr<Image>(
+                new Image(this, descs[img.index], img.image, img.allocation, img.decision));
+        }
+        catch (...)
+        {
+            // the Image constructor released its view, sampler and export, the image and
+            // allocation are still pending. The ones before are owned by their images
+            pending.erase(pending.begin(), pending.begin() + p);
+            destroyPending();
+            throw;
+        }
+    }
+    // every pending image is owned by its Image now, so nothing can be freed twice
+    for (const PendingImage& img : pending)
+    {
+        telemetry.recordAllocation(img.decision, images[img.index]->getExternalMemoryRange().size, img.latency);
+    }
+
+    return images;
+}
+
+VkSemaphore Device::createExportableTimelineSemaphore(uint64_t initialValue) const
+{
+    VkSemaphoreTypeCreateInfo typeInfo{};
+    typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    typeInfo.initialValue = initialValue;
+
+    // make sure the implementation can actually export timelines
+    VkPhysicalDeviceExternalSemaphoreInfo externalInfo{};
+    externalInfo.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_SEMAPHORE_INFO;
+    externalInfo.pNext = &typeInfo;
+    externalInfo.handleType = EXTERNAL_SEMAPHORE_HANDLE_TYPE;
+
+    VkExternalSemaphoreProperties externalProps{};
+    externalProps.sType = VK_STRUCTURE_TYPE_EXTERNAL_SEMAPHORE_PROPERTIES;
+    vkGetPhysicalDeviceExternalSemaphoreProperties(physicalDevice, &externalInfo, &externalProps);
+    if (!(externalProps.externalSemaphoreFeatures & VK_EXTERNAL_SEMAPHORE_FEATURE_EXPORTABLE_BIT))
+    {
+        throw std::runtime_error("Timeline semaphores cannot be exported on this device!");
+    }
+
+    VkExportSemaphoreCreateInfo exportInfo{};
+    exportInfo.sType = VK_STRUCTURE_TYPE_EXPORT_SEMAPHORE_CREATE_INFO;
+    exportInfo.handleTypes = EXTERNAL_SEMAPHORE_HANDLE_TYPE;
+    typeInfo.pNext = &exportInfo;
+
+    VkSemaphoreCreateInfo createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    createInfo.pNext = &typeInfo;
+
+    VkSemaphore semaphore = VK_NULL_HANDLE;
+    VkResult result = vkCreateSemaphore(device, &createInfo, nullptr, &semaphore);
+    if (result != VK_SUCCESS)
+    {
+        throw std::runtime_error("Could not create exportable timeline semaphore!");
+    }
+    return semaphore;
+}
+
+VkDeviceMemory Device::importMemory(const ExternalMemoryRange& range, VkImage dedicatedImage) const
+{
+    if (range.dedicated && dedicatedImage == VK_NULL_HANDLE)
+    {
+        throw std::runtime_error("Dedicated memory can only be imported together with its image!");
+    }
+    VkMemoryDedicatedAllocateInfo dedicatedInfo{};
+    dedicatedInfo.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO;
+    dedicatedInfo.image = dedicatedImage;
+
+#if _WIN32
+    VkImportMemoryWin32HandleInfoKHR importInfo{};
+    importInfo.sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_WIN32_HANDLE_INFO_KHR;
+    importInfo.handleType = EXTERNAL_MEMORY_HANDLE_TYPE;
+    // importing a win32 handle does not take its ownership
+    importInfo.handle = range.handle;
+#else
+    VkImportMemoryFdInfoKHR importInfo{};
+    importInfo.sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_FD_INFO_KHR;
+    importInfo.handleType = EXTERNAL_MEMORY_HANDLE_TYPE;
+    // a successful import owns the fd, so it gets a copy
+    importInfo.fd = dup(range.handle);
+#endif
+    importInfo.pNext = range.dedicated ? &dedicatedInfo : nullptr;
+
+    VkMemoryAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.pNext = &importInfo;
+    allocInfo.allocationSize = range.allocationSize;
+    allocInfo.memoryTypeIndex = range.memoryTypeIndex;
+
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkResult result = vkAllocateMemory(device, &allocInfo, nullptr, &memory);
+    if (result != VK_SUCCESS)
+    {
+#if !_WIN32
+        close(importInfo.fd);
+#endif
+        throw std::runtime_error("Could not import memory!");
+    }
+    return memory;
+}
+
+VkSemaphore Device::importTimelineSemaphore(Handle handle) const
+{
+    VkSemaphoreTypeCreateInfo typeInfo{};
+    typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    typeInfo.initialValue = 0;
+
+    VkSemaphoreCreateInfo createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    createInfo.pNext = &typeInfo;
+
+    VkSemaphore semaphore = VK_NULL_HANDLE;
+    VkResult result = vkCreateSemaphore(device, &createInfo, nullptr, &semaphore);
+    if (result != VK_SUCCESS)
+    {
+        throw std::runtime_error("Could not create timeline semaphore for import!");
+    }
+
+#if _WIN32
+    VkImportSemaphoreWin32HandleInfoKHR importInfo{};
+    importInfo.sType = VK_STRUCTURE_TYPE_IMPORT_SEMAPHORE_WIN32_HANDLE_INFO_KHR;
+    importInfo.semaphore = semaphore;
+    importInfo.handleType = EXTERNAL_SEMAPHORE_HANDLE_TYPE;
+    importInfo.handle = handle;
+    result = vkImportSemaphoreWin32HandleKHR(device, &importInfo);
+#else
+    VkImportSemaphoreFdInfoKHR importInfo{};
+    importInfo.sType = VK_STRUCTURE_TYPE_IMPORT_SEMAPHORE_FD_INFO_KHR;
+    importInfo.semaphore = semaphore;
+    importInfo.handleType = EXTERNAL_SEMAPHORE_HANDLE_TYPE;
+    importInfo.fd = handle;
+    result = vkImportSemaphoreFdKHR(device, &importInfo);
+#endif
+    if (result != VK_SUCCESS)
+    {
+        vkDestroySemaphore(device, semaphore, nullptr);
+        throw std::runtime_error("Could not import timeline semaphore!");
+    }
+    return semaphore;
+}
+
+Handle Device::exportSemaphore(VkSemaphore semaphore) const
+{
+    Handle handle = INVALID_HANDLE_VALUE;
+#if _WIN32
+    VkSemaphoreGetWin32HandleInfoKHR handleInfo{};
+    handleInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_GET_WIN32_HANDLE_INFO_KHR;
+    handleInfo.semaphore = semaphore;
+    handleInfo.handleType = EXTERNAL_SEMAPHORE_HANDLE_TYPE;
+    VkResult result = vkGetSemaphoreWin32HandleKHR(device, &handleInfo, &handle);
+#else
+    VkSemaphoreGetFdInfoKHR fdInfo{};
+    fdInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_GET_FD_INFO_KHR;
+    fdInfo.semaphore = semaphore;
+    fdInfo.handleType = EXTERNAL_SEMAPHORE_HANDLE_TYPE;
+    VkResult result = vkGetSemaphoreFdKHR(device, &fdInfo, &handle);
+#endif
+    if (result != VK_SUCCESS)
+    {
+        throw std::runtime_error("Could not export semaphore handle!");
+    }
+    return handle;
+}
+
+void Device::destroySemaphore(VkSemaphore semaphore) const
+{
+    vkDestroySemaphore(device, semaphore, nullptr);
+}
+
+void Device::signalTimeline(VkSemaphore timeline, uint64_t value) const
+{
+    VkSemaphoreSignalInfo signalInfo{};
+    signalInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SIGNAL_INFO;
+    signalInfo.semaphore = timeline;
+    signalInfo.value = value;
+
+    VkResult result = vkSignalSemaphore(device, &signalInfo);
+    if (result != VK_SUCCESS)
+    {
+        throw std::runtime_error("Could not signal the timeline semaphore!");
+    }
+}
+
+bool Device::waitTimeline(VkSemaphore timeline, uint64_t value, uint64_t timeoutNs) const
+{
+    VkSemaphoreWaitInfo waitInfo{};
+    waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    waitInfo.semaphoreCount = 1;
+    waitInfo.pSemaphores = &timeline;
+    waitInfo.pValues = &value;
+
+    VkResult result = vkWaitSemaphores(device, &waitInfo, timeoutNs);
+    if (result == VK_TIMEOUT)
+    {
+        return false;
+    }
+    if (result != VK_SUCCESS)
+    {
+        throw std::runtime_error("Could not wait for the timeline semaphore!");
+    }
+    return true;
+}
+
+uint64_t Device::getTimelineValue(VkSemaphore timeline) const
+{
+    uint64_t value = 0;
+    vkGetSemaphoreCounterValue(device, timeline, &value);
+    return value;
+}
+
+void Device::retire(std::function<void()> deleter, std::function<bool()> isIdle, uint64_t lastUsedFrame)
+{
+    retirementQueue.retire(std::min<uint64_t>(frameIndex, lastUsedFrame), std::move(deleter), std::move(isIdle));
+}
+
+uint64_t Device::advanceFrame()
+{
+    // the index moves before the end is signaled: whatever is retired with the old index
+    // was submitted before the signal, and so is covered by it
+    const uint64_t endedFrame = frameIndex++;
+    const uint64_t newFrame = endedFrame + 1;
+    signalFrameEnd(endedFrame);
+    if(newFrame >= framesInFlight)
+    {
+        // the per frame resources handed out for the new frame were last used by this frame
+        waitForFrame(newFrame - framesInFlight);
+    }
+
+    // lets the caches shrink before allocations start to get refused
+    memoryBudget->poll();
+    gpuTimers->beginFrame(newFrame);
+    collectRetired();
+    return newFrame;
+}
+
+bool Device::isFrameComplete(uint64_t frame) const
+{
+    return getCompletedFrameCount() > frame;
+}
+
+bool Device::waitForFrame(uint64_t frame, uint64_t timeoutNs) const
+{
+    if(frame >= frameIndex)
+    {
+        throw std::runtime_error("Can only wait for frames that have ended!");
+    }
+
+    std::vector<VkSemaphore> timelines;
+    for(VkSemaphore timeline : frameTimelines)
+    {
+        if(timeline)
+        {
+            timelines.push_back(timeline);
+        }
+    }
+    const std::vector<uint64_t> values(timelines.size(), frame + 1);
+
+    VkSemaphoreWaitInfo waitInfo{};
+    waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    waitInfo.semaphoreCount = static_cast<uint32_t>(timelines.size());
+    waitInfo.pSemaphores = timelines.data();
+    waitInfo.pValues = values.data();
+    VkResult result = vkWaitSemaphores(device, &waitInfo, timeoutNs);
+    if(result == VK_TIMEOUT)
+    {
+        return false;
+    }
+    if(result != VK_SUCCESS)
+    {
+        throw std::runtime_error("Could not wait for the frame to complete!");
+    }
+    return true;
+}
+
+void Device::collectRetired(uint64_t completedFrame)
+{
+    retirementQueue.collect(completedFrame);
+}
+
+void Device::collectRetired()
+{
+    const uint64_t completedFrames = getCompletedFrameCount();
+    if(completedFrames > 0)
+    {
+        collectRetired(completedFrames - 1);
+    }
+}
+
+void Device::flushRetired()
+{
+    vkDeviceWaitIdle(device);
+    retirementQueue.collect(UINT64_MAX);
+}
+
+size_t Device::getRetiredCount() const
+{
+    return retirementQueue.getPendingCount();
+}
+
+uint64_t Device::getFrameIndex() const
+{
+    return frameIndex;
+}
+
+uint32_t Device::getFramesInFlight() const
+{
+    return framesInFlight;
 }
 
 std::vector<std::pair<uint32_t, std::string>> Device::getDevices()
@@ -107,23 +842,19 @@ std::vector<std::pair<uint32_t, std::string>> Device::getDevices()
     // need an instance to query devices
     Device d(true);
 
-	uint32_t deviceCount = 0;
-	vkEnumeratePhysicalDevices(d.instance, &deviceCount, nullptr);
-	if (deviceCount == 0)
-	{
-		throw std::runtime_error("failed to find GPUs with Vulkan support!");
-	}
-
-    std::vector<VkPhysicalDevice> physicalDevices(deviceCount);
-	vkEnumeratePhysicalDevices(d.instance, &deviceCount, physicalDevices.data());
+    PhysicalDeviceCatalog catalog(d.instance, PhysicalDeviceCatalog::getDefaultSnapshotFile());
+    if (catalog.getDevices().empty())
+    {
+        throw std::runtime_error("failed to find GPUs with Vulkan support!");
+    }
+    if (!catalog.wasLoadedFromSnapshot())
+    {
+        catalog.saveSnapshot();
+    }
 
-    for(uint32_t i = 0; i < deviceCount; i++)
+    for (const PhysicalDeviceInfo& info : catalog.getDevices())
     {
-        VkPhysicalDevice physicalDevice = physicalDevices[i];
-        VkPhysicalDeviceProperties deviceProps;
-        vkGetPhysicalDeviceProperties(physicalDevice, &deviceProps);
-        // std::cout << "Using " << deviceProps.deviceName << std::endl;
-        devices.push_back({i, deviceProps.deviceName});
+        devices.push_back({info.index, info.properties.deviceName});
     }
 
     return devices;
@@ -145,6 +876,7 @@ void populateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT& create
 
 void Device::setupInstance()
 {
+	TRACE_SCOPE("Device::setupInstance");
 	if (enableValidationLayers && !VulkanUtils::areInstanceLayersSupported(validationLayers))
 	{
         std::cout << "Validation layers requested but not available!" << std::endl;
@@ -220,9 +952,16 @@ void Device::setupInstance()
 
 void Device::choosePhysicalDevice()
 {
-	uint32_t deviceCount = 0;
-	vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
+	TRACE_SCOPE("Device::choosePhysicalDevice");
+	// enumerate and query everything once, the snapshot saves most of it on the next launch
+	physicalDeviceCatalog = std::make_unique<PhysicalDeviceCatalog>(instance,
+		PhysicalDeviceCatalog::getDefaultSnapshotFile());
+	if (!physicalDeviceCatalog->wasLoadedFromSnapshot())
+	{
+		physicalDeviceCatalog->saveSnapshot();
+	}
 
+	const uint32_t deviceCount = static_cast<uint32_t>(physicalDeviceCatalog->getDevices().size());
 	if (deviceCount == 0)
 	{
 		throw std::runtime_error("failed to find GPUs with Vulkan support!");
@@ -236,44 +975,33 @@ void Device::choosePhysicalDevice()
     {
         choosePhysicalDeviceByRating();
     }
+
+	physicalDevice = physicalDeviceInfo->physicalDevice;
+	// store the physical device properties such that 
+	// they don't have to be queried every time they are needed
+	physicalDeviceProperties = {};
+	physicalDeviceProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+	physicalDeviceProperties.properties = physicalDeviceInfo->properties;
+	memoryProperties = physicalDeviceInfo->memoryProperties;
 }
 
 void Device::choosePhysicalDeviceById()
 {
+    TRACE_SCOPE("Device::choosePhysicalDeviceById");
     std::cout << "choosing physical device by id" << std::endl;
 
-	uint32_t deviceCount = 0;
-	vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
-
-    if(deviceId > deviceCount -1)
+	const std::vector<PhysicalDeviceInfo>& devices = physicalDeviceCatalog->getDevices();
+    if(deviceId > devices.size() - 1)
     {
         throw std::runtime_error("Invalid device id chosen!");
     }
 
-	std::vector<VkPhysicalDevice> devices(deviceCount);
-	// use a multimap to have a map sorted by score
-	std::multimap<uint32_t, VkPhysicalDevice> candidates;
-	vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
-
-    physicalDevice = devices[deviceId];
-	VkPhysicalDeviceProperties deviceProps;
-	vkGetPhysicalDeviceProperties(physicalDevice, &deviceProps);
+    physicalDeviceInfo = &devices[deviceId];
     std::cout << "Using device " 
-        + std::to_string(deviceId) + " : " + deviceProps.deviceName 
+        + std::to_string(deviceId) + " : " + physicalDeviceInfo->properties.deviceName 
         + " as per user request" << std::endl;
 
-    // setup similar to the one in choosing device by rating
-	physicalDeviceProperties.pNext = nullptr;
-    physicalDeviceProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
-    vkGetPhysicalDeviceProperties2(physicalDevice, &physicalDeviceProperties );
-
-    VkPhysicalDeviceMemoryProperties2 memoryProps{};
-    // check that interop is actually possible
-    memoryProps.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
-    vkGetPhysicalDeviceMemoryProperties2(physicalDevice, &memoryProps);
-    memoryProperties = memoryProps.memoryProperties;
-
-    uint32_t score = ratePhysicalDevice(physicalDevice);
+    uint32_t score = ratePhysicalDevice(*physicalDeviceInfo);
     if(score == 0)
     {
         throw std::runtime_error("Chosen device does not support all necessary extensions!");
@@ -282,27 +1010,21 @@ void Device::choosePhysicalDeviceById()
 
 void Device::choosePhysicalDeviceByRating()
 {
-	uint32_t deviceCount = 0;
-	vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
-
+    TRACE_SCOPE("Device::choosePhysicalDeviceByRating");
     std::cout << "choosing physical device by rating" << std::endl;
-	std::vector<VkPhysicalDevice> devices(deviceCount);
 	// use a multimap to have a map sorted by score
-	std::multimap<uint32_t, VkPhysicalDevice> candidates;
-	vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
+	std::multimap<uint32_t, const PhysicalDeviceInfo*> candidates;
 
-	for (const auto& device : devices)
+	for (const PhysicalDeviceInfo& info : physicalDeviceCatalog->getDevices())
 	{
-		uint32_t score = ratePhysicalDevice(device);
-		candidates.insert({ score, device });
+		uint32_t score = ratePhysicalDevice(info);
+		candidates.insert({ score, &info });
 	}
 
 	if (candidates.rbegin()->first > 0)
 	{
 		// best candidate is a suitable one (since the score is >0)
-		physicalDevice = candidates.rbegin()->second;
-        // TODO: probably unnecessary
-		// setOptionalExtensionAvailability();
+		physicalDeviceInfo = candidates.rbegin()->second;
 	}
 	else
 	{
@@ -310,36 +1032,20 @@ void Device::choosePhysicalDeviceByRating()
 	}
 
 	// tell the user which device was chosen
-	VkPhysicalDeviceProperties deviceProps;
-	vkGetPhysicalDeviceProperties(physicalDevice, &deviceProps);
-    std::cout << "Using " << deviceProps.deviceName << std::endl;
+    std::cout << "Using " << physicalDeviceInfo->properties.deviceName << std::endl;
 
 	// tell the user which devices are available, but are rejected
 	for (const auto& pair_scoreToDevice : candidates)
 	{
 		uint32_t score = pair_scoreToDevice.first;
-		VkPhysicalDevice candidate = pair_scoreToDevice.second;
-
-		VkPhysicalDeviceProperties2 candidateProps{};
-		candidateProps.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
-		vkGetPhysicalDeviceProperties2(candidate, &candidateProps);
-
-		if (candidate == physicalDevice)
+		const PhysicalDeviceInfo* candidate = pair_scoreToDevice.second;
+		if (candidate == physicalDeviceInfo)
 		{
-			// store the physical device properties such that 
-			// they don't have to be queried every time they are needed
-			physicalDeviceProperties = candidateProps;
-
-            VkPhysicalDeviceMemoryProperties2 memoryProps{};
-            // check that interop is actually possible
-            memoryProps.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
-            vkGetPhysicalDeviceMemoryProperties2(physicalDevice, &memoryProps);
-            memoryProperties = memoryProps.memoryProperties;
 			continue;
 		}
 
 		std::string logStr = "Rejected ";
-		logStr += candidateProps.properties.deviceName;
+		logStr += candidate->properties.deviceName;
 		if (score > 0)
 		{
 			logStr += " due to lower score.";
@@ -352,55 +1058,45 @@ void Device::choosePhysicalDeviceByRating()
 	}
 }
 
-uint32_t Device::ratePhysicalDevice(VkPhysicalDevice phyDevice) const
+uint32_t Device::ratePhysicalDevice(const PhysicalDeviceInfo& info) const
 {
 	uint32_t score = 0;
 
-	VkPhysicalDeviceProperties deviceProps;
-	vkGetPhysicalDeviceProperties(phyDevice, &deviceProps);
-
-	VkPhysicalDeviceFeatures deviceFeatures;
-	vkGetPhysicalDeviceFeatures(phyDevice, &deviceFeatures);
-
-	if (deviceProps.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU)
+	if (info.properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU)
 	{
 		score += 1000;
 	}
-	else if (deviceProps.deviceType == VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU)
+	else if (info.properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU)
 	{
 		score += 500;
 	}
 	// if the device is CPU / virtual GPU, don't improve the score
 
-	// check if the device address feature is supported
-	VkPhysicalDeviceFeatures2 deviceFeatures2{};
-	deviceFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
-	VkPhysicalDeviceBufferDeviceAddressFeatures deviceAddressFeatures{};
-	deviceAddressFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_BUFFER_DEVICE_ADDRESS_FEATURES;
-	deviceFeatures2.pNext = &deviceAddressFeatures;
-
-	vkGetPhysicalDeviceFeatures2(phyDevice, &deviceFeatures2);
-
-	bool areExtensionsSupported = areRequiredDeviceExtensionsSupported(phyDevice);
+	bool areExtensionsSupported = areRequiredDeviceExtensionsSupported(info);
 	bool isSwapchainAdequate = false;
 	if (areExtensionsSupported && !renderOffscreenOnly)
 	{
-		SwapchainSupportDetails swapChainSupport = VulkanUtils::getSwapchainSupportDetails(phyDevice, surface);
+		SwapchainSupportDetails swapChainSupport = VulkanUtils::getSwapchainSupportDetails(info.physicalDevice, surface);
 		isSwapchainAdequate = !swapChainSupport.Formats.empty()
 			&& !swapChainSupport.PresentModes.empty();
 	}
 
-	QueueFamilyIndices indices = VulkanUtils::findQueueFamilies(phyDevice, surface);
+	QueueFamilyIndices indices = VulkanUtils::findQueueFamilies(info.physicalDevice, surface, info.queueFamilies);
 
 	// if something important is missing, set score to 0
+	// (timelines synchronize interop images with their consumers, submissions are batched with vkQueueSubmit2,
+	// GPU timers reset their queries on the host)
 	if (!indices.GraphicsFamily.has_value()
 		|| (!renderOffscreenOnly && !indices.PresentFamily.has_value())
 		|| !areExtensionsSupported
 		|| (!renderOffscreenOnly && !isSwapchainAdequate)
-		|| !deviceFeatures.samplerAnisotropy
-		|| !deviceAddressFeatures.bufferDeviceAddress)
+		|| !info.features.samplerAnisotropy
+		|| !info.bufferDeviceAddress
+		|| !info.timelineSemaphore
+		|| !info.synchronization2
+		|| !info.hostQueryReset)
 	{
-		const std::string logStr = std::string(deviceProps.deviceName) + " does not support all required features!";
+		const std::string logStr = std::string(info.properties.deviceName) + " does not support all required features!";
         std::cout << logStr << std::endl;
 
 		return 0;
@@ -411,7 +1107,8 @@ uint32_t Device::ratePhysicalDevice(VkPhysicalDevice phyDevice) const
 
 void Device::createLogicalDevice()
 {
-	qfIndices = VulkanUtils::findQueueFamilies(physicalDevice, surface);
+	TRACE_SCOPE("Device::createLogicalDevice");
+	qfIndices = VulkanUtils::findQueueFamilies(physicalDevice, surface, physicalDeviceInfo->queueFamilies);
 
 	std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
 	std::set<uint32_t> uniqueQueueFamilies = {
@@ -421,6 +1118,14 @@ void Device::createLogicalDevice()
 	{
 		uniqueQueueFamilies.insert(qfIndices.PresentFamily.value());
 	}
+	if (qfIndices.ComputeFamily.has_value())
+	{
+		uniqueQueueFamilies.insert(qfIndices.ComputeFamily.value());
+	}
+	if (qfIndices.TransferFamily.has_value())
+	{
+		uniqueQueueFamilies.insert(qfIndices.TransferFamily.value());
+	}
 	float queuePriority = 1.0f; // required, even if there is only one queue. 1.0f is highest priority
 
 	for (uint32_t queueFamily : uniqueQueueFamilies)
@@ -432,9 +1137,6 @@ void Device::createLogicalDevice()
 		queueCreateInfo.pQueuePriorities = &queuePriority;
 		queueCreateInfos.push_back(queueCreateInfo);
 	}
-	VkPhysicalDeviceFeatures deviceFeatures{};
-	deviceFeatures.samplerAnisotropy = VK_TRUE;
-
 	std::vector<const char*> deviceExtensions = requiredDeviceExtensions;
 	if (!renderOffscreenOnly)
 	{
@@ -444,6 +1146,10 @@ void Device::createLogicalDevice()
     deviceExtensions.insert(deviceExtensions.end(),
         interopDeviceExtensions.begin(), interopDeviceExtensions.end());
 
+	for (auto& [extension, available] : optionalDeviceExtensions)
+	{
+		available = physicalDeviceInfo->hasExtension(extension);
+	}
 	enableAvailableOptionalDeviceExtensions(deviceExtensions, optionalDeviceExtensions);
 
 	VkPhysicalDeviceFeatures2 physicalDeviceFeatures{};
@@ -454,9 +1160,22 @@ void Device::createLogicalDevice()
 	bufferDeviceAddressFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_BUFFER_DEVICE_ADDRESS_FEATURES;
 
 	physicalDeviceFeatures.pNext = &bufferDeviceAddressFeatures;
-	physicalDeviceFeatures.features = deviceFeatures;
-
-	vkGetPhysicalDeviceFeatures2(physicalDevice, &physicalDeviceFeatures);
+	VkPhysicalDeviceTimelineSemaphoreFeatures timelineFeatures{};
+	timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+	bufferDeviceAddressFeatures.pNext = &timelineFeatures;
+	VkPhysicalDeviceSynchronization2Features synchronization2Features{};
+	synchronization2Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES;
+	timelineFeatures.pNext = &synchronization2Features;
+	VkPhysicalDeviceHostQueryResetFeatures hostQueryResetFeatures{};
+	hostQueryResetFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_QUERY_RESET_FEATURES;
+	synchronization2Features.pNext = &hostQueryResetFeatures;
+
+	// everything the device supports, as queried by the catalog
+	physicalDeviceFeatures.features = physicalDeviceInfo->features;
+	bufferDeviceAddressFeatures.bufferDeviceAddress = physicalDeviceInfo->bufferDeviceAddress;
+	timelineFeatures.timelineSemaphore = physicalDeviceInfo->timelineSemaphore;
+	synchronization2Features.synchronization2 = physicalDeviceInfo->synchronization2;
+	hostQueryResetFeatures.hostQueryReset = physicalDeviceInfo->hostQueryReset;
 
 	VkDeviceCreateInfo createInfo{};
 	createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
@@ -491,10 +1210,17 @@ void Device::createLogicalDevice()
 
 
 	fetchQueues();
+	createFrameTimelines();
+
+	samplerCache = std::make_unique<SamplerCache>(device,
+		physicalDeviceProperties.properties.limits.maxSamplerAnisotropy);
+	commandContexts = std::make_unique<CommandContextManager>(this);
+	gpuTimers = std::make_unique<GpuTimers>(this, framesInFlight);
 }
 
 void Device::setupVma()
 {
+	TRACE_SCOPE("Device::setupVma");
 	// set up dynamic vulkan functions via volk for VMA
 	VmaVulkanFunctions vmaVkFunctions{};
 	{
@@ -533,7 +1259,13 @@ void Device::setupVma()
 	createInfo.device = device;
 	createInfo.vulkanApiVersion = vulkanApiVersion;
 	createInfo.pVulkanFunctions = &vmaVkFunctions;
+	// VMA_ALLOCATOR_CREATE_EXTERNALLY_SYNCHRONIZED_BIT must not be set,
+	// images are created and destroyed from several threads
 	createInfo.flags = VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT;
+	if (isOptionalDeviceExtensionEnabled(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME))
+	{
+		createInfo.flags |= VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT;
+	}
 
 	VkResult result = vmaCreateAllocator(&createInfo, &memoryAllocator);
 	if (result != VK_SUCCESS)
@@ -541,63 +1273,12 @@ void Device::setupVma()
 		throw std::runtime_error("Could not create Vulkan Memory Allocator!");
 	}
 
-    // create an example image creation struct to get the correct memory type for the pool
-    VkImageCreateInfo exampleImgInfo{};
-    exampleImgInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-    exampleImgInfo.imageType = VK_IMAGE_TYPE_2D;
-    exampleImgInfo.format = VK_FORMAT_R32G32B32A32_SFLOAT;
-    exampleImgInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
-    exampleImgInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-    exampleImgInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
-    exampleImgInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-    exampleImgInfo.flags = 0;
-    exampleImgInfo.mipLevels = 1;
-    exampleImgInfo.arrayLayers = 1;
-    exampleImgInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    exampleImgInfo.queueFamilyIndexCount = 1;
-    exampleImgInfo.pQueueFamilyIndices = &qfIndices.GraphicsFamily.value();
-    exampleImgInfo.extent = VkExtent3D(1, 1, 1);
-
-    VkExternalMemoryImageCreateInfo extMemInfo{ VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_IMAGE_CREATE_INFO };
-#ifdef WIN32
-    extMemInfo.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_WIN32_BIT;
-#else
-    extMemInfo.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT;
-#endif
-    exampleImgInfo.pNext = &extMemInfo;
-
-
-    // allocation for the example image 
-    VmaAllocationCreateInfo allocCreateInfo = {};
-    allocCreateInfo.usage = VMA_MEMORY_USAGE_AUTO;
-
-    uint32_t memTypeIndex;
-    vmaFindMemoryTypeIndexForImageInfo(memoryAllocator, &exampleImgInfo, &allocCreateInfo,
-                                       &memTypeIndex);
-
-    // create an extra pool which will handle memory and allocations for shared resources
-    poolCreateInfo.memoryTypeIndex = memTypeIndex;
-
-    std::memset(&exportMemAllocInfo, 0, sizeof(exportMemAllocInfo));
-    exportMemAllocInfo.sType = VK_STRUCTURE_TYPE_EXPORT_MEMORY_ALLOCATE_INFO;
-#ifdef _WIN32
-    exportMemAllocInfo.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_WIN32_BIT;
-#else
-    exportMemAllocInfo.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT;
-#endif
-    poolCreateInfo.pMemoryAllocateNext = &exportMemAllocInfo;
-
-    result = vmaCreatePool(memoryAllocator, &poolCreateInfo, 
-                                    &imageInteropPool);
-    if (result != VK_SUCCESS)
-    {
-        throw std::runtime_error("Could not create allocation pool for interop resources!");
-    }
-    else
-{
-        vmaSetPoolName(memoryAllocator, imageInteropPool, "Image Interop Pool");
-    }
-
+    // the interop pools are created on demand, once the size and usage of the images is known
+    interopPools = std::make_unique<InteropPoolManager>(device, memoryAllocator);
+    allocationPolicy = std::make_unique<AllocationPolicy>(device, physicalDevice);
+    memoryBudget = std::make_unique<MemoryBudgetMonitor>(memoryAllocator, memoryProperties);
+    // evicted images are only retired, the idle ones can go right away
+    memoryBudget->setReclaimHandler([this]() { collectRetired(); });
 }
 
 std::vector<const char*> Device::getRequiredInstanceExtensions() const
@@ -617,25 +1298,37 @@ std::vector<const char*> Device::getRequiredInstanceExtensions() const
 	return extensions;
 }
 
-bool Device::areRequiredDeviceExtensionsSupported(VkPhysicalDevice device) const
+bool Device::areRequiredDeviceExtensionsSupported(const PhysicalDeviceInfo& info) const
 {
-	if (!VulkanUtils::areDeviceExtensionsAvailable(device, requiredDeviceExtensions))
+	if (!info.hasExtensions(requiredDeviceExtensions))
 	{
 		return false;
 	}
     if (!renderOffscreenOnly 
-        && !VulkanUtils::areDeviceExtensionsAvailable(device, requiredOnScreenRenderingDeviceExtensions))
+        && !info.hasExtensions(requiredOnScreenRenderingDeviceExtensions))
     {
         return false;
     }
 	
-	if (!VulkanUtils::areDeviceExtensionsAvailable(device, interopDeviceExtensions))
+	if (!info.hasExtensions(interopDeviceExtensions))
 	{
 		return false;
 	}
 	return true;
 }
 
+bool Device::isOptionalDeviceExtensionEnabled(const char* extension) const
+{
+	for (const auto& [optionalExtension, available] : optionalDeviceExtensions)
+	{
+		if (strcmp(optionalExtension, extension) == 0)
+		{
+			return available;
+		}
+	}
+	return false;
+}
+
 void Device::enableAvailableOptionalDeviceExtensions(std::vector<const char*>& deviceExtensions, const std::map<const char*, bool>& optionalDeviceExtensions) const
 {
 	for (std::pair<const char*, bool> optionalExtension : optionalDeviceExtensions)
@@ -670,5 +1363,150 @@ void Device::fetchQueues()
 		vkGetDeviceQueue(device, qfIndices.PresentFamily.value(), 0, &presentQueue);
 		VulkanUtils::setDebugName(device, (uint64_t)presentQueue, VK_OBJECT_TYPE_QUEUE, "Present Queue");
 	}
+
+	// compute and transfer work falls back to the graphics queue without dedicated families
+	queues[static_cast<size_t>(QueueType::Graphics)] = { graphicsQueue, qfIndices.GraphicsFamily.value(), 0 };
+	queues[static_cast<size_t>(QueueType::Compute)] = queues[static_cast<size_t>(QueueType::Graphics)];
+	queues[static_cast<size_t>(QueueType::Transfer)] = queues[static_cast<size_t>(QueueType::Graphics)];
+
+	auto fetchDedicatedQueue = [this](QueueType type, uint32_t family, const std::string& name)
+	{
+		QueueSlot& slot = queues[static_cast<size_t>(type)];
+		vkGetDeviceQueue(device, family, 0, &slot.queue);
+		slot.family = family;
+		slot.mutexIndex = static_cast<size_t>(type);
+		VulkanUtils::setDebugName(device, (uint64_t)slot.queue, VK_OBJECT_TYPE_QUEUE, name);
+	};
+	if (qfIndices.ComputeFamily.has_value())
+	{
+		fetchDedicatedQueue(QueueType::Compute, qfIndices.ComputeFamily.value(), "Compute Queue");
+	}
+	if (qfIndices.TransferFamily.has_value())
+	{
+		fetchDedicatedQueue(QueueType::Transfer, qfIndices.TransferFamily.value(), "Transfer Queue");
+	}
+
+	usedQueueFamilies.clear();
+	for (const QueueSlot& slot : queues)
+	{
+		if (std::find(usedQueueFamilies.begin(), usedQueueFamilies.end(), slot.family) == usedQueueFamilies.end())
+		{
+			usedQueueFamilies.push_back(slot.family);
+		}
+	}
+}
+
+Handle Device::exportMemory(VkDeviceMemory memory) const
+{
+	Handle handle = INVALID_HANDLE_VALUE;
+#if _WIN32
+	VkMemoryGetWin32HandleInfoKHR winHandleInfo{};
+	winHandleInfo.sType = VK_STRUCTURE_TYPE_MEMORY_GET_WIN32_HANDLE_INFO_KHR;
+	winHandleInfo.handleType = EXTERNAL_MEMORY_HANDLE_TYPE;
+	winHandleInfo.memory = memory;
+
+	VkResult result = vkGetMemoryWin32HandleKHR(device, &winHandleInfo, &handle);
+#else
+	VkMemoryGetFdInfoKHR memoryFdInfo{};
+	memoryFdInfo.sType = VK_STRUCTURE_TYPE_MEMORY_GET_FD_INFO_KHR;
+	memoryFdInfo.handleType = EXTERNAL_MEMORY_HANDLE_TYPE;
+	memoryFdInfo.memory = memory;
+
+	VkResult result = vkGetMemoryFdKHR(device, &memoryFdInfo, &handle);
+#endif
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Could not export memory handle!");
+	}
+	return handle;
+}
+
+void Device::closeHandle(Handle handle)
+{
+	if (handle == INVALID_HANDLE_VALUE)
+	{
+		return;
+	}
+#if _WIN32
+	CloseHandle(handle);
+#else
+	close(handle);
+#endif
+}
+
+void Device::createFrameTimelines()
+{
+	for (const QueueSlot& slot : queues)
+	{
+		// queue types without a dedicated queue share the timeline of the graphics queue
+		VkSemaphore& timeline = frameTimelines[slot.mutexIndex];
+		if (timeline)
+		{
+			continue;
+		}
+
+		VkSemaphoreTypeCreateInfo typeInfo{};
+		typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+		typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+		typeInfo.initialValue = 0;
+
+		VkSemaphoreCreateInfo createInfo{};
+		createInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		createInfo.pNext = &typeInfo;
+
+		VkResult result = vkCreateSemaphore(device, &createInfo, nullptr, &timeline);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Could not create frame timeline!");
+		}
+		VulkanUtils::setDebugName(device, (uint64_t)timeline, VK_OBJECT_TYPE_SEMAPHORE, "Frame Timeline");
+	}
+}
+
+void Device::signalFrameEnd(uint64_t frame)
+{
+	std::array<bool, QUEUE_TYPE_COUNT> signaled{};
+	for (size_t type = 0; type < QUEUE_TYPE_COUNT; type++)
+	{
+		const size_t timelineIndex = queues[type].mutexIndex;
+		if (signaled[timelineIndex])
+		{
+			continue;
+		}
+		signaled[timelineIndex] = true;
+
+		// a signal operation waits for all work submitted to the queue before it
+		VkSemaphoreSubmitInfo signalInfo{};
+		signalInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
+		signalInfo.semaphore = frameTimelines[timelineIndex];
+		signalInfo.value = frame + 1;
+		signalInfo.stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+
+		VkSubmitInfo2 submitInfo{};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2;
+		submitInfo.signalSemaphoreInfoCount = 1;
+		submitInfo.pSignalSemaphoreInfos = &signalInfo;
+		VkResult result = submit2(static_cast<QueueType>(type), std::span(&submitInfo, 1));
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Could not signal the end of the frame!");
+		}
+	}
+}
+
+uint64_t Device::getCompletedFrameCount() const
+{
+	uint64_t completed = UINT64_MAX;
+	for (VkSemaphore timeline : frameTimelines)
+	{
+		if (!timeline)
+		{
+			continue;
+		}
+		uint64_t value = 0;
+		vkGetSemaphoreCounterValue(device, timeline, &value);
+		completed = std::min(completed, value);
+	}
+	return completed == UINT64_MAX ? 0 : completed;
 }
 
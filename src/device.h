@@ -1,14 +1,72 @@
 
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <future>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <span>
 #include <vector>
 
 #include <volk.h>
 #include <vk_mem_alloc.h>
 
+#include "allocation_policy.h"
+#include "allocation_telemetry.h"
+#include "command_context.h"
+#include "compute_pipelines.h"
+#include "gpu_timers.h"
+#include "handle.h"
+#include "image.h"
+#include "interop_pool_manager.h"
+#include "memory_budget.h"
+#include "physical_device_catalog.h"
+#include "retirement_queue.h"
+#include "sampler_cache.h"
 #include "vulkan_utils.h"
 
+struct DeviceOptions
+{
+    /** UINT32_MAX chooses the best graphics card */
+    uint32_t deviceId = UINT32_MAX;
+    /** the validation layers slow down the startup considerably, so only debug builds enable them by default */
+#ifdef NDEBUG
+    bool enableValidation = false;
+#else
+    bool enableValidation = true;
+#endif
+};
+
+/**
+ * Time spent in each phase of the device startup
+ */
+struct DeviceStartupTimings
+{
+    /** volkInitialize, the only phase on the calling thread with Device::createAsync */
+    std::chrono::microseconds loader{ 0 };
+    std::chrono::microseconds instance{ 0 };
+    std::chrono::microseconds physicalDevice{ 0 };
+    std::chrono::microseconds logicalDevice{ 0 };
+    /** VMA, interop pools and the other per device caches */
+    std::chrono::microseconds allocator{ 0 };
+
+    std::chrono::microseconds getTotal() const
+    {
+        return loader + instance + physicalDevice + logicalDevice + allocator;
+    }
+};
+
+/**
+ * Owns the Vulkan instance, device and allocator.
+ * Creating and destroying images (including Device::createImages and the
+ * caches handed out by the device) is thread safe, everything else,
+ * especially construction and destruction of the device itself, is not
+ */
 class Device
 {
 public:
@@ -17,6 +75,13 @@ public:
      * otherwise choose the device with the given id
      */
     Device(uint32_t deviceId = UINT32_MAX);
+    explicit Device(const DeviceOptions& options);
+    /**
+     * Loads the Vulkan loader on the calling thread and does the rest of the startup
+     * (instance, device selection, logical device, allocator) on a background thread,
+     * so the caller can do other work meanwhile. The future rethrows startup errors
+     */
+    static std::future<std::unique_ptr<Device>> createAsync(const DeviceOptions& options = {});
 private:
     /**
      * Setup a minimal device. Only used for querying available
@@ -28,7 +93,199 @@ public:
 
     VkDevice getDevice() const;
     VmaAllocator getAllocator() const;
-    VmaPool getSharedPool() const;
+    const DeviceStartupTimings& getStartupTimings() const;
+    const VkPhysicalDeviceProperties& getPhysicalDeviceProperties() const;
+    /**
+     * @returns everything known about the chosen physical device, e.g. its queue families
+     */
+    const PhysicalDeviceInfo& getPhysicalDeviceInfo() const;
+
+    /**
+     * @returns the queue for the given kind of work. Compute and transfer use dedicated
+     * queues if the device has them and fall back to the graphics queue otherwise
+     */
+    VkQueue getQueue(QueueType type) const;
+    uint32_t getQueueFamily(QueueType type) const;
+    bool hasDedicatedQueue(QueueType type) const;
+    /**
+     * @returns every distinct queue family the device uses. Images are shared
+     * concurrently between them, so no ownership transfers are needed
+     */
+    std::span<const uint32_t> getQueueFamilies() const;
+    /**
+     * Submits to the queue of the given type. Queue access needs external synchronization,
+     * so all submissions of the library go through here
+     */
+    VkResult submit(QueueType type, const VkSubmitInfo& submitInfo, VkFence fence = VK_NULL_HANDLE);
+    VkResult submit2(QueueType type, std::span<const VkSubmitInfo2> submitInfos, VkFence fence = VK_NULL_HANDLE);
+
+    VkQueue getGraphicsQueue() const;
+    uint32_t getGraphicsQueueFamily() const;
+    VkResult submitGraphics(const VkSubmitInfo& submitInfo, VkFence fence = VK_NULL_HANDLE);
+    /**
+     * @returns the interop pool matching the size, usage and allocation path of the given image
+     */
+    VmaPool getInteropPool(const VkImageCreateInfo& createInfo, const AllocationDecision& decision);
+    /**
+     * Decides between pooled and dedicated memory for exportable images
+     */
+    AllocationPolicy& getAllocationPolicy();
+    /**
+     * Shared samplers for all images of this device
+     */
+    SamplerCache& getSamplerCache();
+    /**
+     * Per thread and per frame command buffers, see advanceFrame
+     */
+    CommandContextManager& getCommandContexts();
+    /**
+     * Timestamp queries around command buffer regions, resolved as frames complete, see advanceFrame
+     */
+    GpuTimers& getGpuTimers();
+    /**
+     * Heap budgets and the pressure policy for allocations, polled every frame
+     */
+    MemoryBudgetMonitor& getMemoryBudget();
+    /**
+     * Compute pipelines with disk caches, created on first use
+     */
+    ComputePipelines& getComputePipelines();
+    /**
+     * @returns the utilization of every interop pool that has been created so far
+     */
+    std::vector<InteropPoolStats> getInteropPoolStats() const;
+    /**
+     * @returns the interop pools that sub-allocate images, see InteropDefragmenter
+     */
+    std::vector<VmaPool> getDefragmentableInteropPools() const;
+
+    /**
+     * Live allocation counters, recorded by the images of this device
+     */
+    AllocationTelemetry& getTelemetry();
+    /**
+     * @returns the allocation counters together with the utilization of the interop pools
+     */
+    DeviceStats getStats() const;
+    /**
+     * @returns a JSON object with the counters of getStats under "Telemetry" and
+     * vmaBuildStatsString's dump of the allocator, listing every pool by its name, under "Vma"
+     * @param detailedMap whether VMA should list every single allocation
+     */
+    std::string buildStatsJson(bool detailedMap = false) const;
+    /**
+     * Writes buildStatsJson to the file in the given interval from a background thread,
+     * until stopStatsDump is called or the device is destroyed. Replaces a running dump
+     */
+    void startStatsDump(const std::filesystem::path& file,
+        std::chrono::milliseconds interval = std::chrono::seconds(10));
+    void stopStatsDump();
+
+    /**
+     * Exports the given memory block and returns its external handle.
+     * The block is only exported once, every further call returns the same handle.
+     * Each call needs to be matched by a call to releaseExportedMemory,
+     * the handle is closed once the last user released it
+     */
+    Handle acquireExportedMemory(VkDeviceMemory memory);
+    void releaseExportedMemory(VkDeviceMemory memory);
+    /**
+     * @returns the number of memory blocks that currently have an open export handle
+     */
+    size_t getExportedMemoryCount() const;
+
+    /**
+     * Creates the image, stepping down to smaller formats of the same channels
+     * (e.g. RGBA32F to RGBA16F) while the memory budget refuses it
+     */
+    std::unique_ptr<Image> createImageWithFallback(ImageDesc desc);
+    /**
+     * Creates many images at once. Pooled images are created first, their memory is
+     * allocated per group of identical requirements with vmaAllocateMemoryPages and
+     * everything is bound with a single vkBindImageMemory2 call. Images that need
+     * dedicated memory are created one by one.
+     * @returns the images in the order of the descriptions
+     */
+    std::vector<std::unique_ptr<Image>> createImages(std::span<const ImageDesc> descs);
+    /**
+     * Imports the memory behind an exported image, e.g. of another device on the same GPU.
+     * The handle stays with the caller, the returned memory has to be freed with vkFreeMemory.
+     * @param dedicatedImage the image to bind to dedicated memory, created like the exported one.
+     * Ignored for pooled memory
+     */
+    VkDeviceMemory importMemory(const ExternalMemoryRange& range, VkImage dedicatedImage = VK_NULL_HANDLE) const;
+
+    /**
+     * Creates a timeline semaphore that can be exported with exportSemaphore
+     */
+    VkSemaphore createExportableTimelineSemaphore(uint64_t initialValue = 0) const;
+    /**
+     * Imports a timeline semaphore exported by another device or API.
+     * On Linux, the ownership of the fd goes to the Vulkan implementation
+     */
+    VkSemaphore importTimelineSemaphore(Handle handle) const;
+    /**
+     * @returns a new handle for the semaphore, which is owned by the caller
+     */
+    Handle exportSemaphore(VkSemaphore semaphore) const;
+    void destroySemaphore(VkSemaphore semaphore) const;
+
+    /**
+     * Signals the timeline semaphore from the host
+     */
+    void signalTimeline(VkSemaphore timeline, uint64_t value) const;
+    /**
+     * Waits on the host until the timeline semaphore reached the value
+     * @returns false on timeout
+     */
+    bool waitTimeline(VkSemaphore timeline, uint64_t value, uint64_t timeoutNs = UINT64_MAX) const;
+    uint64_t getTimelineValue(VkSemaphore timeline) const;
+
+    /**
+     * Defers the deleter until the GPU work of the current frame is done,
+     * which every queue signals on its frame timeline once the frame ended
+     * @param isIdle optional check for users outside of this device, e.g. importers,
+     * the deleter waits until it returns true
+     * @param lastUsedFrame the last frame the GPU used the resources in, if that was before the current one
+     */
+    void retire(std::function<void()> deleter, std::function<bool()> isIdle = {},
+        uint64_t lastUsedFrame = UINT64_MAX);
+    /**
+     * Ends the current frame on every queue and starts a new one. Waits until the frame
+     * framesInFlight frames ago completed on the GPU, so per frame resources can be reused,
+     * and destroys everything that was retired in completed frames
+     * @returns the index of the new frame
+     */
+    uint64_t advanceFrame();
+    /**
+     * @returns whether the work submitted up to the end of the given frame completed on every queue
+     */
+    bool isFrameComplete(uint64_t frame) const;
+    /**
+     * Waits on the host until the given frame, which has to have ended, completed on every queue
+     * @returns false on timeout
+     */
+    bool waitForFrame(uint64_t frame, uint64_t timeoutNs = UINT64_MAX) const;
+    /**
+     * Destroys everything that was retired up to (including) the given frame,
+     * for callers that know better which work has completed
+     */
+    void collectRetired(uint64_t completedFrame);
+    /**
+     * Destroys everything that was retired in frames that completed on every queue, without waiting
+     */
+    void collectRetired();
+    /**
+     * Waits for the device to be idle and destroys everything that has been retired,
+     * except what importers still use
+     */
+    void flushRetired();
+    /**
+     * @returns the number of retired resources that are not destroyed yet
+     */
+    size_t getRetiredCount() const;
+    uint64_t getFrameIndex() const;
+    uint32_t getFramesInFlight() const;
 
     /**
      * @returns a list of all device ids and their human readable names
@@ -36,42 +293,100 @@ public:
     static std::vector<std::pair<uint32_t, std::string>> getDevices();
 
 private:
+    /** tag for the constructor that only runs the synchronous part of the startup */
+    struct DeferredStartup {};
+    Device(const DeviceOptions& options, DeferredStartup);
+    /** everything after volkInitialize */
+    void finishStartup();
+
     void setupInstance();
     void choosePhysicalDevice();
     void choosePhysicalDeviceById();
     void choosePhysicalDeviceByRating();
-    uint32_t ratePhysicalDevice(VkPhysicalDevice device) const;
+    uint32_t ratePhysicalDevice(const PhysicalDeviceInfo& info) const;
     void createLogicalDevice();
     void setupVma();
 
     bool areValidationLayersSupported() const;
     std::vector<const char*> getRequiredInstanceExtensions() const;
     bool areRequiredInstanceExtensionsAvailable(const std::vector<const char*>& requiredExtensions) const;
-    bool areRequiredDeviceExtensionsSupported(VkPhysicalDevice device) const;
+    bool areRequiredDeviceExtensionsSupported(const PhysicalDeviceInfo& info) const;
+    bool isOptionalDeviceExtensionEnabled(const char* extension) const;
     void enableAvailableOptionalDeviceExtensions(
         std::vector<const char*>& deviceExtensions,
         const std::map<const char*, bool>& optionalDeviceExtensions) const;
 
     void fetchQueues();
+    void createFrameTimelines();
+    /**
+     * Signals the end of the frame on every queue, after all work submitted to it before
+     */
+    void signalFrameEnd(uint64_t frame);
+    /**
+     * @returns the number of frames that completed on every queue
+     */
+    uint64_t getCompletedFrameCount() const;
+
+    Handle exportMemory(VkDeviceMemory memory) const;
+    static void closeHandle(Handle handle);
 
 private:
     VkInstance instance = VK_NULL_HANDLE;
     VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+	std::unique_ptr<PhysicalDeviceCatalog> physicalDeviceCatalog;
+	/** the chosen device, owned by the catalog */
+	const PhysicalDeviceInfo* physicalDeviceInfo = nullptr;
 	VkPhysicalDeviceProperties2 physicalDeviceProperties;
 	VkPhysicalDeviceMemoryProperties memoryProperties;
     VkDevice device = VK_NULL_HANDLE;
 	VmaAllocator memoryAllocator = VK_NULL_HANDLE;
 
-	/** pool for creating interop resources*/
-	VmaPool imageInteropPool = VK_NULL_HANDLE;
-	/** The Pool Create Info needs to stay alive while the pool is alive! */
-	VmaPoolCreateInfo poolCreateInfo{};
-	VkExportMemoryAllocateInfo exportMemAllocInfo{};
+	/** pools for creating interop resources, bucketed by size and usage */
+	std::unique_ptr<InteropPoolManager> interopPools;
+	std::unique_ptr<AllocationPolicy> allocationPolicy;
+	std::unique_ptr<MemoryBudgetMonitor> memoryBudget;
+	AllocationTelemetry telemetry;
+	std::unique_ptr<StatsDumper> statsDumper;
+	std::mutex statsDumperMutex;
+	std::unique_ptr<SamplerCache> samplerCache;
+	std::unique_ptr<CommandContextManager> commandContexts;
+	std::unique_ptr<GpuTimers> gpuTimers;
+	std::unique_ptr<ComputePipelines> computePipelines;
+	std::once_flag computePipelinesOnce;
+
+	/** destruction of resources the GPU may still use */
+	RetirementQueue retirementQueue;
+
+	std::atomic<uint64_t> frameIndex = 0;
+	uint32_t framesInFlight = 2;
+
+	struct ExportedMemory
+	{
+		Handle handle = INVALID_HANDLE_VALUE;
+		uint32_t refCount = 0;
+	};
+	/** every memory block that has been exported, together with the number of its users */
+	std::map<VkDeviceMemory, ExportedMemory> exportedMemory;
+	mutable std::mutex exportedMemoryMutex;
 
     QueueFamilyIndices qfIndices;
     VkQueue graphicsQueue = VK_NULL_HANDLE;
     VkQueue presentQueue = VK_NULL_HANDLE; 
 
+	struct QueueSlot
+	{
+		VkQueue queue = VK_NULL_HANDLE;
+		uint32_t family = 0;
+		/** index of the slot whose mutex guards the queue, shared queues share a mutex */
+		size_t mutexIndex = 0;
+	};
+	static constexpr size_t QUEUE_TYPE_COUNT = 3;
+	std::array<QueueSlot, QUEUE_TYPE_COUNT> queues;
+	std::array<std::mutex, QUEUE_TYPE_COUNT> queueMutexes;
+	/** per distinct queue (indexed like the mutexes), signaled with the number of ended frames */
+	std::array<VkSemaphore, QUEUE_TYPE_COUNT> frameTimelines{};
+	std::vector<uint32_t> usedQueueFamilies;
+
 	uint32_t vulkanApiVersion = 0;
 
 	VkSurfaceKHR surface = VK_NULL_HANDLE;
@@ -89,18 +404,24 @@ private:
 	};
 	const std::vector<const char*> interopDeviceExtensions = {
 #if _WIN32
-		VK_KHR_EXTERNAL_MEMORY_WIN32_EXTENSION_NAME
+		VK_KHR_EXTERNAL_MEMORY_WIN32_EXTENSION_NAME,
+		VK_KHR_EXTERNAL_SEMAPHORE_WIN32_EXTENSION_NAME
 #else
-		VK_KHR_EXTERNAL_MEMORY_FD_EXTENSION_NAME
+		VK_KHR_EXTERNAL_MEMORY_FD_EXTENSION_NAME,
+		VK_KHR_EXTERNAL_SEMAPHORE_FD_EXTENSION_NAME
 #endif
 	};
 	std::map<const char*, bool> optionalDeviceExtensions = {
+		// real budgets instead of VMA's estimates
+		{ VK_EXT_MEMORY_BUDGET_EXTENSION_NAME, false },
 	};
 
 	const std::vector<const char*> validationLayers = {
 		"VK_LAYER_KHRONOS_validation"
 	};
-    bool enableValidationLayers = true;
+    /** see DeviceOptions::enableValidation */
+    bool enableValidationLayers = false;
+    DeviceStartupTimings startupTimings;
 
     uint32_t deviceId = UINT32_MAX;
 };
@@ -0,0 +1,189 @@
+#include "gpu_timers.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "device.h"
+#include "trace.h"
+
+GpuTimerScope::GpuTimerScope(VkCommandBuffer commandBuffer, VkQueryPool pool, uint32_t query)
+    : commandBuffer(commandBuffer), pool(pool), query(query)
+{
+    if (query == UINT32_MAX)
+    {
+        return;
+    }
+    vkCmdWriteTimestamp2(commandBuffer, VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT, pool, query);
+}
+
+GpuTimerScope::~GpuTimerScope()
+{
+    if (query == UINT32_MAX)
+    {
+        return;
+    }
+    vkCmdWriteTimestamp2(commandBuffer, VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT, pool, query + 1);
+}
+
+GpuTimers::GpuTimers(Device* device, uint32_t framesInFlight, uint32_t maxScopesPerFrame)
+    : device(device), maxScopesPerFrame(maxScopesPerFrame), frames(framesInFlight)
+{
+    timestampPeriod = device->getPhysicalDeviceProperties().limits.timestampPeriod;
+    const std::vector<VkQueueFamilyProperties>& queueFamilies = device->getPhysicalDeviceInfo().queueFamilies;
+    for (QueueType type : { QueueType::Graphics, QueueType::Compute, QueueType::Transfer })
+    {
+        const uint32_t validBits = queueFamilies[device->getQueueFamily(type)].timestampValidBits;
+        timestampMasks[static_cast<size_t>(type)] = validBits >= 64 ? UINT64_MAX
+            : (uint64_t(1) << validBits) - 1;
+    }
+
+    for (FrameQueries& frameQueries : frames)
+    {
+        VkQueryPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        poolInfo.queryCount = maxScopesPerFrame * 2;
+        VkResult result = vkCreateQueryPool(device->getDevice(), &poolInfo, nullptr, &frameQueries.pool);
+        if (result != VK_SUCCESS)
+        {
+            throw std::runtime_error("Could not create timestamp query pool!");
+        }
+        // queries have to be reset before their first use
+        vkResetQueryPool(device->getDevice(), frameQueries.pool, 0, maxScopesPerFrame * 2);
+        frameQueries.scopeInfos.resize(maxScopesPerFrame);
+        frameQueries.cpuStart = std::chrono::steady_clock::now();
+    }
+}
+
+GpuTimers::~GpuTimers()
+{
+    for (FrameQueries& frameQueries : frames)
+    {
+        vkDestroyQueryPool(device->getDevice(), frameQueries.pool, nullptr);
+    }
+}
+
+bool GpuTimers::isSupported(QueueType type) const
+{
+    return timestampMasks[static_cast<size_t>(type)] != 0;
+}
+
+GpuTimerScope GpuTimers::scope(VkCommandBuffer commandBuffer, const char* name, QueueType type)
+{
+    if (!isSupported(type))
+    {
+        return GpuTimerScope(commandBuffer, VK_NULL_HANDLE, UINT32_MAX);
+    }
+
+    scopes++;
+    FrameQueries& frameQueries = frames[currentFrame % frames.size()];
+    const uint32_t index = frameQueries.usedScopes++;
+    if (index >= maxScopesPerFrame)
+    {
+        dropped++;
+        return GpuTimerScope(commandBuffer, VK_NULL_HANDLE, UINT32_MAX);
+    }
+    frameQueries.scopeInfos[index] = ScopeInfo{ name, type };
+    return GpuTimerScope(commandBuffer, frameQueries.pool, index * 2);
+}
+
+void GpuTimers::beginFrame(uint64_t frame)
+{
+    FrameQueries& frameQueries = frames[frame % frames.size()];
+    // the previous user of the pool was framesInFlight frames ago. Its work has to be done
+    // before the results are read and before the queries are reset for the new frame
+    if (frameQueries.usedScopes > 0)
+    {
+        device->waitForFrame(frameQueries.frame);
+        resolve(frameQueries);
+        // queries of scopes whose command buffer was never submitted would otherwise keep their old timestamps
+        vkResetQueryPool(device->getDevice(), frameQueries.pool, 0, maxScopesPerFrame * 2);
+    }
+
+    frameQueries.usedScopes = 0;
+    frameQueries.frame = frame;
+    frameQueries.cpuStart = std::chrono::steady_clock::now();
+    currentFrame = frame;
+}
+
+std::vector<GpuTimingResult> GpuTimers::getLastFrameResults() const
+{
+    std::lock_guard lock(mutex);
+    return lastFrameResults;
+}
+
+std::map<std::string, GpuTimingSummary> GpuTimers::getSummaries() const
+{
+    std::lock_guard lock(mutex);
+    return summaries;
+}
+
+GpuTimers::Stats GpuTimers::getStats() const
+{
+    std::lock_guard lock(mutex);
+    Stats result = stats;
+    result.scopes = scopes;
+    result.dropped = dropped;
+    return result;
+}
+
+void GpuTimers::resolve(FrameQueries& frameQueries)
+{
+    const uint32_t scopeCount = std::min(frameQueries.usedScopes.load(), maxScopesPerFrame);
+    if (scopeCount == 0)
+    {
+        return;
+    }
+
+    // timestamp and availability per query, the frame completed already
+    std::vector<uint64_t> data(scopeCount * 2 * 2);
+    vkGetQueryPoolResults(device->getDevice(), frameQueries.pool, 0, scopeCount * 2,
+        data.size() * sizeof(uint64_t), data.data(), 2 * sizeof(uint64_t),
+        VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+
+    std::vector<GpuTimingResult> results;
+    uint64_t unavailable = 0;
+    uint64_t firstStart = UINT64_MAX;
+    std::vector<uint64_t> startTicks;
+    for (uint32_t i = 0; i < scopeCount; i++)
+    {
+        const uint64_t* start = &data[i * 4];
+        const uint64_t* end = &data[i * 4 + 2];
+        if (!start[1] || !end[1])
+        {
+            unavailable++;
+            continue;
+        }
+        const ScopeInfo& info = frameQueries.scopeInfos[i];
+        // the wrap around of the counter is taken care of by the mask
+        const uint64_t elapsedTicks = (end[0] - start[0]) & timestampMasks[static_cast<size_t>(info.type)];
+        results.push_back(GpuTimingResult{ info.name, frameQueries.frame,
+            static_cast<uint64_t>(double(elapsedTicks) * timestampPeriod) });
+        startTicks.push_back(start[0]);
+        firstStart = std::min(firstStart, start[0]);
+    }
+
+    if (Trace::isEnabled())
+    {
+        // GPU and CPU clocks are not calibrated, so the regions are placed relative to the frame's start
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            const auto offset = std::chrono::nanoseconds(
+                static_cast<int64_t>(double(startTicks[i] - firstStart) * timestampPeriod));
+            const auto start = frameQueries.cpuStart + offset;
+            Trace::recordGpu(results[i].name, start, start + std::chrono::nanoseconds(results[i].durationNs));
+        }
+    }
+
+    std::lock_guard lock(mutex);
+    for (const GpuTimingResult& result : results)
+    {
+        GpuTimingSummary& summary = summaries[result.name];
+        summary.count++;
+        summary.totalNs += result.durationNs;
+        summary.minNs = std::min(summary.minNs, result.durationNs);
+        summary.maxNs = std::max(summary.maxNs, result.durationNs);
+    }
+    stats.unavailable += unavailable;
+    lastFrameResults = std::move(results);
+}
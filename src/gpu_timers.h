@@ -0,0 +1,161 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <volk.h>
+
+#include "vulkan_utils.h"
+
+class Device;
+class GpuTimers;
+
+/**
+ * GPU duration of one timed region
+ */
+struct GpuTimingResult
+{
+    const char* name = nullptr;
+    uint64_t frame = 0;
+    uint64_t durationNs = 0;
+};
+
+/**
+ * All results of one region name so far
+ */
+struct GpuTimingSummary
+{
+    uint64_t count = 0;
+    uint64_t totalNs = 0;
+    uint64_t minNs = UINT64_MAX;
+    uint64_t maxNs = 0;
+
+    double getMeanNs() const
+    {
+        return count > 0 ? double(totalNs) / double(count) : 0.0;
+    }
+};
+
+/**
+ * Writes the start timestamp on construction and the end timestamp on destruction,
+ * both into the command buffer it was created for. Does nothing if the queue has no timestamps
+ * or the frame ran out of queries
+ */
+class GpuTimerScope
+{
+public:
+    ~GpuTimerScope();
+
+    GpuTimerScope(const GpuTimerScope&) = delete;
+    GpuTimerScope& operator=(const GpuTimerScope&) = delete;
+
+private:
+    friend class GpuTimers;
+    GpuTimerScope(VkCommandBuffer commandBuffer, VkQueryPool pool, uint32_t query);
+
+private:
+    VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+    VkQueryPool pool = VK_NULL_HANDLE;
+    /** the start query, the end query follows it. UINT32_MAX if the scope is not timed */
+    uint32_t query = UINT32_MAX;
+};
+
+/**
+ * Timestamp queries around command buffer regions, with one query pool per frame in flight.
+ * The results of a frame are read when its pool is reused, framesInFlight frames later,
+ * once the frame completed on the frame timelines, see Device::waitForFrame. The pool is then
+ * reset on the host, so regions whose command buffer was never submitted have no timestamps
+ * and are dropped. Timestamps are converted with the device's timestampPeriod.
+ *
+ * Resolved regions are summed up per name and, if tracing is compiled in, written into the trace
+ * next to the CPU scopes, on a separate GPU track aligned to the start of their frame.
+ *
+ * The command buffer of a scope has to be submitted in the frame the scope was created in.
+ * Thread safe, like CommandContextManager
+ */
+class GpuTimers
+{
+public:
+    struct Stats
+    {
+        uint64_t scopes = 0;
+        /** scopes that were not timed, because the frame's pool was full */
+        uint64_t dropped = 0;
+        /** timestamps that were not available when the frame was resolved */
+        uint64_t unavailable = 0;
+    };
+
+    GpuTimers(Device* device, uint32_t framesInFlight, uint32_t maxScopesPerFrame = 256);
+    ~GpuTimers();
+
+    GpuTimers(const GpuTimers&) = delete;
+    GpuTimers& operator=(const GpuTimers&) = delete;
+
+    /**
+     * @returns whether the queue writes timestamps at all
+     */
+    bool isSupported(QueueType type) const;
+
+    /**
+     * Times the commands recorded into the command buffer until the scope is destroyed
+     * @param name has to be a string literal
+     */
+    [[nodiscard]] GpuTimerScope scope(VkCommandBuffer commandBuffer, const char* name,
+        QueueType type = QueueType::Graphics);
+
+    /**
+     * Waits for the frame that used the pool of the new frame before, resolves it
+     * and hands the pool to the new frame. Called by Device::advanceFrame
+     */
+    void beginFrame(uint64_t frame);
+
+    /**
+     * @returns the regions of the last resolved frame
+     */
+    std::vector<GpuTimingResult> getLastFrameResults() const;
+    std::map<std::string, GpuTimingSummary> getSummaries() const;
+    Stats getStats() const;
+
+private:
+    struct ScopeInfo
+    {
+        const char* name = nullptr;
+        /** decides the number of valid timestamp bits */
+        QueueType type = QueueType::Graphics;
+    };
+    struct FrameQueries
+    {
+        VkQueryPool pool = VK_NULL_HANDLE;
+        /** indexed by the scope's start query / 2 */
+        std::vector<ScopeInfo> scopeInfos;
+        std::atomic<uint32_t> usedScopes = 0;
+        uint64_t frame = 0;
+        std::chrono::steady_clock::time_point cpuStart;
+    };
+
+    void resolve(FrameQueries& frameQueries);
+
+private:
+    Device* device = nullptr;
+    uint32_t maxScopesPerFrame = 0;
+    /** nanoseconds per timestamp tick */
+    double timestampPeriod = 1.0;
+    /** mask of the valid timestamp bits per queue type, 0 if the queue has no timestamps */
+    std::array<uint64_t, 3> timestampMasks{};
+
+    std::vector<FrameQueries> frames;
+    std::atomic<uint64_t> currentFrame = 0;
+
+    std::vector<GpuTimingResult> lastFrameResults;
+    std::map<std::string, GpuTimingSummary> summaries;
+    Stats stats;
+    mutable std::mutex mutex;
+    std::atomic<uint64_t> scopes = 0;
+    std::atomic<uint64_t> dropped = 0;
+};
@@ -1,4 +1,3 @@
-
 #pragma once
 
 #include <volk.h>
@@ -9,3 +8,42 @@ using Handle = HANDLE;
 using Handle                          = int;
 constexpr Handle INVALID_HANDLE_VALUE = static_cast<Handle>(-1);
 #endif
+
+/**
+ * Platform handle type used for exporting and importing memory, the only one Handle can hold
+ */
+constexpr VkExternalMemoryHandleTypeFlagBits EXTERNAL_MEMORY_HANDLE_TYPE =
+#if defined(WIN32)
+    VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_WIN32_BIT;
+#else
+    VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT;
+#endif
+
+/**
+ * Platform handle type used for exporting and importing semaphores
+ */
+constexpr VkExternalSemaphoreHandleTypeFlagBits EXTERNAL_SEMAPHORE_HANDLE_TYPE =
+#if defined(WIN32)
+    VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_WIN32_BIT;
+#else
+    VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_FD_BIT;
+#endif
+
+/**
+ * Describes where an image lives inside an exported memory object.
+ * Several images may share the same handle (the whole VkDeviceMemory block is exported),
+ * they are told apart by their offset into that block
+ */
+struct ExternalMemoryRange
+{
+    Handle handle = INVALID_HANDLE_VALUE;
+    /** offset of the image inside the exported memory object */
+    VkDeviceSize offset = 0;
+    /** size of the image's allocation */
+    VkDeviceSize size = 0;
+    /** size of the whole exported memory object, needed as allocationSize on import */
+    VkDeviceSize allocationSize = 0;
+    uint32_t memoryTypeIndex = 0;
+    /** dedicated memory has to be imported as dedicated allocation as well */
+    bool dedicated = false;
+};
@@ -1,71 +1,328 @@
 
 #include "image.h"
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <stdexcept>
 
 #include "device.h"
+#include "trace.h"
 
 Image::Image(Device* device, uint32_t width, uint32_t height, VkImageUsageFlags usageFlags)
-    : device(device), width(width), height(height), usageFlags(usageFlags)
+    : Image(device, ImageDesc{ width, height, VK_FORMAT_R32G32B32A32_SFLOAT, usageFlags })
 {
-    setupExternalInfo();
+}
 
+Image::Image(Device* device, const ImageDesc& desc)
+    : device(device), desc(desc)
+{
     VkImageCreateInfo createInfo = getImageCreateInfo();
     createImage(createInfo);
-    createImageView();
-    createSampler();
-    setupExternalAccess();
+    try
+    {
+        createImageView();
+        createSampler();
+        setupExternalAccess();
+    }
+    catch (...)
+    {
+        // the destructor is not run for a throwing constructor
+        releaseImageSetup();
+        vmaDestroyImage(device->getAllocator(), image, allocation);
+        throw;
+    }
+    // lets the defragmentation find the image of a moved allocation
+    vmaSetAllocationUserData(device->getAllocator(), allocation, this);
+}
+
+Image::Image(Device* device, const ImageDesc& desc, VkImage image, VmaAllocation allocation,
+    const AllocationDecision& decision)
+    : image(image), allocation(allocation), allocationDecision(decision), device(device), desc(desc)
+{
+    try
+    {
+        createImageView();
+        createSampler();
+        setupExternalAccess();
+    }
+    catch (...)
+    {
+        // the image and its allocation stay with the caller, which destroys them
+        releaseImageSetup();
+        throw;
+    }
+    vmaSetAllocationUserData(device->getAllocator(), allocation, this);
 }
 
 Image::~Image()
 {
-    if(sampler)
+    device->getTelemetry().recordImageDestroyed(externalMemory.size);
+    // the allocation outlives the image until it is retired, defragmentation must not move it anymore
+    if(allocation)
     {
-        vkDestroySampler(device->getDevice(), sampler, nullptr);
+        vmaSetAllocationUserData(device->getAllocator(), allocation, nullptr);
     }
-    if(imageView)
+    // importers are done with the content once they signaled the acquire value
+    std::function<bool()> isIdle;
+    if(const uint64_t value = acquireValue; value && consumerTimeline)
     {
-        vkDestroyImageView(device->getDevice(), imageView, nullptr);
+        isIdle = [device = device, timeline = consumerTimeline, value]()
+        {
+            return device->getTimelineValue(timeline) >= value;
+        };
     }
-    if(image)
+    // the GPU or an importer may still use the image, so destruction
+    // (including closing the exported handle) is deferred until it is idle
+    device->retire([device = device, image = image, imageView = imageView, sampler = sampler,
+        allocation = allocation, exportedMemory = exportedMemory,
+        producerTimeline = producerTimeline, consumerTimeline = consumerTimeline]()
     {
-        vmaDestroyImage(device->getAllocator(), image, allocation);
+        if(producerTimeline)
+        {
+            device->destroySemaphore(producerTimeline);
+        }
+        if(consumerTimeline)
+        {
+            device->destroySemaphore(consumerTimeline);
+        }
+        if(exportedMemory)
+        {
+            device->releaseExportedMemory(exportedMemory);
+        }
+        if(sampler)
+        {
+            device->getSamplerCache().release(sampler);
+        }
+        if(imageView)
+        {
+            vkDestroyImageView(device->getDevice(), imageView, nullptr);
+        }
+        if(image)
+        {
+            vmaDestroyImage(device->getAllocator(), image, allocation);
+        }
+    }, std::move(isIdle), lastUsedFrame);
+}
+
+const ImageDesc& Image::getDesc() const
+{
+    return desc;
+}
+
+VkImage Image::getImage() const
+{
+    return image;
+}
+
+VkImageView Image::getImageView() const
+{
+    return imageView;
+}
+
+VkSampler Image::getSampler() const
+{
+    return sampler;
+}
+
+VkImageLayout Image::getLayout() const
+{
+    return layout;
+}
+
+void Image::setLayout(VkImageLayout layout)
+{
+    this->layout = layout;
+}
+
+VkImageCreateInfo Image::makeImageCreateInfo(const ImageDesc& desc, std::span<const uint32_t> queueFamilies,
+    VkExternalMemoryImageCreateInfo& externalInfo)
+{
+    // opaque win32 handles on Windows, opaque fds on Linux. The memory comes from pools
+    // and gets exported with exactly that type, so an image can't ask for others
+    if (desc.handleTypes != EXTERNAL_MEMORY_HANDLE_TYPE)
+    {
+        throw std::runtime_error("Images only support the platform's opaque external memory handle type!");
     }
+    externalInfo.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_IMAGE_CREATE_INFO;
+    externalInfo.pNext = nullptr;
+    externalInfo.handleTypes = desc.handleTypes;
+
+    VkImageCreateInfo createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    createInfo.extent = VkExtent3D{desc.width, desc.height, 1};
+    createInfo.format = desc.format;
+    createInfo.imageType = VK_IMAGE_TYPE_2D;
+    createInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    createInfo.mipLevels = 1;
+    createInfo.arrayLayers = 1;
+    createInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    createInfo.usage = desc.usageFlags;
+    createInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    // shared between all queues of the device, so the library never has to transfer ownership
+    if (queueFamilies.size() > 1)
+    {
+        createInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        createInfo.queueFamilyIndexCount = static_cast<uint32_t>(queueFamilies.size());
+        createInfo.pQueueFamilyIndices = queueFamilies.data();
+    }
+    else
+    {
+        createInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    }
+    createInfo.flags = 0;
+    createInfo.pNext = &externalInfo;
+    return createInfo;
 }
 
 Handle Image::getExternalHandle() const
 {
-    return externalHandle;
+    return externalMemory.handle;
+}
+
+const ExternalMemoryRange& Image::getExternalMemoryRange() const
+{
+    return externalMemory;
+}
+
+const AllocationDecision& Image::getAllocationDecision() const
+{
+    return allocationDecision;
+}
+
+VkSemaphore Image::getProducerTimeline()
+{
+    std::lock_guard lock(timelineMutex);
+    if(!producerTimeline)
+    {
+        producerTimeline = device->createExportableTimelineSemaphore();
+        VulkanUtils::setDebugName(device->getDevice(), (uint64_t)producerTimeline, VK_OBJECT_TYPE_SEMAPHORE,
+            "Producer Timeline");
+    }
+    return producerTimeline;
+}
+
+VkSemaphore Image::getConsumerTimeline()
+{
+    std::lock_guard lock(timelineMutex);
+    if(!consumerTimeline)
+    {
+        consumerTimeline = device->createExportableTimelineSemaphore();
+        VulkanUtils::setDebugName(device->getDevice(), (uint64_t)consumerTimeline, VK_OBJECT_TYPE_SEMAPHORE,
+            "Consumer Timeline");
+    }
+    return consumerTimeline;
+}
+
+uint64_t Image::getAcquireValue() const
+{
+    return acquireValue;
+}
+
+void Image::setAcquireValue(uint64_t value)
+{
+    acquireValue = value;
+}
+
+uint64_t Image::getReleaseValue() const
+{
+    return releaseValue;
+}
+
+void Image::setReleaseValue(uint64_t value)
+{
+    releaseValue = value;
+}
+
+bool Image::waitForConsumer(uint64_t timeoutNs)
+{
+    const uint64_t value = acquireValue;
+    if(value == 0)
+    {
+        return true;
+    }
+    return device->waitTimeline(getConsumerTimeline(), value, timeoutNs);
+}
+
+void Image::setLastUsedFrame(uint64_t frame)
+{
+    lastUsedFrame = frame;
+}
+
+void Image::addPendingTransfer(const std::shared_ptr<const VkSemaphore>& timeline, uint64_t value)
+{
+    std::lock_guard lock(transferMutex);
+    uint64_t& pending = pendingTransfers[timeline];
+    pending = std::max(pending, value);
+}
+
+bool Image::waitForTransfers(uint64_t timeoutNs)
+{
+    std::lock_guard lock(transferMutex);
+    for(auto it = pendingTransfers.begin(); it != pendingTransfers.end();)
+    {
+        // an expired timeline belonged to an engine that waited for all of its transfers
+        if(const std::shared_ptr<const VkSemaphore> timeline = it->first.lock())
+        {
+            VkSemaphoreWaitInfo waitInfo{};
+            waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+            waitInfo.semaphoreCount = 1;
+            waitInfo.pSemaphores = timeline.get();
+            waitInfo.pValues = &it->second;
+            VkResult result = vkWaitSemaphores(device->getDevice(), &waitInfo, timeoutNs);
+            if(result == VK_TIMEOUT)
+            {
+                return false;
+            }
+            if(result != VK_SUCCESS)
+            {
+                throw std::runtime_error("Could not wait for the transfers of the image!");
+            }
+        }
+        it = pendingTransfers.erase(it);
+    }
+    return true;
 }
 
 void Image::createImage(const VkImageCreateInfo& createInfo)
 {
+    TRACE_SCOPE("Image::createImage");
+    allocationDecision = device->getAllocationPolicy().decide(createInfo);
+    // refuse before the driver runs out of memory
+    device->getMemoryBudget().checkAllocation(allocationDecision.size, desc.priority);
+
     VmaAllocationCreateInfo allocInfo{};
     allocInfo.usage = VMA_MEMORY_USAGE_AUTO;
-    allocInfo.pool = device->getSharedPool();
+    allocInfo.pool = device->getInteropPool(createInfo, allocationDecision);
+    if (allocationDecision.path == AllocationPath::Dedicated)
+    {
+        allocInfo.flags |= VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
+    }
 
     // vmaCreate also does the allocation and image binding
+    const auto start = std::chrono::steady_clock::now();
     VkResult result = vmaCreateImage(device->getAllocator(), &createInfo, &allocInfo,
     	&image, &allocation, nullptr);
     if (result != VK_SUCCESS)
     {
     	throw std::runtime_error("VMA could not create image!");
     }
+    const auto latency = std::chrono::steady_clock::now() - start;
    
     // fetch the size of the image for the import of others
     VmaAllocationInfo alloc;
     vmaGetAllocationInfo(device->getAllocator(), allocation, &alloc);
-    // size_bytes = alloc.size;
+    device->getTelemetry().recordAllocation(allocationDecision, alloc.size, latency);
 }
 
 void Image::createImageView()
 {
+    TRACE_SCOPE("Image::createImageView");
     VkImageViewCreateInfo createInfo{};
     createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
     createInfo.image = image;
     createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-    createInfo.format = VK_FORMAT_R32G32B32A32_SFLOAT;
+    createInfo.format = desc.format;
 
     // swizzle setup
     createInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
@@ -90,91 +347,73 @@ void Image::createImageView()
 
 void Image::createSampler()
 {
-    VkSamplerCreateInfo createInfo{};
-    createInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
-    // TODO: make this switchable for a full screen texture that is rendered full screen
-    createInfo.magFilter = VK_FILTER_LINEAR;
-    createInfo.minFilter = VK_FILTER_LINEAR;
-    createInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-    createInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-    createInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-    createInfo.anisotropyEnable = VK_FALSE; // TODO: enable? VK_TRUE;
-    //PhysicalDeviceProperties.properties.limits.maxSamplerAnisotropy;
-    // std::cout << "untested max sampler anisotropy!" << std::endl;
-    createInfo.maxAnisotropy = 1.0; //maxSamplerAnisotropy;
-
-    createInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_BLACK;
-    createInfo.unnormalizedCoordinates = VK_FALSE;
-    createInfo.compareEnable = VK_FALSE;
-    createInfo.compareOp = VK_COMPARE_OP_ALWAYS;
-    createInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
-    createInfo.mipLodBias = 0.f;
-    createInfo.minLod = 0.f;
-    createInfo.maxLod = 0.f;
-
-    VkResult result = vkCreateSampler(device->getDevice(), &createInfo, nullptr, &sampler);
-    if (result != VK_SUCCESS)
-    {
-	    throw std::runtime_error("Could not create Sampler!");
-    }
+    TRACE_SCOPE("Image::createSampler");
+    // identical samplers are shared through the device's cache
+    sampler = device->getSamplerCache().acquire(desc.sampler.toCreateInfo());
 }
 
 VkImageCreateInfo Image::getImageCreateInfo()
 {
-    VkImageCreateInfo createInfo{};
-    createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-    createInfo.extent = VkExtent3D{width, height, 1};
-    createInfo.format = VK_FORMAT_R32G32B32A32_SFLOAT;
-    createInfo.imageType = VK_IMAGE_TYPE_2D;
-    createInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    createInfo.mipLevels = 1;
-    createInfo.arrayLayers = 1;
-    createInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
-    createInfo.usage = usageFlags;
-    createInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-    createInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-    createInfo.flags = 0;
-    // external memory setup should have been done at this point
-    assert(externalMemoryImageCreateInfo.sType == VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_IMAGE_CREATE_INFO);
-    createInfo.pNext = &externalMemoryImageCreateInfo;
-    return createInfo;
+    // also sets up the export info, which has to live as long as the image is created
+    return makeImageCreateInfo(desc, device->getQueueFamilies(), externalMemoryImageCreateInfo);
+}
 
+void Image::setupExternalAccess()
+{
+	TRACE_SCOPE("Image::setupExternalAccess");
+	// VkImage is a setup of a buffer associated with data on how to interpret the buffer data
+	// VkImageView is the interpretation and VkDeviceMemory is the underlying data
+	// Therefore get the VkDeviceMemory here and import it into CUDA.
+	// Small images are sub-allocated from a shared block, so the exported handle
+	// refers to the whole block and the image is identified by its offset in it
+	VmaAllocationInfo2 alloc;
+	vmaGetAllocationInfo2(device->getAllocator(), allocation, &alloc);
+	const VkDeviceMemory& sharedDeviceMem = alloc.allocationInfo.deviceMemory;
+
+	externalMemory.handle = device->acquireExportedMemory(sharedDeviceMem);
+	exportedMemory = sharedDeviceMem;
+
+	externalMemory.offset = alloc.allocationInfo.offset;
+	externalMemory.size = alloc.allocationInfo.size;
+	externalMemory.allocationSize = alloc.blockSize;
+	externalMemory.memoryTypeIndex = alloc.allocationInfo.memoryType;
+	externalMemory.dedicated = alloc.dedicatedMemory;
+}
+
+void Image::releaseImageSetup()
+{
+    if (exportedMemory)
+    {
+        device->releaseExportedMemory(exportedMemory);
+        exportedMemory = VK_NULL_HANDLE;
+    }
+    if (sampler)
+    {
+        device->getSamplerCache().release(sampler);
+        sampler = VK_NULL_HANDLE;
+    }
+    vkDestroyImageView(device->getDevice(), imageView, nullptr);
+    imageView = VK_NULL_HANDLE;
 }
 
-void Image::setupExternalInfo()
+void Image::detachFromMemory()
 {
-	externalMemoryImageCreateInfo.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_IMAGE_CREATE_INFO;
-	externalMemoryImageCreateInfo.pNext = nullptr;
-	externalMemoryImageCreateInfo.handleTypes =
-#ifdef WIN32
-		VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_WIN32_BIT;     // Windows handleTypes
-#else
-		VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT;        // Linux handleTypes
-#endif
+    // the copy to the new place has completed. The export goes first: once the pass ends,
+    // VMA may free the old block and a new block could get the same VkDeviceMemory handle
+    device->releaseExportedMemory(exportedMemory);
+    exportedMemory = VK_NULL_HANDLE;
+    // the frames that used the old image have completed before it was chosen for the move,
+    // see InteropDefragmenter::prepareMovesLocked, and passes run between frames
+    vkDestroyImageView(device->getDevice(), imageView, nullptr);
+    vkDestroyImage(device->getDevice(), image, nullptr);
+    imageView = VK_NULL_HANDLE;
+    image = VK_NULL_HANDLE;
 }
 
-void Image::setupExternalAccess()
+void Image::attachToMemory(VkImage movedImage)
 {
-	// VkImage is a setup of a buffer associated with data on how to interpret the buffer data
-	// VkImageView is the interpretation and VkDeviceMemory is the underlying data
-	// Therefore get the VkDeviceMemory here and import it into CUDA
-	VmaAllocationInfo alloc;
-	vmaGetAllocationInfo(device->getAllocator(), allocation, &alloc);
-	const VkDeviceMemory& sharedDeviceMem = alloc.deviceMemory;
-
-#if _WIN32
-	VkMemoryGetWin32HandleInfoKHR winHandleInfo{};
-	winHandleInfo.sType = VK_STRUCTURE_TYPE_MEMORY_GET_WIN32_HANDLE_INFO_KHR;
-	winHandleInfo.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_WIN32_BIT;
-	winHandleInfo.memory = sharedDeviceMem;
-
-	VkResult result = vkGetMemoryWin32HandleKHR(device->getDevice(), &winHandleInfo, &externalHandle);
-#else
-	VkMemoryGetFdInfoKHR memoryFdInfo{};
-	memoryFdInfo.sType = VK_STRUCTURE_TYPE_MEMORY_GET_FD_INFO_KHR;
-	memoryFdInfo.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT;
-	memoryFdInfo.memory = sharedDeviceMem;
-
-	VkResult result = vkGetMemoryFdKHR(device->getDevice(), &memoryFdInfo, &externalHandle);
-#endif
+    image = movedImage;
+    createImageView();
+    // the sampler does not depend on the image and stays as it is
+    setupExternalAccess();
 }
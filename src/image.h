@@ -1,50 +1,191 @@
 
 #pragma once
 
+#include <atomic>
+#include <compare>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <span>
+
 #include "volk.h"
 #include "vk_mem_alloc.h"
 
+#include "allocation_policy.h"
 #include "handle.h"
+#include "memory_budget.h"
+#include "sampler_cache.h"
 
 class Device;
 
+/**
+ * The essentials of an image's VkImageCreateInfo. Images with equal descriptions
+ * are interchangeable, which is what the ImageCache relies on
+ */
+struct ImageDesc
+{
+    uint32_t width = 1;
+    uint32_t height = 1;
+    VkFormat format = VK_FORMAT_R32G32B32A32_SFLOAT;
+    VkImageUsageFlags usageFlags = 0;
+    /** the pools and the export only support EXTERNAL_MEMORY_HANDLE_TYPE, anything else is rejected */
+    VkExternalMemoryHandleTypeFlags handleTypes = EXTERNAL_MEMORY_HANDLE_TYPE;
+    /** samplers are shared between all images with the same description */
+    SamplerDesc sampler;
+    /** decides whether the image may still be created when memory gets tight */
+    AllocationPriority priority = AllocationPriority::Normal;
+
+    auto operator<=>(const ImageDesc&) const = default;
+};
+
 class Image
 {
 public:
     Image(Device* device, uint32_t width, uint32_t height, VkImageUsageFlags usageFlags);
+    Image(Device* device, const ImageDesc& desc);
     ~Image();
 
+    Image(const Image&) = delete;
+    Image& operator=(const Image&) = delete;
+
+    const ImageDesc& getDesc() const;
+
+    VkImage getImage() const;
+    VkImageView getImageView() const;
+    VkSampler getSampler() const;
+
+    /**
+     * The layout the image is in once all recorded work completed.
+     * Whoever records a layout transition for the image has to update it
+     */
+    VkImageLayout getLayout() const;
+    void setLayout(VkImageLayout layout);
+
+    /**
+     * Fills the create info for an image of the given description.
+     * The external memory info is chained into pNext, so it needs to outlive the create info.
+     * With more than one queue family the image is shared concurrently between them
+     */
+    static VkImageCreateInfo makeImageCreateInfo(const ImageDesc& desc, std::span<const uint32_t> queueFamilies,
+        VkExternalMemoryImageCreateInfo& externalInfo);
+
     Handle getExternalHandle() const;
+    /**
+     * @returns the exported memory handle together with the image's place in that memory.
+     * Small images may share their handle with others, but never the offset
+     */
+    const ExternalMemoryRange& getExternalMemoryRange() const;
+    /**
+     * @returns whether the image was sub-allocated or got dedicated memory, and why
+     */
+    const AllocationDecision& getAllocationDecision() const;
+
+    /**
+     * Synchronization with importers happens on two exportable timelines of the image,
+     * which are created on first use, see Device::exportSemaphore. The producer signals
+     * the release value on the producer timeline once the content is ready to be consumed,
+     * the consumer signals the acquire value on the consumer timeline once it is done with
+     * the content, before the producer may write to the image again. 0 means no synchronization needed
+     */
+    VkSemaphore getProducerTimeline();
+    VkSemaphore getConsumerTimeline();
+    uint64_t getAcquireValue() const;
+    void setAcquireValue(uint64_t value);
+    uint64_t getReleaseValue() const;
+    void setReleaseValue(uint64_t value);
+    /**
+     * Waits until the consumer signaled the acquire value, at most for the timeout
+     * @returns false on timeout
+     */
+    bool waitForConsumer(uint64_t timeoutNs = UINT64_MAX);
+
+    /**
+     * Tells the image that the GPU does not use it after the given frame, e.g. while it waits in a
+     * cache, so its destruction only waits for that frame to complete instead of the current one.
+     * UINT64_MAX means it may be used until it is destroyed
+     */
+    void setLastUsedFrame(uint64_t frame);
+
+    /**
+     * Records a transfer into or out of the image that completes once the timeline reached the value,
+     * used by the upload and readback engines. Only a weak reference to the timeline is kept,
+     * engines wait for all of their transfers before they destroy it
+     */
+    void addPendingTransfer(const std::shared_ptr<const VkSemaphore>& timeline, uint64_t value);
+    /**
+     * Waits until every pending transfer completed, at most for the timeout per timeline.
+     * Transfers that have not been submitted yet never complete here
+     * @returns false on timeout
+     */
+    bool waitForTransfers(uint64_t timeoutNs);
 
 private:
+    friend class Device;
+    friend class InteropDefragmenter;
+    /**
+     * Takes over an image that has already been created and bound to its memory,
+     * used by Device::createImages
+     */
+    Image(Device* device, const ImageDesc& desc, VkImage image, VmaAllocation allocation,
+        const AllocationDecision& decision);
+
     void createImage(const VkImageCreateInfo& createInfo);
     void createImageView();
     void createSampler();
 
     VkImageCreateInfo getImageCreateInfo();
-    void setupExternalInfo();
     /**
     * Sets up the HANDLE for external access
     */
     void setupExternalAccess();
+    /**
+     * Destroys the view and releases the sampler and the export right away, for constructors that fail
+     * before the image could have been used
+     */
+    void releaseImageSetup();
+
+    /**
+     * Destroys the image and its view and releases the export of its memory, but keeps
+     * the allocation, which the defragmentation is about to move
+     */
+    void detachFromMemory();
+    /**
+     * Takes over the image bound to the moved allocation and rebuilds the view
+     * and the export of the new memory
+     */
+    void attachToMemory(VkImage movedImage);
 
 private:
     VkImage image = VK_NULL_HANDLE;
     VkImageView imageView = VK_NULL_HANDLE;
     VkSampler sampler = VK_NULL_HANDLE;
     VmaAllocation allocation = VK_NULL_HANDLE;
+    AllocationDecision allocationDecision;
+    VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
 
-    uint32_t width = 1;
-    uint32_t height = 1;
+    /** one timeline per direction, so the values of both sides never interfere */
+    VkSemaphore producerTimeline = VK_NULL_HANDLE;
+    VkSemaphore consumerTimeline = VK_NULL_HANDLE;
+    std::mutex timelineMutex;
+    std::atomic<uint64_t> acquireValue = 0;
+    std::atomic<uint64_t> releaseValue = 0;
+    std::atomic<uint64_t> lastUsedFrame = UINT64_MAX;
 
-    VkImageUsageFlags usageFlags;
+    /** the latest pending value per transfer timeline */
+    std::map<std::weak_ptr<const VkSemaphore>, uint64_t, std::owner_less<>> pendingTransfers;
+    std::mutex transferMutex;
 
     Device* device = nullptr;
 
+    ImageDesc desc;
+
     /**
     * External memory access handle (can be used by OpenGL, CUDA, ...)
+    * and the range of the image within the exported memory
     */
-    Handle externalHandle = 0;
+    ExternalMemoryRange externalMemory;
+    /** the memory block whose export is referenced by this image */
+    VkDeviceMemory exportedMemory = VK_NULL_HANDLE;
     /** 
     * Export handle setup.
     */
@@ -0,0 +1,137 @@
+#include "image_cache.h"
+
+#include "device.h"
+
+ImageCache::ImageCache(Device* device, VkDeviceSize byteBudget)
+    : device(device), byteBudget(byteBudget)
+{
+    pressureHandlerId = device->getMemoryBudget().addPressureHandler([this](MemoryPressure pressure)
+    {
+        // keep half under elevated pressure, nothing once it gets critical
+        trim(pressure == MemoryPressure::Critical ? 0 : getByteBudget() / 2);
+    });
+}
+
+ImageCache::~ImageCache()
+{
+    device->getMemoryBudget().removePressureHandler(pressureHandlerId);
+    clear();
+}
+
+std::unique_ptr<Image> ImageCache::acquire(const ImageDesc& desc)
+{
+    {
+        std::lock_guard lock(mutex);
+        auto it = freeImages.find(desc);
+        if (it != freeImages.end())
+        {
+            stats.hits++;
+            LruList::iterator entry = it->second;
+            std::unique_ptr<Image> image = std::move(entry->image);
+
+            stats.freeImages--;
+            stats.freeBytes -= getImageBytes(*image);
+            freeImages.erase(it);
+            lru.erase(entry);
+
+            // in use again from now on
+            image->setLastUsedFrame(UINT64_MAX);
+            return image;
+        }
+        stats.misses++;
+    }
+
+    return std::make_unique<Image>(device, desc);
+}
+
+void ImageCache::release(std::unique_ptr<Image> image)
+{
+    if (!image)
+    {
+        return;
+    }
+
+    // the GPU is done with released images, so evicting them does not have to wait for later frames
+    image->setLastUsedFrame(device->getFrameIndex());
+
+    std::vector<std::unique_ptr<Image>> evicted;
+    {
+        std::lock_guard lock(mutex);
+        const VkDeviceSize bytes = getImageBytes(*image);
+        if (bytes > byteBudget)
+        {
+            // would evict everything else and still not fit
+            stats.evictions++;
+            evicted.push_back(std::move(image));
+        }
+        else
+        {
+            const ImageDesc desc = image->getDesc();
+            lru.push_front(Entry{ std::move(image), {} });
+            lru.front().freeIt = freeImages.emplace(desc, lru.begin());
+
+            stats.freeImages++;
+            stats.freeBytes += bytes;
+
+            evicted = evictLocked(byteBudget);
+        }
+    }
+    // evicted images are destroyed here, outside of the lock
+}
+
+void ImageCache::trim(VkDeviceSize byteBudget)
+{
+    std::vector<std::unique_ptr<Image>> evicted;
+    {
+        std::lock_guard lock(mutex);
+        evicted = evictLocked(byteBudget);
+    }
+}
+
+void ImageCache::clear()
+{
+    trim(0);
+}
+
+VkDeviceSize ImageCache::getByteBudget() const
+{
+    std::lock_guard lock(mutex);
+    return byteBudget;
+}
+
+void ImageCache::setByteBudget(VkDeviceSize byteBudget)
+{
+    {
+        std::lock_guard lock(mutex);
+        this->byteBudget = byteBudget;
+    }
+    trim(byteBudget);
+}
+
+ImageCache::Stats ImageCache::getStats() const
+{
+    std::lock_guard lock(mutex);
+    return stats;
+}
+
+std::vector<std::unique_ptr<Image>> ImageCache::evictLocked(VkDeviceSize byteBudget)
+{
+    std::vector<std::unique_ptr<Image>> evicted;
+    while (stats.freeBytes > byteBudget && !lru.empty())
+    {
+        Entry& oldest = lru.back();
+        stats.freeImages--;
+        stats.freeBytes -= getImageBytes(*oldest.image);
+        stats.evictions++;
+
+        evicted.push_back(std::move(oldest.image));
+        freeImages.erase(oldest.freeIt);
+        lru.pop_back();
+    }
+    return evicted;
+}
+
+VkDeviceSize ImageCache::getImageBytes(const Image& image)
+{
+    return image.getExternalMemoryRange().size;
+}
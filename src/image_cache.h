@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "image.h"
+
+class Device;
+
+/**
+ * Recycles images of recurring shapes. Released images go to a free list keyed by
+ * their ImageDesc, a later acquire of the same description gets them back including
+ * their image view, sampler and exported handle, instead of creating everything anew.
+ * Free images are evicted least recently released first once they exceed the byte budget,
+ * or when the device's memory budget comes under pressure.
+ *
+ * The contents of a recycled image are undefined, and the caller has to make sure
+ * the GPU (or any importer) is done with an image before releasing it.
+ * Thread safe, images are created outside of the lock on a miss
+ */
+class ImageCache
+{
+public:
+    struct Stats
+    {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        /** number and memory size of the images currently waiting for reuse */
+        size_t freeImages = 0;
+        VkDeviceSize freeBytes = 0;
+    };
+
+    /**
+     * @param byteBudget maximum memory kept alive by images that are not in use
+     */
+    ImageCache(Device* device, VkDeviceSize byteBudget);
+    ~ImageCache();
+
+    ImageCache(const ImageCache&) = delete;
+    ImageCache& operator=(const ImageCache&) = delete;
+
+    /**
+     * @returns a free image matching the description, or a newly created one
+     */
+    std::unique_ptr<Image> acquire(const ImageDesc& desc);
+    /**
+     * Hands the image back for reuse. Images that don't fit the budget are destroyed
+     */
+    void release(std::unique_ptr<Image> image);
+
+    /**
+     * Evicts free images until at most byteBudget bytes are left in the cache
+     */
+    void trim(VkDeviceSize byteBudget);
+    void clear();
+
+    VkDeviceSize getByteBudget() const;
+    void setByteBudget(VkDeviceSize byteBudget);
+
+    Stats getStats() const;
+
+private:
+    struct Entry;
+    using LruList = std::list<Entry>;
+    using FreeMap = std::multimap<ImageDesc, LruList::iterator>;
+
+    struct Entry
+    {
+        std::unique_ptr<Image> image;
+        FreeMap::iterator freeIt;
+    };
+
+    /**
+     * Moves the images over budget out of the cache, so they can be destroyed outside of the lock
+     */
+    std::vector<std::unique_ptr<Image>> evictLocked(VkDeviceSize byteBudget);
+
+    static VkDeviceSize getImageBytes(const Image& image);
+
+private:
+    Device* device = nullptr;
+    VkDeviceSize byteBudget = 0;
+
+    /** the most recently released image is at the front */
+    LruList lru;
+    FreeMap freeImages;
+
+    Stats stats;
+    mutable std::mutex mutex;
+
+    /** shrinks the cache when the device runs low on memory */
+    uint64_t pressureHandlerId = 0;
+};
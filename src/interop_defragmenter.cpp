@@ -0,0 +1,380 @@
+#include "interop_defragmenter.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "device.h"
+#include "image.h"
+
+namespace
+{
+void accumulate(DefragmentationStats& totals, const DefragmentationStats& pass)
+{
+    totals.passes += pass.passes;
+    totals.imagesMoved += pass.imagesMoved;
+    totals.movesIgnored += pass.movesIgnored;
+    totals.bytesMoved += pass.bytesMoved;
+    totals.blocksFreed += pass.blocksFreed;
+    totals.finished = pass.finished;
+}
+}
+
+InteropDefragmenter::InteropDefragmenter(Device* device, DefragmentationSettings settings)
+    : device(device), settings(settings)
+{
+    createCommandObjects();
+}
+
+InteropDefragmenter::~InteropDefragmenter()
+{
+    if (context)
+    {
+        vmaEndDefragmentation(device->getAllocator(), context, nullptr);
+    }
+    vkDestroyFence(device->getDevice(), fence, nullptr);
+    vkDestroyCommandPool(device->getDevice(), commandPool, nullptr);
+}
+
+DefragmentationStats InteropDefragmenter::runPass()
+{
+    return runPass(std::chrono::steady_clock::now() + settings.waitTimeout);
+}
+
+DefragmentationStats InteropDefragmenter::run(std::chrono::microseconds timeBudget)
+{
+    const auto start = std::chrono::steady_clock::now();
+    DefragmentationStats stats;
+    do
+    {
+        const auto now = std::chrono::steady_clock::now();
+        accumulate(stats, runPass(std::min(start + timeBudget, now + settings.waitTimeout)));
+    } while (!stats.finished && std::chrono::steady_clock::now() - start < timeBudget);
+    return stats;
+}
+
+DefragmentationStats InteropDefragmenter::runPass(std::chrono::steady_clock::time_point deadline)
+{
+    DefragmentationStats stats;
+    std::vector<ImageRelocation> relocations;
+    {
+        std::lock_guard lock(mutex);
+        if (!context)
+        {
+            if (currentPool >= pools.size())
+            {
+                // new round, pools may have been created since the last one
+                pools = device->getDefragmentableInteropPools();
+                currentPool = 0;
+            }
+            if (pools.empty())
+            {
+                stats.finished = true;
+                return stats;
+            }
+            beginPoolLocked();
+        }
+
+        VmaAllocator allocator = device->getAllocator();
+        VmaPool pool = pools[currentPool];
+        VmaStatistics before{};
+        vmaGetPoolStatistics(allocator, pool, &before);
+
+        VmaDefragmentationPassMoveInfo pass{};
+        VkResult result = vmaBeginDefragmentationPass(allocator, context, &pass);
+        if (result == VK_INCOMPLETE)
+        {
+            std::vector<Move> moves = prepareMovesLocked(pass, stats, deadline);
+            copyLocked(moves);
+            for (Move& move : moves)
+            {
+                move.previousRange = move.image->getExternalMemoryRange();
+                move.image->detachFromMemory();
+            }
+
+            // VMA swaps the moved allocations over to their new place and frees emptied blocks
+            result = vmaEndDefragmentationPass(allocator, context, &pass);
+            for (Move& move : moves)
+            {
+                move.image->attachToMemory(move.movedImage);
+                relocations.push_back(ImageRelocation{ move.image, move.previousRange });
+            }
+        }
+        if (result == VK_SUCCESS)
+        {
+            // nothing left to move in this pool
+            endPoolLocked();
+        }
+        else if (result != VK_INCOMPLETE)
+        {
+            throw std::runtime_error("Could not run defragmentation pass!");
+        }
+
+        VmaStatistics after{};
+        vmaGetPoolStatistics(allocator, pool, &after);
+        stats.blocksFreed = before.blockCount > after.blockCount ? before.blockCount - after.blockCount : 0;
+        stats.passes = 1;
+        stats.finished = currentPool >= pools.size();
+        accumulate(totals, stats);
+    }
+
+    notify(relocations);
+    return stats;
+}
+
+uint64_t InteropDefragmenter::addRelocationHandler(RelocationHandler handler)
+{
+    std::unique_lock lock(handlersMutex);
+    const uint64_t id = nextHandlerId++;
+    handlers.emplace(id, std::move(handler));
+    return id;
+}
+
+void InteropDefragmenter::removeRelocationHandler(uint64_t id)
+{
+    std::unique_lock lock(handlersMutex);
+    handlers.erase(id);
+}
+
+DefragmentationStats InteropDefragmenter::getStats() const
+{
+    std::lock_guard lock(mutex);
+    return totals;
+}
+
+void InteropDefragmenter::beginPoolLocked()
+{
+    VmaDefragmentationInfo info{};
+    info.flags = settings.flags;
+    info.pool = pools[currentPool];
+    info.maxBytesPerPass = settings.maxBytesPerPass;
+    info.maxAllocationsPerPass = settings.maxAllocationsPerPass;
+
+    VkResult result = vmaBeginDefragmentation(device->getAllocator(), &info, &context);
+    if (result != VK_SUCCESS)
+    {
+        throw std::runtime_error("Could not begin defragmentation of interop pool!");
+    }
+}
+
+void InteropDefragmenter::endPoolLocked()
+{
+    vmaEndDefragmentation(device->getAllocator(), context, nullptr);
+    context = VK_NULL_HANDLE;
+    currentPool++;
+}
+
+std::vector<InteropDefragmenter::Move> InteropDefragmenter::prepareMovesLocked(
+    VmaDefragmentationPassMoveInfo& pass, DefragmentationStats& stats, std::chrono::steady_clock::time_point deadline)
+{
+    VmaAllocator allocator = device->getAllocator();
+    std::vector<Move> moves;
+    for (uint32_t i = 0; i < pass.moveCount; i++)
+    {
+        VmaDefragmentationMove& vmaMove = pass.pMoves[i];
+
+        VmaAllocationInfo allocInfo{};
+        vmaGetAllocationInfo(allocator, vmaMove.srcAllocation, &allocInfo);
+        // destroyed images that wait for their retirement have cleared the user data
+        Image* image = static_cast<Image*>(allocInfo.pUserData);
+
+        constexpr VkImageUsageFlags copyUsage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+        const bool hasContent = image && image->getLayout() != VK_IMAGE_LAYOUT_UNDEFINED;
+        // consumers may still read the old place until they signaled the acquire value,
+        // which may never happen, so all waits of the pass share the time up to the deadline
+        auto remainingNs = [deadline]() -> uint64_t
+        {
+            const auto remaining = deadline - std::chrono::steady_clock::now();
+            return remaining.count() > 0 ? std::chrono::duration_cast<std::chrono::nanoseconds>(remaining).count() : 0;
+        };
+        // frame work still in flight would read the old place after VMA freed it
+        auto waitForLastFrame = [&]()
+        {
+            // passes run between frames, so the current frame has not used the image yet
+            const uint64_t frameIndex = device->getFrameIndex();
+            return frameIndex == 0
+                || device->waitForFrame(std::min<uint64_t>(image->lastUsedFrame, frameIndex - 1), remainingNs());
+        };
+        if (!image || (hasContent && (image->getDesc().usageFlags & copyUsage) != copyUsage)
+            || !waitForLastFrame()
+            || !image->waitForTransfers(remainingNs())
+            || !image->waitForConsumer(remainingNs()))
+        {
+            vmaMove.operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+            stats.movesIgnored++;
+            continue;
+        }
+
+        VkExternalMemoryImageCreateInfo externalInfo{};
+        VkImageCreateInfo createInfo = Image::makeImageCreateInfo(image->getDesc(), device->getQueueFamilies(),
+            externalInfo);
+        VkImage movedImage = VK_NULL_HANDLE;
+        VkResult result = vkCreateImage(device->getDevice(), &createInfo, nullptr, &movedImage);
+        if (result == VK_SUCCESS)
+        {
+            result = vmaBindImageMemory(allocator, vmaMove.dstTmpAllocation, movedImage);
+        }
+        if (result != VK_SUCCESS)
+        {
+            // the image simply stays where it is
+            vkDestroyImage(device->getDevice(), movedImage, nullptr);
+            vmaMove.operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+            stats.movesIgnored++;
+            continue;
+        }
+
+        moves.push_back(Move{ image, movedImage, {} });
+        stats.imagesMoved++;
+        stats.bytesMoved += allocInfo.size;
+    }
+    return moves;
+}
+
+void InteropDefragmenter::copyLocked(const std::vector<Move>& moves)
+{
+    std::vector<const Move*> copies;
+    for (const Move& move : moves)
+    {
+        // images without content only need to be rebuilt
+        if (move.image->getLayout() != VK_IMAGE_LAYOUT_UNDEFINED)
+        {
+            copies.push_back(&move);
+        }
+    }
+    if (copies.empty())
+    {
+        return;
+    }
+
+    vkResetCommandBuffer(commandBuffer, 0);
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+    auto makeBarrier = [](VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout)
+    {
+        VkImageMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.oldLayout = oldLayout;
+        barrier.newLayout = newLayout;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = image;
+        barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+        return barrier;
+    };
+
+    std::vector<VkImageMemoryBarrier> barriers;
+    for (const Move* move : copies)
+    {
+        VkImageMemoryBarrier& src = barriers.emplace_back(makeBarrier(move->image->getImage(),
+            move->image->getLayout(), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL));
+        src.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+        src.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        VkImageMemoryBarrier& dst = barriers.emplace_back(makeBarrier(move->movedImage,
+            VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL));
+        dst.srcAccessMask = 0;
+        dst.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    }
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0, 0, nullptr, 0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data());
+
+    for (const Move* move : copies)
+    {
+        const ImageDesc& desc = move->image->getDesc();
+        VkImageCopy region{};
+        region.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+        region.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+        region.extent = { desc.width, desc.height, 1 };
+        vkCmdCopyImage(commandBuffer, move->image->getImage(), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            move->movedImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+    }
+
+    // the moved image continues in the layout the image was in
+    barriers.clear();
+    for (const Move* move : copies)
+    {
+        VkImageMemoryBarrier& barrier = barriers.emplace_back(makeBarrier(move->movedImage,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, move->image->getLayout()));
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+    }
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+        0, 0, nullptr, 0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data());
+
+    vkEndCommandBuffer(commandBuffer);
+
+    VkCommandBufferSubmitInfo commandBufferInfo{};
+    commandBufferInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO;
+    commandBufferInfo.commandBuffer = commandBuffer;
+
+    // the consumers already signaled the acquire values, see prepareMovesLocked,
+    // so nothing on the GPU can hold the copies back
+    VkSubmitInfo2 submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2;
+    submitInfo.commandBufferInfoCount = 1;
+    submitInfo.pCommandBufferInfos = &commandBufferInfo;
+
+    VkResult result = device->submit2(QueueType::Graphics, std::span(&submitInfo, 1), fence);
+    if (result != VK_SUCCESS)
+    {
+        throw std::runtime_error("Could not submit defragmentation copies!");
+    }
+    // VMA frees the old places when the pass ends, so the copies have to be done by then
+    result = vkWaitForFences(device->getDevice(), 1, &fence, VK_TRUE, UINT64_MAX);
+    if (result != VK_SUCCESS)
+    {
+        throw std::runtime_error("Could not wait for defragmentation copies!");
+    }
+    vkResetFences(device->getDevice(), 1, &fence);
+}
+
+void InteropDefragmenter::createCommandObjects()
+{
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    // layout transitions of arbitrary images need the graphics queue
+    poolInfo.queueFamilyIndex = device->getQueueFamily(QueueType::Graphics);
+
+    VkResult result = vkCreateCommandPool(device->getDevice(), &poolInfo, nullptr, &commandPool);
+    if (result != VK_SUCCESS)
+    {
+        throw std::runtime_error("Could not create command pool for defragmentation!");
+    }
+
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = commandPool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = 1;
+    result = vkAllocateCommandBuffers(device->getDevice(), &allocInfo, &commandBuffer);
+    if (result != VK_SUCCESS)
+    {
+        throw std::runtime_error("Could not allocate command buffer for defragmentation!");
+    }
+
+    VkFenceCreateInfo fenceInfo{};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    result = vkCreateFence(device->getDevice(), &fenceInfo, nullptr, &fence);
+    if (result != VK_SUCCESS)
+    {
+        throw std::runtime_error("Could not create fence for defragmentation!");
+    }
+}
+
+void InteropDefragmenter::notify(const std::vector<ImageRelocation>& relocations)
+{
+    if (relocations.empty())
+    {
+        return;
+    }
+    std::shared_lock lock(handlersMutex);
+    for (const ImageRelocation& relocation : relocations)
+    {
+        for (const auto& [id, handler] : handlers)
+        {
+            handler(relocation);
+        }
+    }
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
+
+#include <volk.h>
+#include <vk_mem_alloc.h>
+
+#include "handle.h"
+
+class Device;
+class Image;
+
+struct DefragmentationSettings
+{
+    /** upper bounds of a single pass, which keep each pass short */
+    VkDeviceSize maxBytesPerPass = 64 * 1024 * 1024;
+    uint32_t maxAllocationsPerPass = 64;
+    VmaDefragmentationFlags flags = VMA_DEFRAGMENTATION_FLAG_ALGORITHM_BALANCED_BIT;
+    /**
+     * how long a pass may wait in total for the images it moves: for the frames they were last used in
+     * to complete, for their pending uploads and readbacks and for their consumers to signal the acquire
+     * value. Once it is spent, busy images are only polled and left in place
+     */
+    std::chrono::milliseconds waitTimeout{ 100 };
+};
+
+/**
+ * Result of one or several defragmentation passes
+ */
+struct DefragmentationStats
+{
+    uint32_t passes = 0;
+    uint32_t imagesMoved = 0;
+    /** moves VMA asked for that could not be done, e.g. for images without transfer usage or still in use */
+    uint32_t movesIgnored = 0;
+    VkDeviceSize bytesMoved = 0;
+    uint32_t blocksFreed = 0;
+    /** whether every interop pool has been compacted since the round started */
+    bool finished = false;
+};
+
+/**
+ * Handed to the relocation handlers for every image that has been moved.
+ * The image already has its new view and export, see Image::getExternalMemoryRange
+ */
+struct ImageRelocation
+{
+    Image* image = nullptr;
+    /** where the image was before, the handle is already closed */
+    ExternalMemoryRange previousRange;
+};
+
+/**
+ * Compacts the sub-allocating interop pools with VMA's defragmentation, incrementally in
+ * bounded passes: each pass moves at most the configured number of images and bytes.
+ * A moved image gets a new VkImage bound to its new place, its content is copied over on
+ * the graphics queue once the consumers signaled its acquire value on its consumer timeline,
+ * and its view and external handle are rebuilt. Consumers have to re-import the image,
+ * which is what the relocation handlers are for.
+ *
+ * Images in the pools must neither be used on other threads nor be used by the current frame while
+ * a pass runs, so passes are best run between frames. The frame an image was last used in (the previous one,
+ * unless Image::setLastUsedFrame says otherwise), pending uploads and readbacks and the acquire
+ * value are waited for up to the wait timeout per pass, images that are not free by then stay in place. Images with content need
+ * VK_IMAGE_USAGE_TRANSFER_SRC_BIT and VK_IMAGE_USAGE_TRANSFER_DST_BIT to be moved.
+ * Thread safe, passes are serialized and handlers are called without internal locks held
+ */
+class InteropDefragmenter
+{
+public:
+    using RelocationHandler = std::function<void(const ImageRelocation& relocation)>;
+
+    InteropDefragmenter(Device* device, DefragmentationSettings settings = {});
+    ~InteropDefragmenter();
+
+    InteropDefragmenter(const InteropDefragmenter&) = delete;
+    InteropDefragmenter& operator=(const InteropDefragmenter&) = delete;
+
+    /**
+     * Runs one bounded pass on the pool currently being compacted,
+     * starting a new round over all pools if the last one finished.
+     * Busy images are waited for at most the wait timeout in total
+     */
+    DefragmentationStats runPass();
+    /**
+     * Runs passes until the round is finished or the time is used up. Passes stop waiting for busy
+     * images once the time is used up, but the copies of a started pass always complete,
+     * so the time may be exceeded by those
+     */
+    DefragmentationStats run(std::chrono::microseconds timeBudget);
+
+    /**
+     * @returns an id for removing the handler again
+     */
+    uint64_t addRelocationHandler(RelocationHandler handler);
+    void removeRelocationHandler(uint64_t id);
+
+    /**
+     * @returns the totals of all passes so far
+     */
+    DefragmentationStats getStats() const;
+
+private:
+    struct Move
+    {
+        Image* image = nullptr;
+        VkImage movedImage = VK_NULL_HANDLE;
+        ExternalMemoryRange previousRange;
+    };
+
+    /** waiting for busy images stops at the deadline */
+    DefragmentationStats runPass(std::chrono::steady_clock::time_point deadline);
+    void beginPoolLocked();
+    void endPoolLocked();
+    /** creates the new images and binds them to their new place, ignoring moves that are not possible */
+    std::vector<Move> prepareMovesLocked(VmaDefragmentationPassMoveInfo& pass, DefragmentationStats& stats,
+        std::chrono::steady_clock::time_point deadline);
+    void copyLocked(const std::vector<Move>& moves);
+    void createCommandObjects();
+    void notify(const std::vector<ImageRelocation>& relocations);
+
+private:
+    Device* device = nullptr;
+    DefragmentationSettings settings;
+
+    /** the pools of the current round, compacted one after the other */
+    std::vector<VmaPool> pools;
+    size_t currentPool = 0;
+    VmaDefragmentationContext context = VK_NULL_HANDLE;
+
+    VkCommandPool commandPool = VK_NULL_HANDLE;
+    VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+    VkFence fence = VK_NULL_HANDLE;
+
+    DefragmentationStats totals;
+    /** serializes passes */
+    mutable std::mutex mutex;
+
+    std::map<uint64_t, RelocationHandler> handlers;
+    uint64_t nextHandlerId = 1;
+    /** held shared while handlers run, so removing a handler waits for its calls to finish */
+    std::shared_mutex handlersMutex;
+};
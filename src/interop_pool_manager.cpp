@@ -0,0 +1,178 @@
+#include "interop_pool_manager.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "handle.h"
+
+InteropPoolManager::InteropPoolManager(VkDevice device, VmaAllocator allocator,
+    std::vector<InteropPoolSizeClass> sizeClasses)
+    : device(device), allocator(allocator), sizeClasses(std::move(sizeClasses))
+{
+    if(this->sizeClasses.empty())
+    {
+        throw std::runtime_error("Interop pools need at least one size class!");
+    }
+    std::sort(this->sizeClasses.begin(), this->sizeClasses.end(),
+        [](const InteropPoolSizeClass& a, const InteropPoolSizeClass& b)
+        {
+            return a.maxAllocationSize < b.maxAllocationSize;
+        });
+
+    exportMemAllocInfo.sType = VK_STRUCTURE_TYPE_EXPORT_MEMORY_ALLOCATE_INFO;
+    exportMemAllocInfo.handleTypes = EXTERNAL_MEMORY_HANDLE_TYPE;
+}
+
+InteropPoolManager::~InteropPoolManager()
+{
+    for(const auto& [key, pool] : pools)
+    {
+        vmaDestroyPool(allocator, pool);
+    }
+}
+
+VmaPool InteropPoolManager::getPool(const VkImageCreateInfo& createInfo, const AllocationDecision& decision)
+{
+    VmaAllocationCreateInfo allocCreateInfo{};
+    allocCreateInfo.usage = VMA_MEMORY_USAGE_AUTO;
+
+    uint32_t memTypeIndex = 0;
+    VkResult result = vmaFindMemoryTypeIndexForImageInfo(allocator, &createInfo, &allocCreateInfo,
+        &memTypeIndex);
+    if (result != VK_SUCCESS)
+    {
+        throw std::runtime_error("Could not find a memory type for interop image!");
+    }
+
+    PoolKey key;
+    key.sizeClass = decision.path == AllocationPath::Dedicated
+        ? getDedicatedClass()
+        : findSizeClass(decision.size);
+    key.usageFlags = createInfo.usage;
+    key.memoryTypeIndex = memTypeIndex;
+
+    {
+        std::shared_lock lock(poolsMutex);
+        auto it = pools.find(key);
+        if(it != pools.end())
+        {
+            return it->second;
+        }
+    }
+
+    std::unique_lock lock(poolsMutex);
+    // another thread may have created the pool in the meantime
+    auto it = pools.find(key);
+    if(it != pools.end())
+    {
+        return it->second;
+    }
+
+    VmaPool pool = createPool(key.sizeClass, key.usageFlags, key.memoryTypeIndex);
+    pools.emplace(key, pool);
+    return pool;
+}
+
+std::vector<InteropPoolStats> InteropPoolManager::getStats() const
+{
+    std::shared_lock lock(poolsMutex);
+    std::vector<InteropPoolStats> stats;
+    stats.reserve(pools.size());
+    for(const auto& [key, pool] : pools)
+    {
+        VmaStatistics poolStats{};
+        vmaGetPoolStatistics(allocator, pool, &poolStats);
+
+        InteropPoolStats& bucket = stats.emplace_back();
+        bucket.name = key.sizeClass == getDedicatedClass()
+            ? "Dedicated"
+            : sizeClasses[key.sizeClass].name;
+        bucket.usageFlags = key.usageFlags;
+        bucket.memoryTypeIndex = key.memoryTypeIndex;
+        bucket.blockCount = poolStats.blockCount;
+        bucket.allocationCount = poolStats.allocationCount;
+        bucket.blockBytes = poolStats.blockBytes;
+        bucket.allocationBytes = poolStats.allocationBytes;
+        bucket.utilization = poolStats.blockBytes > 0
+            ? static_cast<float>(poolStats.allocationBytes) / static_cast<float>(poolStats.blockBytes)
+            : 0.f;
+    }
+    return stats;
+}
+
+std::vector<VmaPool> InteropPoolManager::getDefragmentablePools() const
+{
+    std::shared_lock lock(poolsMutex);
+    std::vector<VmaPool> defragmentable;
+    for(const auto& [key, pool] : pools)
+    {
+        if(key.sizeClass != getDedicatedClass() && sizeClasses[key.sizeClass].blockSize != 0)
+        {
+            defragmentable.push_back(pool);
+        }
+    }
+    return defragmentable;
+}
+
+std::vector<InteropPoolSizeClass> InteropPoolManager::getDefaultSizeClasses()
+{
+    constexpr VkDeviceSize KiB = 1024;
+    constexpr VkDeviceSize MiB = 1024 * KiB;
+
+    return {
+        // tiles, e.g. 32x32 RGBA32F is 16 KiB
+        { "Small", 256 * KiB, 8 * MiB, 0, 0 },
+        // e.g. 512x512 RGBA32F render targets are 4 MiB
+        { "Medium", 4 * MiB, 64 * MiB, 0, 0 },
+        { "Large", 32 * MiB, 256 * MiB, 0, 0 },
+        // no explicit block size, so VMA is free to give these their own memory
+        { "Huge", UINT64_MAX, 0, 0, 0 },
+    };
+}
+
+size_t InteropPoolManager::findSizeClass(VkDeviceSize size) const
+{
+    for(size_t i = 0; i < sizeClasses.size(); i++)
+    {
+        if(size <= sizeClasses[i].maxAllocationSize)
+        {
+            return i;
+        }
+    }
+    // larger than every class, the last one is the best fit
+    return sizeClasses.size() - 1;
+}
+
+size_t InteropPoolManager::getDedicatedClass() const
+{
+    return sizeClasses.size();
+}
+
+VmaPool InteropPoolManager::createPool(size_t sizeClass, VkImageUsageFlags usageFlags, uint32_t memoryTypeIndex)
+{
+    // dedicated allocations need a pool without an explicit block size
+    const InteropPoolSizeClass settings = sizeClass == getDedicatedClass()
+        ? InteropPoolSizeClass{ "Dedicated", UINT64_MAX, 0, 0, 0 }
+        : sizeClasses[sizeClass];
+
+    VmaPoolCreateInfo poolCreateInfo{};
+    poolCreateInfo.memoryTypeIndex = memoryTypeIndex;
+    poolCreateInfo.blockSize = settings.blockSize;
+    poolCreateInfo.minBlockCount = settings.minBlockCount;
+    poolCreateInfo.maxBlockCount = settings.maxBlockCount;
+    poolCreateInfo.pMemoryAllocateNext = &exportMemAllocInfo;
+
+    VmaPool pool = VK_NULL_HANDLE;
+    VkResult result = vmaCreatePool(allocator, &poolCreateInfo, &pool);
+    if (result != VK_SUCCESS)
+    {
+        throw std::runtime_error("Could not create allocation pool for interop resources!");
+    }
+
+    // VMA copies the name
+    std::string poolName = "Image Interop Pool (" + settings.name
+        + ", usage " + std::to_string(usageFlags) + ")";
+    vmaSetPoolName(allocator, pool, poolName.c_str());
+
+    return pool;
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <compare>
+#include <map>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+#include <volk.h>
+#include <vk_mem_alloc.h>
+
+#include "allocation_policy.h"
+
+/**
+ * Setup of one size class of the interop pools.
+ * Every allocation up to maxAllocationSize is placed in a pool of this class
+ */
+struct InteropPoolSizeClass
+{
+    std::string name;
+    VkDeviceSize maxAllocationSize = 0;
+    /** 0 lets VMA choose the block size (and allows dedicated allocations in the pool) */
+    VkDeviceSize blockSize = 0;
+    size_t minBlockCount = 0;
+    /** 0 means unlimited */
+    size_t maxBlockCount = 0;
+};
+
+/**
+ * Utilization of a single interop pool
+ */
+struct InteropPoolStats
+{
+    std::string name;
+    VkImageUsageFlags usageFlags = 0;
+    uint32_t memoryTypeIndex = 0;
+    uint32_t blockCount = 0;
+    uint32_t allocationCount = 0;
+    VkDeviceSize blockBytes = 0;
+    VkDeviceSize allocationBytes = 0;
+    /** allocationBytes / blockBytes, 0 if there are no blocks */
+    float utilization = 0.f;
+};
+
+/**
+ * Keeps several exportable VmaPools, bucketed by allocation size and image usage,
+ * such that small tiles and large render targets don't fragment each other's blocks.
+ * Pools are created lazily when the first image of a bucket is requested.
+ * Thread safe, lookups of existing pools only take a shared lock
+ */
+class InteropPoolManager
+{
+public:
+    InteropPoolManager(VkDevice device, VmaAllocator allocator,
+        std::vector<InteropPoolSizeClass> sizeClasses = getDefaultSizeClasses());
+    ~InteropPoolManager();
+
+    InteropPoolManager(const InteropPoolManager&) = delete;
+    InteropPoolManager& operator=(const InteropPoolManager&) = delete;
+
+    /**
+     * @returns the pool an image with the given create info should be allocated from.
+     * The create info has to contain the external memory setup in its pNext chain.
+     * Dedicated allocations are served from a pool without explicit block size,
+     * since VMA only allows those in such pools
+     */
+    VmaPool getPool(const VkImageCreateInfo& createInfo, const AllocationDecision& decision);
+
+    std::vector<InteropPoolStats> getStats() const;
+    /**
+     * @returns the pools with an explicit block size, i.e. all that sub-allocate.
+     * Pools of dedicated allocations have nothing to compact
+     */
+    std::vector<VmaPool> getDefragmentablePools() const;
+
+    /**
+     * Small (<= 256 KiB), medium (<= 4 MiB), large (<= 32 MiB) and huge images
+     */
+    static std::vector<InteropPoolSizeClass> getDefaultSizeClasses();
+
+private:
+    size_t findSizeClass(VkDeviceSize size) const;
+    /** the pseudo size class index used for dedicated allocations */
+    size_t getDedicatedClass() const;
+    VmaPool createPool(size_t sizeClass, VkImageUsageFlags usageFlags, uint32_t memoryTypeIndex);
+
+private:
+    struct PoolKey
+    {
+        size_t sizeClass = 0;
+        VkImageUsageFlags usageFlags = 0;
+        uint32_t memoryTypeIndex = 0;
+
+        auto operator<=>(const PoolKey&) const = default;
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    VmaAllocator allocator = VK_NULL_HANDLE;
+    std::vector<InteropPoolSizeClass> sizeClasses;
+    std::map<PoolKey, VmaPool> pools;
+    mutable std::shared_mutex poolsMutex;
+
+    /** The export info needs to stay alive while the pools are alive! */
+    VkExportMemoryAllocateInfo exportMemAllocInfo{};
+};
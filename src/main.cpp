@@ -1,28 +1,993 @@
-
 #include "third_party_setup.h" // IWYU pragma: export
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstdint>
+#include <cstring>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
 
 #include "device.h"
 #include "image.h"
+#include "image_cache.h"
+#include "interop_defragmenter.h"
+#include "trace.h"
+#include "upload_engine.h"
 
-int main(int argc, char** argv)
+namespace
 {
-    uint32_t id = UINT32_MAX;
-    if (argc > 2 && 
-        (strcmp(argv[1], "-d") == 0
-        || strcmp(argv[1], "--device") == 0))
+/**
+ * Creates and destroys images of mixed sizes from several threads at once.
+ * Every live image needs its own place in memory, and once all images are gone
+ * every allocation, export and sampler has to be returned to the device
+ */
+int runStressTest(Device& device, uint32_t threadCount)
+{
+    constexpr uint32_t iterationsPerThread = 500;
+    const uint32_t sideLengths[] = { 16, 32, 64, 128, 512 };
+    const VkImageUsageFlags usageFlags = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+
+    // (handle, offset) of every live image
+    std::mutex liveMutex;
+    std::set<std::pair<Handle, VkDeviceSize>> liveRanges;
+    std::atomic<uint32_t> errors = 0;
+
+    auto addImage = [&](std::vector<std::unique_ptr<Image>>& images, std::unique_ptr<Image> image)
+    {
+        const ExternalMemoryRange& range = image->getExternalMemoryRange();
+        std::lock_guard lock(liveMutex);
+        if (!liveRanges.insert({ range.handle, range.offset }).second)
+        {
+            std::cerr << "handle " << range.handle << " offset " << range.offset
+                << " is used by two live images!" << std::endl;
+            errors++;
+        }
+        images.push_back(std::move(image));
+    };
+    auto removeImage = [&](std::vector<std::unique_ptr<Image>>& images, size_t index)
+    {
+        {
+            const ExternalMemoryRange& range = images[index]->getExternalMemoryRange();
+            std::lock_guard lock(liveMutex);
+            liveRanges.erase({ range.handle, range.offset });
+        }
+        images[index] = std::move(images.back());
+        images.pop_back();
+    };
+
+    auto worker = [&](uint32_t threadIndex)
+    {
+        std::mt19937 rng(threadIndex);
+        std::vector<std::unique_ptr<Image>> images;
+        try
+        {
+            for (uint32_t i = 0; i < iterationsPerThread; i++)
+            {
+                const uint32_t action = rng() % 4;
+                if (action == 0 && !images.empty())
+                {
+                    removeImage(images, rng() % images.size());
+                }
+                else if (action == 1)
+                {
+                    std::vector<ImageDesc> descs(4);
+                    for (ImageDesc& desc : descs)
+                    {
+                        desc.width = desc.height = sideLengths[rng() % std::size(sideLengths)];
+                        desc.usageFlags = usageFlags;
+                    }
+                    for (std::unique_ptr<Image>& image : device.createImages(descs))
+                    {
+                        addImage(images, std::move(image));
+                    }
+                }
+                else
+                {
+                    const uint32_t length = sideLengths[rng() % std::size(sideLengths)];
+                    addImage(images, std::make_unique<Image>(&device, length, length, usageFlags));
+                }
+            }
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "thread " << threadIndex << ": " << e.what() << std::endl;
+            errors++;
+        }
+        while (!images.empty())
+        {
+            removeImage(images, images.size() - 1);
+        }
+    };
+
+    std::atomic<uint32_t> runningThreads = threadCount;
+    std::vector<std::thread> threads;
+    for (uint32_t t = 0; t < threadCount; t++)
+    {
+        threads.emplace_back([&, t]()
+        {
+            worker(t);
+            runningThreads--;
+        });
+    }
+    // frames keep going while the workers retire images, like they would in an application
+    try
+    {
+        while (runningThreads > 0)
+        {
+            device.advanceFrame();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "advancing frames: " << e.what() << std::endl;
+        errors++;
+    }
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+
+    // everything has to be handed back once the retiring frames completed, without waiting for the device
+    for (uint32_t frame = 0; frame <= device.getFramesInFlight(); frame++)
+    {
+        device.advanceFrame();
+    }
+    if (device.getRetiredCount() != 0)
+    {
+        std::cerr << device.getRetiredCount() << " retired resources were not destroyed after their frames completed!" << std::endl;
+        errors++;
+    }
+    if (device.getExportedMemoryCount() != 0)
+    {
+        std::cerr << device.getExportedMemoryCount() << " exported memory blocks were not released!" << std::endl;
+        errors++;
+    }
+    if (device.getSamplerCache().getSamplerCount() != 0)
     {
-        id = std::atoi(argv[2]);
+        std::cerr << device.getSamplerCache().getSamplerCount() << " samplers were not released!" << std::endl;
+        errors++;
     }
-    else if(argc > 1)
+    for (const InteropPoolStats& pool : device.getInteropPoolStats())
     {
-        if(strcmp(argv[1], "-h") == 0
-            || strcmp(argv[1], "--help") == 0)
+        if (pool.allocationCount != 0)
+        {
+            std::cerr << pool.name << " pool still holds " << pool.allocationCount << " allocations!" << std::endl;
+            errors++;
+        }
+    }
+
+    std::cout << "stress test with " << threadCount << " threads: "
+        << (errors == 0 ? "passed" : std::to_string(errors) + " errors") << std::endl;
+    return errors == 0 ? 0 : 1;
+}
+
+/**
+ * Caps the device local heap to the given budget on top of what is already in use
+ * and checks that the budget policy steps in before the budget is exceeded:
+ * low priority images get refused first, normal ones still fit, formats fall back
+ * to smaller ones, cached images are given up under pressure and a pool capped
+ * by its block count is refused before VMA runs out of memory for it
+ */
+int runBudgetTest(Device& device, VkDeviceSize budgetMiB)
+{
+    MemoryBudgetMonitor& budget = device.getMemoryBudget();
+    auto getDeviceLocalHeap = [&budget]()
+    {
+        HeapBudget deviceLocal;
+        for (const HeapBudget& heap : budget.getHeapBudgets())
+        {
+            if (heap.deviceLocal && heap.budget > deviceLocal.budget)
+            {
+                deviceLocal = heap;
+            }
+        }
+        return deviceLocal;
+    };
+
+    const VkDeviceSize simulatedBudget = getDeviceLocalHeap().blockBytes + budgetMiB * 1024 * 1024;
+    budget.setSimulatedBudget(simulatedBudget);
+
+    uint32_t errors = 0;
+    ImageDesc lowDesc;
+    lowDesc.width = 1024;
+    lowDesc.height = 1024;
+    lowDesc.usageFlags = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    lowDesc.priority = AllocationPriority::Low;
+    const VkDeviceSize lowBytes = VkDeviceSize(lowDesc.width) * lowDesc.height
+        * VulkanUtils::getFormatTexelSize(lowDesc.format);
+
+    // low priority images until the policy refuses them
+    std::vector<std::unique_ptr<Image>> lowImages;
+    bool refused = false;
+    while (!refused && lowImages.size() * lowBytes <= simulatedBudget)
+    {
+        try
+        {
+            lowImages.push_back(std::make_unique<Image>(&device, lowDesc));
+        }
+        catch (const MemoryPressureError& error)
+        {
+            std::cout << error.what() << std::endl;
+            refused = true;
+        }
+        const HeapBudget heap = getDeviceLocalHeap();
+        if (heap.usage > heap.budget)
+        {
+            std::cerr << "usage of " << heap.usage << " bytes exceeds the budget of " << heap.budget << " bytes!" << std::endl;
+            errors++;
+        }
+    }
+    if (!refused)
+    {
+        std::cerr << "low priority images were never refused!" << std::endl;
+        errors++;
+    }
+
+    // normal priority is only refused once the pressure gets critical
+    ImageDesc normalDesc = lowDesc;
+    normalDesc.width = 256;
+    normalDesc.height = 256;
+    normalDesc.priority = AllocationPriority::Normal;
+    try
+    {
+        Image normal(&device, normalDesc);
+    }
+    catch (const MemoryPressureError& error)
+    {
+        std::cerr << "normal priority image was refused: " << error.what() << std::endl;
+        errors++;
+    }
+
+    try
+    {
+        ImageDesc fallbackDesc = lowDesc;
+        fallbackDesc.priority = AllocationPriority::Normal;
+        std::unique_ptr<Image> fallback = device.createImageWithFallback(fallbackDesc);
+        std::cout << "fallback image created with format " << fallback->getDesc().format << std::endl;
+    }
+    catch (const MemoryPressureError& error)
+    {
+        std::cout << "no fallback format fits: " << error.what() << std::endl;
+    }
+
+    // cached images have to make room for new ones
+    {
+        ImageCache cache(&device, simulatedBudget);
+        for (std::unique_ptr<Image>& image : lowImages)
+        {
+            cache.release(std::move(image));
+        }
+        lowImages.clear();
+
+        // once the frame of the release completed, evicted images can be destroyed right away.
+        // Without the simulated budget, advancing the frames does not evict anything yet
+        budget.setSimulatedBudget(0);
+        for (uint32_t frame = 0; frame <= device.getFramesInFlight(); frame++)
+        {
+            device.advanceFrame();
+        }
+        budget.setSimulatedBudget(simulatedBudget);
+
+        const uint64_t evictionsBefore = cache.getStats().evictions;
+        try
+        {
+            budget.checkAllocation(lowBytes, AllocationPriority::Low);
+        }
+        catch (const MemoryPressureError& error)
+        {
+            std::cerr << "evicting the image cache did not make room for a low priority image: "
+                << error.what() << std::endl;
+            errors++;
+        }
+        if (cache.getStats().evictions == evictionsBefore)
+        {
+            std::cerr << "the image cache did not evict anything under pressure!" << std::endl;
+            errors++;
+        }
+    }
+
+    // a pool capped by its block count runs out of memory on its own. With a budget of
+    // what the pool can hold, the policy has to refuse before VMA does
+    {
+        constexpr VkDeviceSize blockSize = 64 * 1024 * 1024;
+        constexpr size_t maxBlockCount = 4;
+
+        VkImageCreateInfo imageInfo{};
+        imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageInfo.format = lowDesc.format;
+        imageInfo.extent = { lowDesc.width, lowDesc.height, 1 };
+        imageInfo.mipLevels = 1;
+        imageInfo.arrayLayers = 1;
+        imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageInfo.usage = lowDesc.usageFlags;
+        imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+        VmaAllocationCreateInfo allocInfo{};
+        allocInfo.usage = VMA_MEMORY_USAGE_AUTO;
+        VmaPoolCreateInfo poolInfo{};
+        poolInfo.blockSize = blockSize;
+        poolInfo.maxBlockCount = maxBlockCount;
+        VmaPool pool = VK_NULL_HANDLE;
+        VkResult result = vmaFindMemoryTypeIndexForImageInfo(device.getAllocator(), &imageInfo, &allocInfo,
+            &poolInfo.memoryTypeIndex);
+        if (result == VK_SUCCESS)
+        {
+            result = vmaCreatePool(device.getAllocator(), &poolInfo, &pool);
+        }
+        if (result != VK_SUCCESS)
+        {
+            std::cerr << "could not create the capped pool!" << std::endl;
+            errors++;
+        }
+        else
+        {
+            // nothing retired may give memory back while the pool fills up
+            device.flushRetired();
+            budget.setSimulatedBudget(getDeviceLocalHeap().blockBytes + blockSize * maxBlockCount);
+            allocInfo.pool = pool;
+
+            std::vector<std::pair<VkImage, VmaAllocation>> poolImages;
+            bool poolRefused = false;
+            bool poolFailed = false;
+            // one more image than the pool can hold
+            while (!poolRefused && poolImages.size() <= maxBlockCount * (blockSize / lowBytes))
+            {
+                try
+                {
+                    budget.checkAllocation(lowBytes, AllocationPriority::Normal);
+                }
+                catch (const MemoryPressureError&)
+                {
+                    poolRefused = true;
+                    continue;
+                }
+
+                VkImage image = VK_NULL_HANDLE;
+                VmaAllocation allocation = VK_NULL_HANDLE;
+                result = vmaCreateImage(device.getAllocator(), &imageInfo, &allocInfo, &image, &allocation, nullptr);
+                if (result != VK_SUCCESS)
+                {
+                    std::cerr << "the capped pool failed with " << result << " after " << poolImages.size()
+                        << " images, before the policy refused!" << std::endl;
+                    errors++;
+                    poolFailed = true;
+                    break;
+                }
+                poolImages.emplace_back(image, allocation);
+            }
+            if (!poolRefused && !poolFailed)
+            {
+                std::cerr << "the policy never refused images of the capped pool!" << std::endl;
+                errors++;
+            }
+            std::cout << "capped pool took " << poolImages.size() << " images before the policy refused" << std::endl;
+
+            for (const auto& [image, allocation] : poolImages)
+            {
+                vmaDestroyImage(device.getAllocator(), image, allocation);
+            }
+            vmaDestroyPool(device.getAllocator(), pool);
+            budget.setSimulatedBudget(simulatedBudget);
+        }
+    }
+
+    const HeapBudget heap = getDeviceLocalHeap();
+    const MemoryBudgetMonitor::Stats stats = budget.getStats();
+    std::cout << "heap " << heap.heapIndex << ": " << heap.usage << " / " << heap.budget << " bytes used, "
+        << heap.getHeadroom() << " bytes headroom" << std::endl;
+    std::cout << stats.refusals << " refusals, " << stats.pressureEvents << " pressure events" << std::endl;
+
+    budget.setSimulatedBudget(0);
+    std::cout << "budget test with " << budgetMiB << " MiB: "
+        << (errors == 0 ? "passed" : std::to_string(errors) + " errors") << std::endl;
+    return errors == 0 ? 0 : 1;
+}
+
+/**
+ * Fragments the small interop pool by destroying every other tile,
+ * then compacts it pass by pass. Every moved image has to be reported to the
+ * relocation handler and keep a handle and offset no other image has
+ */
+int runDefragmentationTest(Device& device, uint32_t imageCount)
+{
+    ImageDesc desc;
+    desc.width = 32;
+    desc.height = 32;
+    desc.usageFlags = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+
+    std::vector<std::unique_ptr<Image>> images;
+    for (uint32_t i = 0; i < imageCount; i++)
+    {
+        images.push_back(std::make_unique<Image>(&device, desc));
+    }
+    for (size_t i = 0; i < images.size(); i += 2)
+    {
+        images[i].reset();
+    }
+    std::erase(images, nullptr);
+    // the destroyed images only give their memory back once they are retired
+    device.flushRetired();
+
+    InteropDefragmenter defragmenter(&device);
+    uint32_t relocations = 0;
+    uint32_t errors = 0;
+    const uint64_t handlerId = defragmenter.addRelocationHandler([&](const ImageRelocation& relocation)
+    {
+        relocations++;
+        const ExternalMemoryRange& range = relocation.image->getExternalMemoryRange();
+        if (range.handle == relocation.previousRange.handle && range.offset == relocation.previousRange.offset)
+        {
+            std::cerr << "relocated image did not move!" << std::endl;
+            errors++;
+        }
+    });
+
+    DefragmentationStats stats;
+    do
+    {
+        stats = defragmenter.runPass();
+        std::cout << "pass: " << stats.imagesMoved << " images moved, " << stats.movesIgnored << " ignored, "
+            << stats.bytesMoved << " bytes moved, " << stats.blocksFreed << " blocks freed" << std::endl;
+    } while (!stats.finished);
+    defragmenter.removeRelocationHandler(handlerId);
+
+    const DefragmentationStats totals = defragmenter.getStats();
+    if (relocations != totals.imagesMoved)
+    {
+        std::cerr << totals.imagesMoved << " images moved, but " << relocations << " relocations reported!" << std::endl;
+        errors++;
+    }
+    std::set<std::pair<Handle, VkDeviceSize>> places;
+    for (const std::unique_ptr<Image>& image : images)
+    {
+        const ExternalMemoryRange& range = image->getExternalMemoryRange();
+        if (!places.emplace(range.handle, range.offset).second)
+        {
+            std::cerr << "two images share handle " << range.handle << " and offset " << range.offset << "!" << std::endl;
+            errors++;
+        }
+    }
+
+    std::cout << "defragmentation in " << totals.passes << " passes: " << totals.bytesMoved << " bytes moved, "
+        << totals.blocksFreed << " blocks freed, "
+        << (errors == 0 ? "passed" : std::to_string(errors) + " errors") << std::endl;
+    return errors == 0 ? 0 : 1;
+}
+
+/**
+ * Clears an image on the GPU every frame inside a timed region and checks that
+ * every region is resolved once its frame completed
+ */
+int runGpuTimerTest(Device& device, uint32_t frameCount)
+{
+    GpuTimers& timers = device.getGpuTimers();
+    if (!timers.isSupported(QueueType::Graphics))
+    {
+        std::cout << "the graphics queue does not support timestamps" << std::endl;
+        return 0;
+    }
+
+    ImageDesc desc;
+    desc.width = 1024;
+    desc.height = 1024;
+    desc.usageFlags = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    Image image(&device, desc);
+    CommandContextManager& commandContexts = device.getCommandContexts();
+
+    for (uint32_t frame = 0; frame < frameCount; frame++)
+    {
+        VkCommandBuffer commandBuffer = commandContexts.acquire(QueueType::Graphics);
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        vkBeginCommandBuffer(commandBuffer, &beginInfo);
+        {
+            GpuTimerScope timer = timers.scope(commandBuffer, "clear");
+
+            VkImageMemoryBarrier barrier{};
+            barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            barrier.srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+            barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.image = image.getImage();
+            barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+            VkClearColorValue color{};
+            color.float32[0] = float(frame % 2);
+            VkImageSubresourceRange range = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+            vkCmdClearColorImage(commandBuffer, image.getImage(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                &color, 1, &range);
+        }
+        vkEndCommandBuffer(commandBuffer);
+
+        commandContexts.enqueue(QueueType::Graphics, CommandSubmission{ { commandBuffer }, {}, {} });
+        if (commandContexts.submitPending(QueueType::Graphics) != VK_SUCCESS)
+        {
+            std::cerr << "Could not submit frame " << frame << "!" << std::endl;
+            return 1;
+        }
+        device.advanceFrame();
+    }
+
+    // the last frames get resolved once their pools are reused, which waits for them to complete
+    for (uint32_t i = 0; i < device.getFramesInFlight(); i++)
+    {
+        device.advanceFrame();
+    }
+
+    const GpuTimers::Stats stats = timers.getStats();
+    const GpuTimingSummary summary = timers.getSummaries()["clear"];
+    std::cout << summary.count << " of " << stats.scopes << " regions resolved ("
+        << stats.unavailable << " unavailable, " << stats.dropped << " dropped), clear took "
+        << summary.getMeanNs() / 1000.0 << " us on average, " << summary.minNs / 1000.0 << " to "
+        << summary.maxNs / 1000.0 << " us" << std::endl;
+
+    // every frame completed before it was resolved, so all timestamps have to be there
+    const bool passed = summary.count == frameCount && stats.unavailable == 0;
+    std::cout << "gpu timer test with " << frameCount << " frames: " << (passed ? "passed" : "failed") << std::endl;
+    return passed ? 0 : 1;
+}
+
+/**
+ * What identifies the memory behind an exported handle: the device and inode of the fd,
+ * whatever kind of file the driver exports. Only if fstat fails, the handle is used,
+ * which is unique per memory block as long as the block is exported
+ */
+std::pair<uint64_t, uint64_t> getMemoryIdentity(Handle handle)
+{
+#ifdef _WIN32
+    return { UINT64_MAX, reinterpret_cast<uint64_t>(handle) };
+#else
+    struct stat status;
+    if (fstat(handle, &status) == 0)
+    {
+        return { static_cast<uint64_t>(status.st_dev), static_cast<uint64_t>(status.st_ino) };
+    }
+    return { UINT64_MAX, static_cast<uint64_t>(handle) };
+#endif
+}
+
+bool isValidHandle(Handle handle)
+{
+#ifdef _WIN32
+    return handle != nullptr && handle != INVALID_HANDLE_VALUE;
+#else
+    struct stat status;
+    return handle != INVALID_HANDLE_VALUE && fstat(handle, &status) == 0;
+#endif
+}
+
+/**
+ * Every image gets its own content, so mixed up images can't go unnoticed
+ */
+std::vector<std::byte> makeTestPattern(const ImageDesc& desc, uint32_t seed)
+{
+    std::vector<std::byte> data(VkDeviceSize(desc.width) * desc.height * VulkanUtils::getFormatTexelSize(desc.format));
+    std::mt19937 rng(seed);
+    for (std::byte& value : data)
+    {
+        value = static_cast<std::byte>(rng() & 0xff);
+    }
+    return data;
+}
+
+/**
+ * Copies an image of the importing device into a host visible buffer and waits for it
+ * @param layout the layout the exporting device left the image in
+ */
+std::vector<std::byte> readImportedImage(Device& importer, VkImage image, const ImageDesc& desc,
+    VkImageLayout layout, VkFence fence)
+{
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = VkDeviceSize(desc.width) * desc.height * VulkanUtils::getFormatTexelSize(desc.format);
+    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    VmaAllocationCreateInfo allocInfo{};
+    allocInfo.usage = VMA_MEMORY_USAGE_AUTO;
+    allocInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VmaAllocation allocation = VK_NULL_HANDLE;
+    VmaAllocationInfo allocationInfo;
+    VkResult result = vmaCreateBuffer(importer.getAllocator(), &bufferInfo, &allocInfo, &buffer, &allocation,
+        &allocationInfo);
+    if (result != VK_SUCCESS)
+    {
+        throw std::runtime_error("Could not create readback buffer!");
+    }
+
+    VkCommandBuffer commandBuffer = importer.getCommandContexts().acquire(QueueType::Graphics);
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    barrier.oldLayout = layout;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    VkBufferImageCopy region{};
+    region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+    region.imageExtent = { desc.width, desc.height, 1 };
+    vkCmdCopyImageToBuffer(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, buffer, 1, &region);
+    vkEndCommandBuffer(commandBuffer);
+
+    importer.getCommandContexts().enqueue(QueueType::Graphics, CommandSubmission{ { commandBuffer }, {}, {} });
+    result = importer.getCommandContexts().submitPending(QueueType::Graphics, fence);
+    if (result == VK_SUCCESS)
+    {
+        result = vkWaitForFences(importer.getDevice(), 1, &fence, VK_TRUE, UINT64_MAX);
+    }
+    vkResetFences(importer.getDevice(), 1, &fence);
+    // the command buffer is done, its pool may be recycled
+    importer.advanceFrame();
+    if (result != VK_SUCCESS)
+    {
+        vmaDestroyBuffer(importer.getAllocator(), buffer, allocation);
+        throw std::runtime_error("Could not read back imported image!");
+    }
+
+    vmaInvalidateAllocation(importer.getAllocator(), allocation, 0, VK_WHOLE_SIZE);
+    const std::byte* mapped = static_cast<const std::byte*>(allocationInfo.pMappedData);
+    std::vector<std::byte> data(mapped, mapped + bufferInfo.size);
+    vmaDestroyBuffer(importer.getAllocator(), buffer, allocation);
+    return data;
+}
+
+/**
+ * Creates images of mixed sizes and formats, one by one and batched, and checks in release builds as well:
+ * - no two images overlap in their exported memory, dedicated images are alone in theirs
+ * - a second device on the same GPU imports every handle and binds the images at their offsets
+ * - the content uploaded on this device reads back unchanged on the second device,
+ *   for an image uploaded twice before a flush that is the second upload
+ */
+int runInteropVerification(Device& device, const DeviceOptions& options, uint32_t imageCount)
+{
+    const uint32_t sideLengths[] = { 16, 32, 64, 100, 128, 300, 512, 1024 };
+    const VkFormat formats[] = { VK_FORMAT_R8G8B8A8_UNORM, VK_FORMAT_R16G16B16A16_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT };
+    uint32_t errors = 0;
+
+    std::mt19937 rng(imageCount);
+    std::vector<std::unique_ptr<Image>> images;
+    while (images.size() < imageCount)
+    {
+        // a quarter of the images in batches, to cover both ways of creating them
+        std::vector<ImageDesc> descs(rng() % 4 == 0 ? std::min<size_t>(8, imageCount - images.size()) : 1);
+        for (ImageDesc& desc : descs)
+        {
+            desc.width = sideLengths[rng() % std::size(sideLengths)];
+            desc.height = sideLengths[rng() % std::size(sideLengths)];
+            desc.format = formats[rng() % std::size(formats)];
+            desc.usageFlags = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT
+                | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+        }
+        if (descs.size() == 1)
+        {
+            images.push_back(std::make_unique<Image>(&device, descs.front()));
+        }
+        else
+        {
+            for (std::unique_ptr<Image>& image : device.createImages(descs))
+            {
+                images.push_back(std::move(image));
+            }
+        }
+    }
+
+    // export identity: images in the same memory must not overlap
+    std::map<std::pair<uint64_t, uint64_t>, std::vector<const ExternalMemoryRange*>> memories;
+    for (const std::unique_ptr<Image>& image : images)
+    {
+        const ExternalMemoryRange& range = image->getExternalMemoryRange();
+        if (!isValidHandle(range.handle))
+        {
+            std::cerr << "image has an invalid handle " << range.handle << "!" << std::endl;
+            errors++;
+            continue;
+        }
+        if (range.offset + range.size > range.allocationSize)
+        {
+            std::cerr << "handle " << range.handle << " offset " << range.offset << " size " << range.size
+                << " exceeds its memory of " << range.allocationSize << " bytes!" << std::endl;
+            errors++;
+        }
+        memories[getMemoryIdentity(range.handle)].push_back(&range);
+    }
+    for (auto& [identity, ranges] : memories)
+    {
+        std::sort(ranges.begin(), ranges.end(), [](const ExternalMemoryRange* a, const ExternalMemoryRange* b)
+        {
+            return a->offset < b->offset;
+        });
+        for (size_t i = 0; i < ranges.size(); i++)
+        {
+            if (ranges[i]->dedicated && ranges.size() > 1)
+            {
+                std::cerr << "dedicated memory of handle " << ranges[i]->handle << " is shared by "
+                    << ranges.size() << " images!" << std::endl;
+                errors++;
+            }
+            if (i > 0 && ranges[i - 1]->offset + ranges[i - 1]->size > ranges[i]->offset)
+            {
+                std::cerr << "handle " << ranges[i]->handle << ": images at offsets " << ranges[i - 1]->offset
+                    << " and " << ranges[i]->offset << " overlap!" << std::endl;
+                errors++;
+            }
+        }
+    }
+
+    // content the second device has to see
+    UploadEngine uploads(&device);
+    std::vector<std::vector<std::byte>> contents;
+    for (uint32_t i = 0; i < images.size(); i++)
+    {
+        if (i == 0)
+        {
+            // uploaded twice before the flush, only the second content may end up in the image
+            const std::vector<std::byte> stale = makeTestPattern(images[i]->getDesc(), imageCount);
+            uploads.upload(*images[i], stale.data(), stale.size());
+        }
+        contents.push_back(makeTestPattern(images[i]->getDesc(), i));
+        uploads.upload(*images[i], contents.back().data(), contents.back().size());
+    }
+    uploads.wait(uploads.flush());
+
+    // a second device on the same GPU, standing in for another process or API
+    Device importer(options);
+    const VkPhysicalDeviceIDProperties& exporterIds = device.getPhysicalDeviceInfo().idProperties;
+    const VkPhysicalDeviceIDProperties& importerIds = importer.getPhysicalDeviceInfo().idProperties;
+    if (memcmp(exporterIds.deviceUUID, importerIds.deviceUUID, VK_UUID_SIZE) != 0
+        || memcmp(exporterIds.driverUUID, importerIds.driverUUID, VK_UUID_SIZE) != 0)
+    {
+        std::cerr << "the second device runs on another GPU or driver, opaque handles can't be imported!" << std::endl;
+        return 1;
+    }
+
+    VkFenceCreateInfo fenceInfo{};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    VkFence fence = VK_NULL_HANDLE;
+    VkResult result = vkCreateFence(importer.getDevice(), &fenceInfo, nullptr, &fence);
+    if (result != VK_SUCCESS)
+    {
+        std::cerr << "Could not create fence!" << std::endl;
+        return 1;
+    }
+
+    // pooled memory is imported once per handle, like any consumer would do
+    std::map<Handle, VkDeviceMemory> importedMemory;
+    uint32_t imports = 0;
+    for (uint32_t i = 0; i < images.size(); i++)
+    {
+        const ExternalMemoryRange& range = images[i]->getExternalMemoryRange();
+        VkExternalMemoryImageCreateInfo externalInfo;
+        const VkImageCreateInfo createInfo = Image::makeImageCreateInfo(images[i]->getDesc(),
+            importer.getQueueFamilies(), externalInfo);
+        VkImage image = VK_NULL_HANDLE;
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        try
+        {
+            result = vkCreateImage(importer.getDevice(), &createInfo, nullptr, &image);
+            if (result != VK_SUCCESS)
+            {
+                throw std::runtime_error("Could not create image for import!");
+            }
+            VkMemoryRequirements requirements;
+            vkGetImageMemoryRequirements(importer.getDevice(), image, &requirements);
+            if (requirements.size > range.size)
+            {
+                throw std::runtime_error("the imported image needs " + std::to_string(requirements.size)
+                    + " bytes, but only " + std::to_string(range.size) + " were exported");
+            }
+
+            if (range.dedicated)
+            {
+                memory = importer.importMemory(range, image);
+                imports++;
+            }
+            else
+            {
+                auto it = importedMemory.find(range.handle);
+                if (it == importedMemory.end())
+                {
+                    it = importedMemory.emplace(range.handle, importer.importMemory(range)).first;
+                    imports++;
+                }
+                memory = it->second;
+            }
+            result = vkBindImageMemory(importer.getDevice(), image, memory, range.offset);
+            if (result != VK_SUCCESS)
+            {
+                throw std::runtime_error("Could not bind imported memory!");
+            }
+
+            const std::vector<std::byte> content = readImportedImage(importer, image, images[i]->getDesc(),
+                images[i]->getLayout(), fence);
+            if (content != contents[i])
+            {
+                std::cerr << "handle " << range.handle << " offset " << range.offset
+                    << ": the imported content differs from the uploaded one!" << std::endl;
+                errors++;
+            }
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "handle " << range.handle << " offset " << range.offset << ": " << e.what() << std::endl;
+            errors++;
+        }
+        vkDestroyImage(importer.getDevice(), image, nullptr);
+        if (range.dedicated && memory)
+        {
+            vkFreeMemory(importer.getDevice(), memory, nullptr);
+        }
+    }
+    for (const auto& [handle, memory] : importedMemory)
+    {
+        vkFreeMemory(importer.getDevice(), memory, nullptr);
+    }
+    vkDestroyFence(importer.getDevice(), fence, nullptr);
+
+    std::cout << "interop verification with " << images.size() << " images in " << memories.size()
+        << " memory blocks, " << imports << " imports: "
+        << (errors == 0 ? "passed" : std::to_string(errors) + " errors") << std::endl;
+    return errors == 0 ? 0 : 1;
+}
+
+/**
+ * Starts the device several times with Device::createAsync and prints the average
+ * time per startup phase, next to the time the calling thread was blocked
+ */
+int runStartupBenchmark(const DeviceOptions& options, uint32_t runs)
+{
+    using std::chrono::microseconds;
+    DeviceStartupTimings sum;
+    microseconds blocked{ 0 };
+    microseconds wallClock{ 0 };
+    for (uint32_t run = 0; run < runs; run++)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        std::future<std::unique_ptr<Device>> pending = Device::createAsync(options);
+        blocked += std::chrono::duration_cast<microseconds>(std::chrono::steady_clock::now() - start);
+        std::unique_ptr<Device> device = pending.get();
+        wallClock += std::chrono::duration_cast<microseconds>(std::chrono::steady_clock::now() - start);
+
+        const DeviceStartupTimings& timings = device->getStartupTimings();
+        sum.loader += timings.loader;
+        sum.instance += timings.instance;
+        sum.physicalDevice += timings.physicalDevice;
+        sum.logicalDevice += timings.logicalDevice;
+        sum.allocator += timings.allocator;
+    }
+
+    auto print = [runs](const char* phase, microseconds time)
+    {
+        std::cout << "\t" << phase << ": " << time.count() / runs << " us" << std::endl;
+    };
+    std::cout << "device startup over " << runs << " runs, validation "
+        << (options.enableValidation ? "on" : "off") << ":" << std::endl;
+    print("loader", sum.loader);
+    print("instance", sum.instance);
+    print("physical device", sum.physicalDevice);
+    print("logical device", sum.logicalDevice);
+    print("allocator", sum.allocator);
+    print("total", sum.getTotal());
+    print("calling thread blocked", blocked);
+    print("until ready", wallClock);
+    return 0;
+}
+}
+
+int main(int argc, char** argv)
+{
+    DeviceOptions options;
+    uint32_t startupRuns = 0;
+    uint32_t id = UINT32_MAX;
+    uint32_t stressThreads = 0;
+    VkDeviceSize budgetMiB = 0;
+    uint32_t defragmentImages = 0;
+    const char* statsFile = nullptr;
+    const char* traceFile = nullptr;
+    uint32_t gpuTimerFrames = 0;
+    uint32_t verifyImages = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (i + 1 < argc &&
+            (strcmp(argv[i], "-d") == 0
+            || strcmp(argv[i], "--device") == 0))
+        {
+            id = std::atoi(argv[++i]);
+        }
+        else if (i + 1 < argc &&
+            (strcmp(argv[i], "-s") == 0
+            || strcmp(argv[i], "--stress") == 0))
+        {
+            stressThreads = std::atoi(argv[++i]);
+        }
+        else if (i + 1 < argc &&
+            (strcmp(argv[i], "-b") == 0
+            || strcmp(argv[i], "--budget") == 0))
+        {
+            budgetMiB = std::atoi(argv[++i]);
+        }
+        else if (i + 1 < argc &&
+            (strcmp(argv[i], "-f") == 0
+            || strcmp(argv[i], "--defragment") == 0))
+        {
+            defragmentImages = std::atoi(argv[++i]);
+        }
+        else if (i + 1 < argc &&
+            (strcmp(argv[i], "-j") == 0
+            || strcmp(argv[i], "--stats-json") == 0))
+        {
+            statsFile = argv[++i];
+        }
+        else if (i + 1 < argc &&
+            (strcmp(argv[i], "-t") == 0
+            || strcmp(argv[i], "--startup") == 0))
+        {
+            startupRuns = std::atoi(argv[++i]);
+        }
+        else if (i + 1 < argc &&
+            (strcmp(argv[i], "-r") == 0
+            || strcmp(argv[i], "--trace") == 0))
+        {
+            traceFile = argv[++i];
+        }
+        else if (i + 1 < argc &&
+            (strcmp(argv[i], "-g") == 0
+            || strcmp(argv[i], "--gpu-timers") == 0))
+        {
+            gpuTimerFrames = std::atoi(argv[++i]);
+        }
+        else if (i + 1 < argc &&
+            (strcmp(argv[i], "-i") == 0
+            || strcmp(argv[i], "--verify") == 0))
+        {
+            verifyImages = std::atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-v") == 0
+            || strcmp(argv[i], "--validation") == 0)
+        {
+            options.enableValidation = true;
+        }
+        else if(strcmp(argv[i], "-h") == 0
+            || strcmp(argv[i], "--help") == 0)
         {
             std::cout << "Bug reproduction for creating small images with a shared handle" << std::endl;
             std::cout << "Observe that for \"small\" images, the handle is always the same" << std::endl;
+            std::cout << "as they share one memory block, but their offsets into that block differ" << std::endl;
             std::cout << std::endl;
             std::cout << "Usage:" << std::endl;
             std::cout << "VmaSharedTexBug.exe" << std::endl;
@@ -32,12 +997,36 @@ int main(int argc, char** argv)
             std::cout << "\t-d <id> || --device <id>" << std::endl;
             std::cout << "\t\t Choose a device by id" << std::endl;
             std::cout << "\t\t (There is no input sanitation for this bug repro...)" << std::endl;
+            std::cout << "\t-s <threads> || --stress <threads>" << std::endl;
+            std::cout << "\t\t Create and destroy images from the given number of threads" << std::endl;
+            std::cout << "\t\t and check that handles stay unique and nothing leaks" << std::endl;
+            std::cout << "\t-b <MiB> || --budget <MiB>" << std::endl;
+            std::cout << "\t\t Simulate a memory budget of the given size and check that" << std::endl;
+            std::cout << "\t\t allocations are refused by priority before it is exceeded" << std::endl;
+            std::cout << "\t-f <images> || --defragment <images>" << std::endl;
+            std::cout << "\t\t Fragment the interop pools with the given number of small images" << std::endl;
+            std::cout << "\t\t and compact them again, printing what every pass moved" << std::endl;
+            std::cout << "\t-j <file> || --stats-json <file>" << std::endl;
+            std::cout << "\t\t Dump the allocation stats as JSON to the file every second and at exit" << std::endl;
+            std::cout << "\t-t <runs> || --startup <runs>" << std::endl;
+            std::cout << "\t\t Start the device the given number of times and print the time per startup phase" << std::endl;
+            std::cout << "\t-v || --validation" << std::endl;
+            std::cout << "\t\t Enable the validation layers, which only debug builds do by default" << std::endl;
+            std::cout << "\t-r <file> || --trace <file>" << std::endl;
+            std::cout << "\t\t Write the device startup and image creation as Chrome trace at exit" << std::endl;
+            std::cout << "\t\t (needs a build with the VMA_INTEROP_TRACING option)" << std::endl;
+            std::cout << "\t-g <frames> || --gpu-timers <frames>" << std::endl;
+            std::cout << "\t\t Time a GPU clear for the given number of frames with timestamp queries" << std::endl;
+            std::cout << "\t-i <images> || --verify <images>" << std::endl;
+            std::cout << "\t\t Create the given number of images of mixed sizes and formats, check that none" << std::endl;
+            std::cout << "\t\t overlap in their exported memory, import them into a second device" << std::endl;
+            std::cout << "\t\t and compare their content there" << std::endl;
             std::cout << "\t-h || --help Print this help" << std::endl;
 
             return 0;
         }
-        else if (strcmp(argv[1], "-l") == 0
-            || strcmp(argv[1], "--list-devices") == 0)
+        else if (strcmp(argv[i], "-l") == 0
+            || strcmp(argv[i], "--list-devices") == 0)
         {
             std::cout << "available devices:" << std::endl;
             auto devices = Device::getDevices();
@@ -54,32 +1043,118 @@ int main(int argc, char** argv)
             return -1;
         }
     }
-    Device device(id);
+    options.deviceId = id;
+    if (traceFile && !Trace::isEnabled())
+    {
+        std::cout << "Tracing is not compiled in, configure with -DVMA_INTEROP_TRACING=ON" << std::endl;
+    }
+    auto finish = [traceFile](int result)
+    {
+        if (traceFile && Trace::isEnabled() && !Trace::writeChromeTrace(traceFile))
+        {
+            std::cerr << "Could not write trace to " << traceFile << "!" << std::endl;
+        }
+        return result;
+    };
+    if (startupRuns > 0)
+    {
+        return finish(runStartupBenchmark(options, startupRuns));
+    }
 
-    uint32_t largeLength = 512;
-    // don't know the exact side length that will lead to a crash,
-    // I could reproduce it with ~300 and lower
-    uint32_t smallLength = 32;
-    VkImageUsageFlags usageFlags = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
-    Image img1(&device, largeLength, largeLength, usageFlags);
-    Image img2(&device, largeLength, largeLength, usageFlags);
-    Image imgSmall1(&device, smallLength, smallLength, usageFlags);
-    Image imgSmall2(&device, smallLength, smallLength, usageFlags);
+    Device device(options);
+    if (statsFile)
+    {
+        device.startStatsDump(statsFile, std::chrono::seconds(1));
+    }
 
-    // these asserts pass
-    // large images have different handles, as expected
-    assert(img1.getExternalHandle() != img2.getExternalHandle());
-    assert(img1.getExternalHandle() != imgSmall1.getExternalHandle());
-    assert(img1.getExternalHandle() != imgSmall2.getExternalHandle());
+    if (stressThreads > 0)
+    {
+        return finish(runStressTest(device, stressThreads));
+    }
+    if (budgetMiB > 0)
+    {
+        return finish(runBudgetTest(device, budgetMiB));
+    }
+    if (defragmentImages > 0)
+    {
+        return finish(runDefragmentationTest(device, defragmentImages));
+    }
+    if (gpuTimerFrames > 0)
+    {
+        return finish(runGpuTimerTest(device, gpuTimerFrames));
+    }
+    if (verifyImages > 0)
+    {
+        return finish(runInteropVerification(device, options, verifyImages));
+    }
+
+    // checked in release builds as well, see --verify for the thorough version
+    uint32_t errors = 0;
+    auto check = [&errors](bool condition, const char* description)
+    {
+        if (!condition)
+        {
+            std::cerr << "check failed: " << description << std::endl;
+            errors++;
+        }
+    };
 
-    // these asserts pass on several NVidia GPUs, but not on the integrated Intel iGPU
-    // still, large image
-    assert(img2.getExternalHandle() != imgSmall1.getExternalHandle());
-    assert(img2.getExternalHandle() != imgSmall2.getExternalHandle());
+    {
+        uint32_t largeLength = 512;
+        // don't know the exact side length that will lead to a crash,
+        // I could reproduce it with ~300 and lower
+        uint32_t smallLength = 32;
+        VkImageUsageFlags usageFlags = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+        Image img1(&device, largeLength, largeLength, usageFlags);
+        Image img2(&device, largeLength, largeLength, usageFlags);
+        Image imgSmall1(&device, smallLength, smallLength, usageFlags);
+        Image imgSmall2(&device, smallLength, smallLength, usageFlags);
 
-    // this assert fails on both NVidia and Intel iGPU
-    // but the small images all have the exact same handle
-    assert(imgSmall1.getExternalHandle() != imgSmall2.getExternalHandle());
+        // small images are sub-allocated from the same memory block,
+        // so they share the exported handle, but never the range within it
+        auto isSameMemory = [](const Image& a, const Image& b)
+        {
+            const ExternalMemoryRange& rangeA = a.getExternalMemoryRange();
+            const ExternalMemoryRange& rangeB = b.getExternalMemoryRange();
+            return rangeA.handle == rangeB.handle && rangeA.offset == rangeB.offset;
+        };
 
-    return 0;
+        // large images have different handles, as expected
+        check(img1.getExternalHandle() != img2.getExternalHandle(), "large images have different handles");
+        check(!isSameMemory(img1, imgSmall1), "img1 and imgSmall1 use different memory");
+        check(!isSameMemory(img1, imgSmall2), "img1 and imgSmall2 use different memory");
+        check(!isSameMemory(img2, imgSmall1), "img2 and imgSmall1 use different memory");
+        check(!isSameMemory(img2, imgSmall2), "img2 and imgSmall2 use different memory");
+
+        // the small images may have the exact same handle (shared block),
+        // but are still distinguishable by their offset
+        check(!isSameMemory(imgSmall1, imgSmall2), "small images differ in handle or offset");
+
+        for(const Image* img : {&img1, &img2, &imgSmall1, &imgSmall2})
+        {
+            const ExternalMemoryRange& range = img->getExternalMemoryRange();
+            std::cout << "handle " << range.handle << " offset " << range.offset
+                << " size " << range.size << " (block size " << range.allocationSize
+                << ", memory type " << range.memoryTypeIndex << ")"
+                << (img->getAllocationDecision().path == AllocationPath::Dedicated ? " dedicated" : " pooled")
+                << std::endl;
+        }
+
+        for(const InteropPoolStats& pool : device.getInteropPoolStats())
+        {
+            std::cout << pool.name << " pool (usage " << pool.usageFlags << "): "
+                << pool.allocationCount << " allocations in " << pool.blockCount << " blocks, "
+                << pool.allocationBytes << " / " << pool.blockBytes << " bytes used" << std::endl;
+        }
+    }
+
+    // the images are retired with their destruction and have to be handed back
+    // once their frame completed, without waiting for the device
+    for(uint32_t frame = 0; frame <= device.getFramesInFlight(); frame++)
+    {
+        device.advanceFrame();
+    }
+    check(device.getExportedMemoryCount() == 0, "exported memory is released after the images' frames completed");
+
+    return finish(errors == 0 ? 0 : 1);
 }
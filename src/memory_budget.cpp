@@ -0,0 +1,194 @@
+#include "memory_budget.h"
+
+#include <algorithm>
+#include <string>
+
+MemoryBudgetMonitor::MemoryBudgetMonitor(VmaAllocator allocator,
+    const VkPhysicalDeviceMemoryProperties& memoryProperties, MemoryBudgetSettings settings)
+    : allocator(allocator), memoryProperties(memoryProperties), settings(settings)
+{
+    VkDeviceSize largestSize = 0;
+    for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++)
+    {
+        const VkMemoryHeap& heap = memoryProperties.memoryHeaps[i];
+        if ((heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) && heap.size > largestSize)
+        {
+            largestSize = heap.size;
+            deviceLocalHeap = i;
+        }
+    }
+}
+
+MemoryPressure MemoryBudgetMonitor::poll()
+{
+    const MemoryPressure pressure = getPressure();
+    if (pressure != MemoryPressure::Normal)
+    {
+        notify(pressure);
+    }
+    return pressure;
+}
+
+std::vector<HeapBudget> MemoryBudgetMonitor::getHeapBudgets() const
+{
+    VmaBudget budgets[VK_MAX_MEMORY_HEAPS];
+    vmaGetHeapBudgets(allocator, budgets);
+
+    std::lock_guard lock(mutex);
+    std::vector<HeapBudget> heaps(memoryProperties.memoryHeapCount);
+    for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++)
+    {
+        HeapBudget& heap = heaps[i];
+        heap.heapIndex = i;
+        heap.deviceLocal = memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT;
+        heap.usage = budgets[i].usage;
+        heap.budget = budgets[i].budget;
+        heap.blockBytes = budgets[i].statistics.blockBytes;
+        heap.allocationBytes = budgets[i].statistics.allocationBytes;
+        if (simulatedBudget > 0)
+        {
+            // only count what this allocator uses, other processes would blur the simulation
+            heap.usage = heap.blockBytes;
+            heap.budget = std::min(heap.budget, simulatedBudget);
+        }
+    }
+    return heaps;
+}
+
+MemoryPressure MemoryBudgetMonitor::getPressure() const
+{
+    return getPressure(queryDeviceLocalBudget(), 0);
+}
+
+bool MemoryBudgetMonitor::canAllocate(VkDeviceSize size, AllocationPriority priority) const
+{
+    return isAllowed(getPressure(queryDeviceLocalBudget(), size), priority);
+}
+
+void MemoryBudgetMonitor::checkAllocation(VkDeviceSize size, AllocationPriority priority)
+{
+    MemoryPressure pressure = getPressure(queryDeviceLocalBudget(), size);
+    if (isAllowed(pressure, priority))
+    {
+        return;
+    }
+
+    // give the caches a chance to make room before refusing, what they gave up
+    // only counts once it is actually destroyed
+    notify(pressure);
+    {
+        std::shared_lock lock(handlersMutex);
+        if (reclaimHandler)
+        {
+            reclaimHandler();
+        }
+    }
+    pressure = getPressure(queryDeviceLocalBudget(), size);
+    if (isAllowed(pressure, priority))
+    {
+        return;
+    }
+
+    {
+        std::lock_guard lock(mutex);
+        stats.refusals++;
+    }
+    throw MemoryPressureError("Allocation of " + std::to_string(size)
+        + " bytes refused, the device local heap is running out of budget!");
+}
+
+uint64_t MemoryBudgetMonitor::addPressureHandler(PressureHandler handler)
+{
+    std::unique_lock lock(handlersMutex);
+    const uint64_t id = nextHandlerId++;
+    handlers.emplace(id, std::move(handler));
+    return id;
+}
+
+void MemoryBudgetMonitor::removePressureHandler(uint64_t id)
+{
+    std::unique_lock lock(handlersMutex);
+    handlers.erase(id);
+}
+
+void MemoryBudgetMonitor::setReclaimHandler(ReclaimHandler handler)
+{
+    std::unique_lock lock(handlersMutex);
+    reclaimHandler = std::move(handler);
+}
+
+void MemoryBudgetMonitor::setSimulatedBudget(VkDeviceSize budget)
+{
+    std::lock_guard lock(mutex);
+    simulatedBudget = budget;
+}
+
+MemoryBudgetSettings MemoryBudgetMonitor::getSettings() const
+{
+    std::lock_guard lock(mutex);
+    return settings;
+}
+
+void MemoryBudgetMonitor::setSettings(const MemoryBudgetSettings& settings)
+{
+    std::lock_guard lock(mutex);
+    this->settings = settings;
+}
+
+MemoryBudgetMonitor::Stats MemoryBudgetMonitor::getStats() const
+{
+    std::lock_guard lock(mutex);
+    return stats;
+}
+
+HeapBudget MemoryBudgetMonitor::queryDeviceLocalBudget() const
+{
+    return getHeapBudgets()[deviceLocalHeap];
+}
+
+MemoryPressure MemoryBudgetMonitor::getPressure(const HeapBudget& heap, VkDeviceSize additionalBytes) const
+{
+    if (heap.budget == 0)
+    {
+        return MemoryPressure::Critical;
+    }
+    const double ratio = double(heap.usage + additionalBytes) / double(heap.budget);
+
+    std::lock_guard lock(mutex);
+    if (ratio >= settings.criticalRatio)
+    {
+        return MemoryPressure::Critical;
+    }
+    if (ratio >= settings.elevatedRatio)
+    {
+        return MemoryPressure::Elevated;
+    }
+    return MemoryPressure::Normal;
+}
+
+bool MemoryBudgetMonitor::isAllowed(MemoryPressure pressure, AllocationPriority priority)
+{
+    switch (priority)
+    {
+    case AllocationPriority::Low:
+        return pressure == MemoryPressure::Normal;
+    case AllocationPriority::Normal:
+        return pressure != MemoryPressure::Critical;
+    case AllocationPriority::High:
+    default:
+        return true;
+    }
+}
+
+void MemoryBudgetMonitor::notify(MemoryPressure pressure)
+{
+    {
+        std::lock_guard lock(mutex);
+        stats.pressureEvents++;
+    }
+    std::shared_lock lock(handlersMutex);
+    for (const auto& [id, handler] : handlers)
+    {
+        handler(pressure);
+    }
+}
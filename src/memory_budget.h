@@ -0,0 +1,149 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <vector>
+
+#include <volk.h>
+#include <vk_mem_alloc.h>
+
+enum class AllocationPriority
+{
+    /** refused as soon as memory gets tight, e.g. for caches or previews */
+    Low,
+    Normal,
+    /** never refused by the budget policy */
+    High,
+};
+
+enum class MemoryPressure
+{
+    Normal,
+    /** caches should shrink, low priority allocations are refused */
+    Elevated,
+    /** only high priority allocations go through */
+    Critical,
+};
+
+struct HeapBudget
+{
+    uint32_t heapIndex = 0;
+    bool deviceLocal = false;
+    /** memory used by the process on this heap and what it may use, as reported by VMA */
+    VkDeviceSize usage = 0;
+    VkDeviceSize budget = 0;
+    /** memory in VMA blocks and in allocations of this allocator */
+    VkDeviceSize blockBytes = 0;
+    VkDeviceSize allocationBytes = 0;
+
+    VkDeviceSize getHeadroom() const
+    {
+        return budget > usage ? budget - usage : 0;
+    }
+};
+
+struct MemoryBudgetSettings
+{
+    /** fraction of the budget from which on the pressure is elevated */
+    float elevatedRatio = 0.8f;
+    /** fraction of the budget from which on the pressure is critical */
+    float criticalRatio = 0.95f;
+};
+
+/**
+ * Thrown when the budget policy refuses an allocation, before the driver runs out of memory.
+ * Callers can retry with a smaller format or a higher priority
+ */
+class MemoryPressureError : public std::runtime_error
+{
+public:
+    using std::runtime_error::runtime_error;
+};
+
+/**
+ * Watches the heap budgets of the allocator (VK_EXT_memory_budget if the device has it,
+ * VMA's estimate otherwise) and turns them into a pressure level for the device local heap.
+ * Under pressure the registered handlers are asked to free memory and allocations below the
+ * required priority are refused. What the handlers give up usually only gets retired, the reclaim
+ * handler destroys whatever of it is idle before an allocation is checked again.
+ * Thread safe, handlers are called without internal locks held
+ */
+class MemoryBudgetMonitor
+{
+public:
+    using PressureHandler = std::function<void(MemoryPressure pressure)>;
+    using ReclaimHandler = std::function<void()>;
+
+    struct Stats
+    {
+        uint64_t refusals = 0;
+        uint64_t pressureEvents = 0;
+    };
+
+    MemoryBudgetMonitor(VmaAllocator allocator, const VkPhysicalDeviceMemoryProperties& memoryProperties,
+        MemoryBudgetSettings settings = {});
+
+    /**
+     * Fetches the current budgets and calls the pressure handlers if the pressure is not normal.
+     * Cheap enough to be called every frame
+     */
+    MemoryPressure poll();
+
+    std::vector<HeapBudget> getHeapBudgets() const;
+    MemoryPressure getPressure() const;
+    /**
+     * @returns whether the policy allows an allocation of the given size on the device local heap
+     */
+    bool canAllocate(VkDeviceSize size, AllocationPriority priority) const;
+    /**
+     * Like canAllocate, but lets the pressure handlers free memory before giving up.
+     * Throws MemoryPressureError if the allocation is refused
+     */
+    void checkAllocation(VkDeviceSize size, AllocationPriority priority);
+
+    /**
+     * @returns an id for removing the handler again
+     */
+    uint64_t addPressureHandler(PressureHandler handler);
+    void removePressureHandler(uint64_t id);
+    /**
+     * Called by checkAllocation after the pressure handlers, to destroy the idle resources they retired
+     */
+    void setReclaimHandler(ReclaimHandler handler);
+
+    /**
+     * Caps the budget of every heap, for testing the behavior under pressure. 0 disables it
+     */
+    void setSimulatedBudget(VkDeviceSize budget);
+
+    MemoryBudgetSettings getSettings() const;
+    void setSettings(const MemoryBudgetSettings& settings);
+    Stats getStats() const;
+
+private:
+    HeapBudget queryDeviceLocalBudget() const;
+    MemoryPressure getPressure(const HeapBudget& heap, VkDeviceSize additionalBytes) const;
+    static bool isAllowed(MemoryPressure pressure, AllocationPriority priority);
+    void notify(MemoryPressure pressure);
+
+private:
+    VmaAllocator allocator = VK_NULL_HANDLE;
+    VkPhysicalDeviceMemoryProperties memoryProperties{};
+    /** the largest device local heap, which images live in */
+    uint32_t deviceLocalHeap = 0;
+
+    MemoryBudgetSettings settings;
+    VkDeviceSize simulatedBudget = 0;
+    Stats stats;
+    mutable std::mutex mutex;
+
+    std::map<uint64_t, PressureHandler> handlers;
+    ReclaimHandler reclaimHandler;
+    uint64_t nextHandlerId = 1;
+    /** held shared while handlers run, so removing a handler waits for its calls to finish */
+    std::shared_mutex handlersMutex;
+};
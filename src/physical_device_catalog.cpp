@@ -0,0 +1,288 @@
+#include "physical_device_catalog.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <stdexcept>
+
+namespace
+{
+constexpr uint32_t SNAPSHOT_MAGIC = 0x50444353; // "PDCS"
+/** bump whenever the layout of the snapshot or of PhysicalDeviceInfo changes */
+constexpr uint32_t SNAPSHOT_VERSION = 2;
+
+template<typename T>
+void write(std::ostream& out, const T& value)
+{
+    out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template<typename T>
+bool read(std::istream& in, T& value)
+{
+    return static_cast<bool>(in.read(reinterpret_cast<char*>(&value), sizeof(T)));
+}
+}
+
+bool PhysicalDeviceInfo::hasExtension(const std::string& extension) const
+{
+    return extensions.contains(extension);
+}
+
+bool PhysicalDeviceInfo::hasExtensions(const std::vector<const char*>& requestedExtensions) const
+{
+    return extensions.containsAll(requestedExtensions);
+}
+
+PhysicalDeviceCatalog::PhysicalDeviceCatalog(VkInstance instance, std::filesystem::path snapshotFile)
+    : snapshotFile(std::move(snapshotFile))
+{
+    uint32_t deviceCount = 0;
+    vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
+    std::vector<VkPhysicalDevice> physicalDevices(deviceCount);
+    vkEnumeratePhysicalDevices(instance, &deviceCount, physicalDevices.data());
+
+    // the identifying properties are always queried, they are the key of the snapshot
+    devices.resize(deviceCount);
+    for (uint32_t i = 0; i < deviceCount; i++)
+    {
+        devices[i].index = i;
+        devices[i].physicalDevice = physicalDevices[i];
+        queryProperties(devices[i]);
+    }
+
+    if (!this->snapshotFile.empty() && loadSnapshot())
+    {
+        loadedFromSnapshot = true;
+        return;
+    }
+
+    // drivers may take a while per device, so query all of them at once
+    std::vector<std::future<PhysicalDeviceInfo>> queries;
+    for (uint32_t i = 0; i < deviceCount; i++)
+    {
+        queries.push_back(std::async(std::launch::async, &PhysicalDeviceCatalog::query, physicalDevices[i], i));
+    }
+    for (uint32_t i = 0; i < deviceCount; i++)
+    {
+        devices[i] = queries[i].get();
+    }
+}
+
+const std::vector<PhysicalDeviceInfo>& PhysicalDeviceCatalog::getDevices() const
+{
+    return devices;
+}
+
+bool PhysicalDeviceCatalog::wasLoadedFromSnapshot() const
+{
+    return loadedFromSnapshot;
+}
+
+std::filesystem::path PhysicalDeviceCatalog::getDefaultSnapshotFile()
+{
+    std::error_code error;
+    std::filesystem::path tempDirectory = std::filesystem::temp_directory_path(error);
+    if (error)
+    {
+        tempDirectory = std::filesystem::current_path();
+    }
+    return tempDirectory / "VmaSharedTexBug" / "physical_devices.bin";
+}
+
+PhysicalDeviceInfo PhysicalDeviceCatalog::query(VkPhysicalDevice physicalDevice, uint32_t index)
+{
+    PhysicalDeviceInfo info;
+    info.index = index;
+    info.physicalDevice = physicalDevice;
+    queryProperties(info);
+
+    VkPhysicalDeviceMemoryProperties2 memoryProperties{};
+    memoryProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+    vkGetPhysicalDeviceMemoryProperties2(physicalDevice, &memoryProperties);
+    info.memoryProperties = memoryProperties.memoryProperties;
+
+    VkPhysicalDeviceFeatures2 features{};
+    features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    VkPhysicalDeviceBufferDeviceAddressFeatures bufferDeviceAddressFeatures{};
+    bufferDeviceAddressFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_BUFFER_DEVICE_ADDRESS_FEATURES;
+    features.pNext = &bufferDeviceAddressFeatures;
+    VkPhysicalDeviceTimelineSemaphoreFeatures timelineFeatures{};
+    timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+    bufferDeviceAddressFeatures.pNext = &timelineFeatures;
+    VkPhysicalDeviceSynchronization2Features synchronization2Features{};
+    synchronization2Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES;
+    timelineFeatures.pNext = &synchronization2Features;
+    VkPhysicalDeviceHostQueryResetFeatures hostQueryResetFeatures{};
+    hostQueryResetFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_QUERY_RESET_FEATURES;
+    synchronization2Features.pNext = &hostQueryResetFeatures;
+    vkGetPhysicalDeviceFeatures2(physicalDevice, &features);
+
+    info.features = features.features;
+    info.bufferDeviceAddress = bufferDeviceAddressFeatures.bufferDeviceAddress;
+    info.timelineSemaphore = timelineFeatures.timelineSemaphore;
+    info.synchronization2 = synchronization2Features.synchronization2;
+    info.hostQueryReset = hostQueryResetFeatures.hostQueryReset;
+
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+    info.queueFamilies.resize(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, info.queueFamilies.data());
+
+    uint32_t extensionCount = 0;
+    vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+    std::vector<VkExtensionProperties> extensions(extensionCount);
+    vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, extensions.data());
+    info.extensions = CapabilitySet::fromExtensions(extensions);
+
+    return info;
+}
+
+void PhysicalDeviceCatalog::queryProperties(PhysicalDeviceInfo& info)
+{
+    VkPhysicalDeviceProperties2 properties{};
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    info.idProperties = {};
+    info.idProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+    properties.pNext = &info.idProperties;
+    vkGetPhysicalDeviceProperties2(info.physicalDevice, &properties);
+    info.idProperties.pNext = nullptr;
+    info.properties = properties.properties;
+}
+
+bool PhysicalDeviceCatalog::saveSnapshot() const
+{
+    if (snapshotFile.empty())
+    {
+        return false;
+    }
+    std::error_code error;
+    std::filesystem::create_directories(snapshotFile.parent_path(), error);
+
+    std::filesystem::path tempPath = snapshotFile;
+    tempPath += ".tmp";
+    {
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        write(out, SNAPSHOT_MAGIC);
+        write(out, SNAPSHOT_VERSION);
+        write(out, static_cast<uint32_t>(devices.size()));
+        for (const PhysicalDeviceInfo& info : devices)
+        {
+            // the key
+            write(out, info.properties.vendorID);
+            write(out, info.properties.deviceID);
+            write(out, info.properties.driverVersion);
+            write(out, info.properties.apiVersion);
+            write(out, info.idProperties.deviceUUID);
+            write(out, info.idProperties.driverUUID);
+
+            write(out, info.memoryProperties);
+            write(out, info.features);
+            write(out, info.bufferDeviceAddress);
+            write(out, info.timelineSemaphore);
+            write(out, info.synchronization2);
+            write(out, info.hostQueryReset);
+
+            write(out, static_cast<uint32_t>(info.queueFamilies.size()));
+            for (const VkQueueFamilyProperties& queueFamily : info.queueFamilies)
+            {
+                write(out, queueFamily);
+            }
+            write(out, static_cast<uint32_t>(info.extensions.size()));
+            for (const std::string& extension : info.extensions.getNames())
+            {
+                write(out, static_cast<uint32_t>(extension.size()));
+                out.write(extension.data(), extension.size());
+            }
+        }
+        if (!out)
+        {
+            return false;
+        }
+    }
+    std::filesystem::rename(tempPath, snapshotFile, error);
+    return !error;
+}
+
+bool PhysicalDeviceCatalog::loadSnapshot()
+{
+    std::ifstream in(snapshotFile, std::ios::binary);
+    uint32_t magic = 0;
+    uint32_t version = 0;
+    uint32_t deviceCount = 0;
+    if (!read(in, magic) || magic != SNAPSHOT_MAGIC
+        || !read(in, version) || version != SNAPSHOT_VERSION
+        || !read(in, deviceCount) || deviceCount != devices.size())
+    {
+        return false;
+    }
+
+    // only take over the snapshot if it is valid for every device
+    std::vector<PhysicalDeviceInfo> loaded = devices;
+    for (PhysicalDeviceInfo& info : loaded)
+    {
+        uint32_t vendorID = 0;
+        uint32_t deviceID = 0;
+        uint32_t driverVersion = 0;
+        uint32_t apiVersion = 0;
+        uint8_t deviceUUID[VK_UUID_SIZE];
+        uint8_t driverUUID[VK_UUID_SIZE];
+        if (!read(in, vendorID) || !read(in, deviceID) || !read(in, driverVersion)
+            || !read(in, apiVersion) || !read(in, deviceUUID) || !read(in, driverUUID))
+        {
+            return false;
+        }
+        if (vendorID != info.properties.vendorID
+            || deviceID != info.properties.deviceID
+            || driverVersion != info.properties.driverVersion
+            || apiVersion != info.properties.apiVersion
+            || std::memcmp(deviceUUID, info.idProperties.deviceUUID, VK_UUID_SIZE) != 0
+            || std::memcmp(driverUUID, info.idProperties.driverUUID, VK_UUID_SIZE) != 0)
+        {
+            // another device, or the driver has been updated
+            return false;
+        }
+
+        uint32_t queueFamilyCount = 0;
+        if (!read(in, info.memoryProperties) || !read(in, info.features)
+            || !read(in, info.bufferDeviceAddress) || !read(in, info.timelineSemaphore)
+            || !read(in, info.synchronization2) || !read(in, info.hostQueryReset)
+            || !read(in, queueFamilyCount))
+        {
+            return false;
+        }
+        info.queueFamilies.resize(queueFamilyCount);
+        for (VkQueueFamilyProperties& queueFamily : info.queueFamilies)
+        {
+            if (!read(in, queueFamily))
+            {
+                return false;
+            }
+        }
+
+        uint32_t extensionCount = 0;
+        if (!read(in, extensionCount))
+        {
+            return false;
+        }
+        std::vector<std::string> extensions(extensionCount);
+        for (std::string& extension : extensions)
+        {
+            uint32_t length = 0;
+            if (!read(in, length) || length > VK_MAX_EXTENSION_NAME_SIZE)
+            {
+                return false;
+            }
+            extension.resize(length);
+            if (!in.read(extension.data(), length))
+            {
+                return false;
+            }
+        }
+        info.extensions = CapabilitySet(std::move(extensions));
+    }
+
+    devices = std::move(loaded);
+    return true;
+}
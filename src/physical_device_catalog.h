@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include <volk.h>
+
+#include "capability_registry.h"
+
+/**
+ * Everything the device selection needs to know about a physical device
+ */
+struct PhysicalDeviceInfo
+{
+    uint32_t index = 0;
+    VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+
+    VkPhysicalDeviceProperties properties{};
+    VkPhysicalDeviceIDProperties idProperties{};
+    VkPhysicalDeviceMemoryProperties memoryProperties{};
+
+    VkPhysicalDeviceFeatures features{};
+    VkBool32 bufferDeviceAddress = VK_FALSE;
+    VkBool32 timelineSemaphore = VK_FALSE;
+    VkBool32 synchronization2 = VK_FALSE;
+    VkBool32 hostQueryReset = VK_FALSE;
+
+    std::vector<VkQueueFamilyProperties> queueFamilies;
+    CapabilitySet extensions;
+
+    bool hasExtension(const std::string& extension) const;
+    bool hasExtensions(const std::vector<const char*>& requestedExtensions) const;
+};
+
+/**
+ * Enumerates the physical devices of an instance once and queries everything about them,
+ * one thread per device. The result can be saved as a snapshot. As long as the devices
+ * and their driver versions did not change, the next launch takes the features, extensions,
+ * queue families and memory properties from the snapshot instead of querying them again
+ */
+class PhysicalDeviceCatalog
+{
+public:
+    /**
+     * @param snapshotFile snapshot to load, empty to always query
+     */
+    PhysicalDeviceCatalog(VkInstance instance, std::filesystem::path snapshotFile = {});
+
+    const std::vector<PhysicalDeviceInfo>& getDevices() const;
+    bool wasLoadedFromSnapshot() const;
+
+    /**
+     * Writes the snapshot to the file given on construction
+     * @returns false if there is no file or writing failed
+     */
+    bool saveSnapshot() const;
+
+    static std::filesystem::path getDefaultSnapshotFile();
+
+private:
+    static PhysicalDeviceInfo query(VkPhysicalDevice physicalDevice, uint32_t index);
+    /** the properties that identify a device and its driver */
+    static void queryProperties(PhysicalDeviceInfo& info);
+    /** @returns false if the snapshot is missing or outdated */
+    bool loadSnapshot();
+
+private:
+    std::vector<PhysicalDeviceInfo> devices;
+    std::filesystem::path snapshotFile;
+    bool loadedFromSnapshot = false;
+};
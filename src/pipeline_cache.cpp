@@ -0,0 +1,131 @@
+#include "pipeline_cache.h"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+namespace
+{
+std::vector<std::byte> readFile(const std::filesystem::path& path)
+{
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file)
+    {
+        return {};
+    }
+    const std::streamsize size = file.tellg();
+    if (size <= 0)
+    {
+        return {};
+    }
+    std::vector<std::byte> data(size);
+    file.seekg(0);
+    if (!file.read(reinterpret_cast<char*>(data.data()), size))
+    {
+        return {};
+    }
+    return data;
+}
+}
+
+PipelineCache::PipelineCache(VkDevice device, const VkPhysicalDeviceProperties& properties,
+    std::filesystem::path file)
+    : device(device), file(std::move(file))
+{
+    std::vector<std::byte> data = readFile(this->file);
+    loadedFromDisk = isCompatible(data, properties);
+    if (!data.empty() && !loadedFromDisk)
+    {
+        std::cout << "Pipeline cache " << this->file.string()
+            << " was written by another device or driver, starting with an empty cache" << std::endl;
+    }
+
+    VkPipelineCacheCreateInfo createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    if (loadedFromDisk)
+    {
+        createInfo.initialDataSize = data.size();
+        createInfo.pInitialData = data.data();
+    }
+
+    VkResult result = vkCreatePipelineCache(device, &createInfo, nullptr, &pipelineCache);
+    if (result != VK_SUCCESS && loadedFromDisk)
+    {
+        // the header matched, but the driver still did not like the content
+        loadedFromDisk = false;
+        createInfo.initialDataSize = 0;
+        createInfo.pInitialData = nullptr;
+        result = vkCreatePipelineCache(device, &createInfo, nullptr, &pipelineCache);
+    }
+    if (result != VK_SUCCESS)
+    {
+        throw std::runtime_error("Could not create pipeline cache!");
+    }
+}
+
+PipelineCache::~PipelineCache()
+{
+    save();
+    vkDestroyPipelineCache(device, pipelineCache, nullptr);
+}
+
+VkPipelineCache PipelineCache::getPipelineCache() const
+{
+    return pipelineCache;
+}
+
+bool PipelineCache::wasLoadedFromDisk() const
+{
+    return loadedFromDisk;
+}
+
+bool PipelineCache::save() const
+{
+    size_t size = 0;
+    VkResult result = vkGetPipelineCacheData(device, pipelineCache, &size, nullptr);
+    if (result != VK_SUCCESS || size == 0)
+    {
+        return false;
+    }
+    std::vector<std::byte> data(size);
+    result = vkGetPipelineCacheData(device, pipelineCache, &size, data.data());
+    if (result != VK_SUCCESS)
+    {
+        return false;
+    }
+
+    std::error_code error;
+    std::filesystem::create_directories(file.parent_path(), error);
+
+    // replace the file at once, so a crash while writing does not leave a broken cache behind
+    std::filesystem::path tempPath = file;
+    tempPath += ".tmp";
+    {
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(data.data()), size);
+        if (!out)
+        {
+            return false;
+        }
+    }
+    std::filesystem::rename(tempPath, file, error);
+    return !error;
+}
+
+bool PipelineCache::isCompatible(std::span<const std::byte> data, const VkPhysicalDeviceProperties& properties)
+{
+    VkPipelineCacheHeaderVersionOne header{};
+    if (data.size() < sizeof(header))
+    {
+        return false;
+    }
+    std::memcpy(&header, data.data(), sizeof(header));
+
+    return header.headerSize >= sizeof(header)
+        && header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+        && header.vendorID == properties.vendorID
+        && header.deviceID == properties.deviceID
+        && std::memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
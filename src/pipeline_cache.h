@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <span>
+
+#include <volk.h>
+
+/**
+ * A VkPipelineCache that is loaded from and saved to disk. Data written by another
+ * driver, device or cache format is ignored, so the cache starts empty instead
+ */
+class PipelineCache
+{
+public:
+    PipelineCache(VkDevice device, const VkPhysicalDeviceProperties& properties,
+        std::filesystem::path file);
+    /**
+     * Saves the cache
+     */
+    ~PipelineCache();
+
+    PipelineCache(const PipelineCache&) = delete;
+    PipelineCache& operator=(const PipelineCache&) = delete;
+
+    VkPipelineCache getPipelineCache() const;
+    /**
+     * @returns whether valid data was found on disk
+     */
+    bool wasLoadedFromDisk() const;
+
+    /**
+     * Writes the current content of the cache to disk
+     * @returns false if writing failed
+     */
+    bool save() const;
+
+    /**
+     * @returns whether the cache data has been written by the device with the given properties
+     */
+    static bool isCompatible(std::span<const std::byte> data, const VkPhysicalDeviceProperties& properties);
+
+private:
+    VkDevice device = VK_NULL_HANDLE;
+    VkPipelineCache pipelineCache = VK_NULL_HANDLE;
+    std::filesystem::path file;
+    bool loadedFromDisk = false;
+};
@@ -0,0 +1,396 @@
+#include "readback_engine.h"
+
+#include <stdexcept>
+
+#include "device.h"
+#include "image.h"
+#include "vulkan_utils.h"
+
+namespace
+{
+/** staging buffers are rounded up to this size so they can be reused for similar images */
+constexpr VkDeviceSize STAGING_GRANULARITY = 64 * 1024;
+}
+
+ReadbackEngine::ReadbackEngine(Device* device, uint32_t framesInFlight, QueueType queueType)
+    : device(device), queueType(queueType)
+{
+    if (framesInFlight == 0)
+    {
+        throw std::runtime_error("Readbacks need at least one frame in flight!");
+    }
+    createCommandPool();
+    createFrames(framesInFlight);
+    createTimeline();
+    completionThread = std::thread(&ReadbackEngine::completionLoop, this);
+}
+
+ReadbackEngine::~ReadbackEngine()
+{
+    waitIdle();
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    condition.notify_all();
+    completionThread.join();
+
+    for (Frame& frame : frames)
+    {
+        vkDestroyFence(device->getDevice(), frame.fence, nullptr);
+    }
+    vkDestroyCommandPool(device->getDevice(), commandPool, nullptr);
+    for (const auto& [size, staging] : freeStagingBuffers)
+    {
+        destroyStagingBuffer(staging);
+    }
+}
+
+std::future<std::vector<std::byte>> ReadbackEngine::readback(Image& image)
+{
+    Request request;
+    std::future<std::vector<std::byte>> future = request.promise.get_future();
+    record(image, std::move(request));
+    return future;
+}
+
+void ReadbackEngine::readback(Image& image, Callback callback)
+{
+    Request request;
+    request.callback = std::move(callback);
+    record(image, std::move(request));
+}
+
+void ReadbackEngine::flush(VkSemaphore waitSemaphore, uint64_t waitValue)
+{
+    std::lock_guard lock(mutex);
+    flushLocked(waitSemaphore, waitValue);
+}
+
+void ReadbackEngine::waitIdle()
+{
+    std::unique_lock lock(mutex);
+    flushLocked();
+    condition.wait(lock, [this] { return inFlight.empty(); });
+}
+
+ReadbackEngine::Stats ReadbackEngine::getStats() const
+{
+    std::lock_guard lock(mutex);
+    return stats;
+}
+
+void ReadbackEngine::createCommandPool()
+{
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    poolInfo.queueFamilyIndex = device->getQueueFamily(queueType);
+
+    VkResult result = vkCreateCommandPool(device->getDevice(), &poolInfo, nullptr, &commandPool);
+    if (result != VK_SUCCESS)
+    {
+        throw std::runtime_error("Could not create command pool for readbacks!");
+    }
+}
+
+void ReadbackEngine::createFrames(uint32_t framesInFlight)
+{
+    frames.resize(framesInFlight);
+
+    std::vector<VkCommandBuffer> commandBuffers(framesInFlight);
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = commandPool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = framesInFlight;
+    VkResult result = vkAllocateCommandBuffers(device->getDevice(), &allocInfo, commandBuffers.data());
+    if (result != VK_SUCCESS)
+    {
+        throw std::runtime_error("Could not allocate command buffers for readbacks!");
+    }
+
+    for (uint32_t i = 0; i < framesInFlight; i++)
+    {
+        frames[i].commandBuffer = commandBuffers[i];
+
+        VkFenceCreateInfo fenceInfo{};
+        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        result = vkCreateFence(device->getDevice(), &fenceInfo, nullptr, &frames[i].fence);
+        if (result != VK_SUCCESS)
+        {
+            throw std::runtime_error("Could not create fence for readbacks!");
+        }
+    }
+}
+
+void ReadbackEngine::createTimeline()
+{
+    VkSemaphoreTypeCreateInfo typeInfo{};
+    typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    typeInfo.initialValue = 0;
+
+    VkSemaphoreCreateInfo createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    createInfo.pNext = &typeInfo;
+
+    VkSemaphore semaphore = VK_NULL_HANDLE;
+    VkResult result = vkCreateSemaphore(device->getDevice(), &createInfo, nullptr, &semaphore);
+    if (result != VK_SUCCESS)
+    {
+        throw std::runtime_error("Could not create timeline semaphore for readbacks!");
+    }
+    timeline = VulkanUtils::shareSemaphore(device->getDevice(), semaphore);
+}
+
+void ReadbackEngine::record(Image& image, Request&& request)
+{
+    const ImageDesc& desc = image.getDesc();
+    if (!(desc.usageFlags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT))
+    {
+        throw std::runtime_error("Readbacks need images with VK_IMAGE_USAGE_TRANSFER_SRC_BIT!");
+    }
+    request.size = VkDeviceSize(desc.width) * desc.height * VulkanUtils::getFormatTexelSize(desc.format);
+
+    std::unique_lock lock(mutex);
+    Frame& frame = beginFrameLocked(lock);
+    request.staging = acquireStagingBuffer(request.size);
+
+    const VkImageLayout oldLayout = image.getLayout();
+    const VkImageLayout finalLayout = oldLayout == VK_IMAGE_LAYOUT_UNDEFINED
+        ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : oldLayout;
+
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    barrier.oldLayout = oldLayout;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image.getImage();
+    barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+    vkCmdPipelineBarrier(frame.commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    VkBufferImageCopy region{};
+    region.bufferOffset = 0;
+    region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+    region.imageOffset = { 0, 0, 0 };
+    region.imageExtent = { desc.width, desc.height, 1 };
+    vkCmdCopyImageToBuffer(frame.commandBuffer, image.getImage(), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        request.staging.buffer, 1, &region);
+
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.newLayout = finalLayout;
+    vkCmdPipelineBarrier(frame.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+        0, 0, nullptr, 0, nullptr, 1, &barrier);
+    image.setLayout(finalLayout);
+    // the frame is submitted with the next ticket
+    image.addPendingTransfer(timeline, lastTicket + 1);
+
+    stats.readbacks++;
+    stats.bytes += request.size;
+    frame.requests.push_back(std::move(request));
+}
+
+ReadbackEngine::Frame& ReadbackEngine::beginFrameLocked(std::unique_lock<std::mutex>& lock)
+{
+    Frame* frame = &frames[currentFrame];
+    while (!frame->recording && frame->inFlight)
+    {
+        // the completion thread frees the frame once its fence signaled
+        condition.wait(lock);
+        frame = &frames[currentFrame];
+    }
+    if (frame->recording)
+    {
+        // another readback already started this frame
+        return *frame;
+    }
+
+    vkResetFences(device->getDevice(), 1, &frame->fence);
+    vkResetCommandBuffer(frame->commandBuffer, 0);
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(frame->commandBuffer, &beginInfo);
+    frame->recording = true;
+    return *frame;
+}
+
+void ReadbackEngine::flushLocked(VkSemaphore waitSemaphore, uint64_t waitValue)
+{
+    Frame& frame = frames[currentFrame];
+    if (!frame.recording)
+    {
+        return;
+    }
+    vkEndCommandBuffer(frame.commandBuffer);
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &frame.commandBuffer;
+
+    const uint64_t ticket = lastTicket + 1;
+    VkTimelineSemaphoreSubmitInfo timelineInfo{};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineInfo.signalSemaphoreValueCount = 1;
+    timelineInfo.pSignalSemaphoreValues = &ticket;
+    submitInfo.pNext = &timelineInfo;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = timeline.get();
+
+    const VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    if (waitSemaphore != VK_NULL_HANDLE)
+    {
+        timelineInfo.waitSemaphoreValueCount = 1;
+        timelineInfo.pWaitSemaphoreValues = &waitValue;
+        submitInfo.waitSemaphoreCount = 1;
+        submitInfo.pWaitSemaphores = &waitSemaphore;
+        submitInfo.pWaitDstStageMask = &waitStage;
+    }
+
+    VkResult result = device->submit(queueType, submitInfo, frame.fence);
+    if (result != VK_SUCCESS)
+    {
+        throw std::runtime_error("Could not submit readbacks!");
+    }
+
+    lastTicket = ticket;
+    frame.recording = false;
+    frame.inFlight = true;
+    inFlight.push_back(currentFrame);
+    currentFrame = (currentFrame + 1) % frames.size();
+    stats.submissions++;
+    condition.notify_all();
+}
+
+ReadbackEngine::StagingBuffer ReadbackEngine::acquireStagingBuffer(VkDeviceSize size)
+{
+    const VkDeviceSize stagingSize = (size + STAGING_GRANULARITY - 1) / STAGING_GRANULARITY * STAGING_GRANULARITY;
+
+    // reuse the smallest free buffer that fits, as long as it is not wastefully large
+    auto it = freeStagingBuffers.lower_bound(stagingSize);
+    if (it != freeStagingBuffers.end() && it->first <= 2 * stagingSize)
+    {
+        StagingBuffer staging = it->second;
+        freeStagingBuffers.erase(it);
+        return staging;
+    }
+
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = stagingSize;
+    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    VmaAllocationCreateInfo allocInfo{};
+    allocInfo.usage = VMA_MEMORY_USAGE_AUTO;
+    allocInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT
+        | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+    // reading uncached memory is very slow
+    allocInfo.preferredFlags = VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+
+    StagingBuffer staging;
+    VmaAllocationInfo allocationInfo;
+    VkResult result = vmaCreateBuffer(device->getAllocator(), &bufferInfo, &allocInfo,
+        &staging.buffer, &staging.allocation, &allocationInfo);
+    if (result != VK_SUCCESS)
+    {
+        throw std::runtime_error("VMA could not create a readback staging buffer!");
+    }
+    vmaSetAllocationName(device->getAllocator(), staging.allocation, "Readback Staging Buffer");
+    staging.data = static_cast<const std::byte*>(allocationInfo.pMappedData);
+    staging.size = stagingSize;
+
+    stats.stagingBufferCount++;
+    stats.stagingBytes += stagingSize;
+    return staging;
+}
+
+void ReadbackEngine::releaseStagingBuffer(const StagingBuffer& staging)
+{
+    freeStagingBuffers.emplace(staging.size, staging);
+}
+
+void ReadbackEngine::destroyStagingBuffer(const StagingBuffer& staging)
+{
+    vmaDestroyBuffer(device->getAllocator(), staging.buffer, staging.allocation);
+}
+
+void ReadbackEngine::complete(Request& request)
+{
+    vmaInvalidateAllocation(device->getAllocator(), request.staging.allocation, 0, request.size);
+
+    std::span<const std::byte> data(request.staging.data, request.size);
+    if (request.callback)
+    {
+        try
+        {
+            request.callback(data);
+        }
+        catch (...)
+        {
+            // there is nobody to hand the exception to on the completion thread
+        }
+    }
+    else
+    {
+        request.promise.set_value(std::vector<std::byte>(data.begin(), data.end()));
+    }
+}
+
+void ReadbackEngine::completionLoop()
+{
+    std::unique_lock lock(mutex);
+    while (true)
+    {
+        condition.wait(lock, [this] { return stopping || !inFlight.empty(); });
+        if (inFlight.empty())
+        {
+            // stopping, and everything has been delivered
+            return;
+        }
+
+        const size_t frameIndex = inFlight.front();
+        const VkFence fence = frames[frameIndex].fence;
+
+        lock.unlock();
+        VkResult result = vkWaitForFences(device->getDevice(), 1, &fence, VK_TRUE, UINT64_MAX);
+        lock.lock();
+
+        Frame& frame = frames[frameIndex];
+        std::vector<Request> requests = std::move(frame.requests);
+        frame.requests.clear();
+
+        lock.unlock();
+        for (Request& request : requests)
+        {
+            if (result == VK_SUCCESS)
+            {
+                complete(request);
+            }
+            else if (!request.callback)
+            {
+                request.promise.set_exception(std::make_exception_ptr(
+                    std::runtime_error("Waiting for the readback failed!")));
+            }
+        }
+        lock.lock();
+
+        for (const Request& request : requests)
+        {
+            releaseStagingBuffer(request.staging);
+        }
+        // only now the frame may be recorded again, its staging buffers are back in the pool
+        frame.inFlight = false;
+        inFlight.pop_front();
+        condition.notify_all();
+    }
+}
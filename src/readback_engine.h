@@ -0,0 +1,145 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+
+#include <volk.h>
+#include <vk_mem_alloc.h>
+
+#include "vulkan_utils.h"
+
+class Device;
+class Image;
+
+/**
+ * Gets image content back to the CPU without stalling the queue. Copies are recorded into
+ * the command buffer of the current frame and land in pooled HOST_CACHED staging buffers.
+ * flush() submits the frame with a fence; up to framesInFlight frames are on the GPU at once,
+ * while a completion thread waits for the fences and hands the data to the requester.
+ *
+ * Readbacks run on the transfer queue by default. If the images are written on another
+ * queue, pass the semaphore signaled by that work to flush().
+ *
+ * Images have to stay alive until their frame has been submitted. Thread safe
+ */
+class ReadbackEngine
+{
+public:
+    using Callback = std::function<void(std::span<const std::byte> data)>;
+
+    struct Stats
+    {
+        uint64_t readbacks = 0;
+        uint64_t submissions = 0;
+        uint64_t bytes = 0;
+        uint32_t stagingBufferCount = 0;
+        VkDeviceSize stagingBytes = 0;
+    };
+
+    ReadbackEngine(Device* device, uint32_t framesInFlight = 2,
+        QueueType queueType = QueueType::Transfer);
+    ~ReadbackEngine();
+
+    ReadbackEngine(const ReadbackEngine&) = delete;
+    ReadbackEngine& operator=(const ReadbackEngine&) = delete;
+
+    /**
+     * Records a copy of the whole image, tightly packed in the image's format.
+     * The image needs VK_IMAGE_USAGE_TRANSFER_SRC_BIT and is returned to its layout afterwards
+     * (VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL if it was undefined).
+     * The data becomes available after the next flush() has completed on the GPU
+     */
+    std::future<std::vector<std::byte>> readback(Image& image);
+    /**
+     * Same as above, but calls the callback from the completion thread instead.
+     * The data is only valid during the call
+     */
+    void readback(Image& image, Callback callback);
+
+    /**
+     * Submits all readbacks recorded in the current frame. Blocks if the next frame
+     * is still in flight
+     * @param waitSemaphore optional timeline semaphore the copies wait for, together with its value
+     */
+    void flush(VkSemaphore waitSemaphore = VK_NULL_HANDLE, uint64_t waitValue = 0);
+    /**
+     * Flushes and waits until every readback has been delivered
+     */
+    void waitIdle();
+
+    Stats getStats() const;
+
+private:
+    struct StagingBuffer
+    {
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VmaAllocation allocation = VK_NULL_HANDLE;
+        const std::byte* data = nullptr;
+        VkDeviceSize size = 0;
+    };
+    struct Request
+    {
+        StagingBuffer staging;
+        VkDeviceSize size = 0;
+        /** either the promise or the callback is used */
+        std::promise<std::vector<std::byte>> promise;
+        Callback callback;
+    };
+    struct Frame
+    {
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        VkFence fence = VK_NULL_HANDLE;
+        std::vector<Request> requests;
+        bool recording = false;
+        bool inFlight = false;
+    };
+
+    void createCommandPool();
+    void createFrames(uint32_t framesInFlight);
+    void createTimeline();
+
+    void record(Image& image, Request&& request);
+    /** waits until the current frame is free and begins its command buffer */
+    Frame& beginFrameLocked(std::unique_lock<std::mutex>& lock);
+    void flushLocked(VkSemaphore waitSemaphore = VK_NULL_HANDLE, uint64_t waitValue = 0);
+
+    StagingBuffer acquireStagingBuffer(VkDeviceSize size);
+    void releaseStagingBuffer(const StagingBuffer& staging);
+    void destroyStagingBuffer(const StagingBuffer& staging);
+
+    void complete(Request& request);
+    void completionLoop();
+
+private:
+    Device* device = nullptr;
+    QueueType queueType = QueueType::Transfer;
+
+    VkCommandPool commandPool = VK_NULL_HANDLE;
+    std::vector<Frame> frames;
+    size_t currentFrame = 0;
+    /** indices of submitted frames in submission order */
+    std::deque<size_t> inFlight;
+    /** signaled with the number of submitted frames, shared with the read images, see Image::addPendingTransfer */
+    std::shared_ptr<const VkSemaphore> timeline;
+    uint64_t lastTicket = 0;
+
+    /** free staging buffers by size */
+    std::multimap<VkDeviceSize, StagingBuffer> freeStagingBuffers;
+
+    Stats stats;
+
+    mutable std::mutex mutex;
+    std::condition_variable condition;
+    bool stopping = false;
+    std::thread completionThread;
+};
@@ -0,0 +1,68 @@
+#include "retirement_queue.h"
+
+#include <vector>
+
+RetirementQueue::~RetirementQueue()
+{
+    flush();
+}
+
+void RetirementQueue::retire(uint64_t retireValue, std::function<void()> deleter, std::function<bool()> isIdle)
+{
+    std::lock_guard lock(mutex);
+    pending.emplace(retireValue, Entry{ std::move(deleter), std::move(isIdle) });
+}
+
+size_t RetirementQueue::collect(uint64_t completedValue)
+{
+    return collect(completedValue, false);
+}
+
+size_t RetirementQueue::flush()
+{
+    return collect(UINT64_MAX, true);
+}
+
+size_t RetirementQueue::collect(uint64_t completedValue, bool force)
+{
+    std::vector<std::pair<uint64_t, Entry>> due;
+    {
+        std::lock_guard lock(mutex);
+        auto end = pending.upper_bound(completedValue);
+        for (auto it = pending.begin(); it != end; ++it)
+        {
+            due.emplace_back(it->first, std::move(it->second));
+        }
+        pending.erase(pending.begin(), end);
+    }
+
+    // deleters may take locks of their own (e.g. for releasing an export), so run them unlocked
+    size_t ran = 0;
+    std::vector<std::pair<uint64_t, Entry>> notIdle;
+    for (auto& [value, entry] : due)
+    {
+        if (!force && entry.isIdle && !entry.isIdle())
+        {
+            notIdle.emplace_back(value, std::move(entry));
+            continue;
+        }
+        entry.deleter();
+        ran++;
+    }
+
+    if (!notIdle.empty())
+    {
+        std::lock_guard lock(mutex);
+        for (auto& [value, entry] : notIdle)
+        {
+            pending.emplace(value, std::move(entry));
+        }
+    }
+    return ran;
+}
+
+size_t RetirementQueue::getPendingCount() const
+{
+    std::lock_guard lock(mutex);
+    return pending.size();
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+
+/**
+ * Collects the destruction of resources that may still be in use by the GPU or an importer.
+ * Every deleter is tagged with a value (a frame index or timeline semaphore value) and runs
+ * once that value is known to be completed and its optional idle check passes, e.g. once an
+ * importer signaled that it is done. Thread safe, deleters and idle checks run outside of the lock
+ */
+class RetirementQueue
+{
+public:
+    RetirementQueue() = default;
+    ~RetirementQueue();
+
+    RetirementQueue(const RetirementQueue&) = delete;
+    RetirementQueue& operator=(const RetirementQueue&) = delete;
+
+    /**
+     * Queues the deleter until a value of at least retireValue has been completed
+     * @param isIdle checked once the value has been completed, the deleter waits while it returns false
+     */
+    void retire(uint64_t retireValue, std::function<void()> deleter, std::function<bool()> isIdle = {});
+
+    /**
+     * Runs every deleter whose value is <= completedValue and that is idle
+     * @returns the number of deleters that ran
+     */
+    size_t collect(uint64_t completedValue);
+    /**
+     * Runs every deleter regardless of its value and idle check.
+     * Only call when the device is idle and nobody else uses the resources anymore
+     * @returns the number of deleters that ran
+     */
+    size_t flush();
+
+    size_t getPendingCount() const;
+
+private:
+    struct Entry
+    {
+        std::function<void()> deleter;
+        std::function<bool()> isIdle;
+    };
+
+    size_t collect(uint64_t completedValue, bool force);
+
+private:
+    std::multimap<uint64_t, Entry> pending;
+    mutable std::mutex mutex;
+};
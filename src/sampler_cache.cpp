@@ -0,0 +1,122 @@
+#include "sampler_cache.h"
+
+#include <algorithm>
+#include <cassert>
+#include <functional>
+#include <stdexcept>
+#include <tuple>
+
+namespace
+{
+auto asTuple(const VkSamplerCreateInfo& info)
+{
+    return std::tie(info.flags, info.magFilter, info.minFilter, info.mipmapMode,
+        info.addressModeU, info.addressModeV, info.addressModeW, info.mipLodBias,
+        info.anisotropyEnable, info.maxAnisotropy, info.compareEnable, info.compareOp,
+        info.minLod, info.maxLod, info.borderColor, info.unnormalizedCoordinates);
+}
+
+template<typename T>
+void hashCombine(size_t& seed, const T& value)
+{
+    seed ^= std::hash<T>{}(value) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+}
+}
+
+VkSamplerCreateInfo SamplerDesc::toCreateInfo() const
+{
+    VkSamplerCreateInfo createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    createInfo.magFilter = filter;
+    createInfo.minFilter = filter;
+    createInfo.addressModeU = addressMode;
+    createInfo.addressModeV = addressMode;
+    createInfo.addressModeW = addressMode;
+    createInfo.anisotropyEnable = maxAnisotropy > 1.f ? VK_TRUE : VK_FALSE;
+    createInfo.maxAnisotropy = std::max(maxAnisotropy, 1.f);
+
+    createInfo.borderColor = borderColor;
+    createInfo.unnormalizedCoordinates = VK_FALSE;
+    createInfo.compareEnable = VK_FALSE;
+    createInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+    createInfo.mipmapMode = mipmapMode;
+    createInfo.mipLodBias = 0.f;
+    createInfo.minLod = 0.f;
+    createInfo.maxLod = 0.f;
+    return createInfo;
+}
+
+size_t SamplerCache::CreateInfoHash::operator()(const VkSamplerCreateInfo& info) const
+{
+    size_t seed = 0;
+    std::apply([&seed](const auto&... fields) { (hashCombine(seed, fields), ...); }, asTuple(info));
+    return seed;
+}
+
+bool SamplerCache::CreateInfoEqual::operator()(const VkSamplerCreateInfo& a, const VkSamplerCreateInfo& b) const
+{
+    return asTuple(a) == asTuple(b);
+}
+
+SamplerCache::SamplerCache(VkDevice device, float maxAnisotropy)
+    : device(device), maxAnisotropy(maxAnisotropy)
+{
+}
+
+SamplerCache::~SamplerCache()
+{
+    for (const auto& [createInfo, entry] : samplers)
+    {
+        vkDestroySampler(device, entry.sampler, nullptr);
+    }
+}
+
+VkSampler SamplerCache::acquire(const VkSamplerCreateInfo& requested)
+{
+    assert(requested.pNext == nullptr && "The sampler cache does not support extension structs!");
+
+    VkSamplerCreateInfo createInfo = requested;
+    createInfo.maxAnisotropy = std::min(createInfo.maxAnisotropy, maxAnisotropy);
+
+    std::lock_guard lock(mutex);
+
+    Entry& entry = samplers[createInfo];
+    if (entry.refCount == 0)
+    {
+        VkResult result = vkCreateSampler(device, &createInfo, nullptr, &entry.sampler);
+        if (result != VK_SUCCESS)
+        {
+            samplers.erase(createInfo);
+            throw std::runtime_error("Could not create Sampler!");
+        }
+        createInfos.emplace(entry.sampler, createInfo);
+    }
+    entry.refCount++;
+    return entry.sampler;
+}
+
+void SamplerCache::release(VkSampler sampler)
+{
+    std::lock_guard lock(mutex);
+    auto infoIt = createInfos.find(sampler);
+    assert(infoIt != createInfos.end() && "Releasing a sampler that is not owned by the cache!");
+    if (infoIt == createInfos.end())
+    {
+        return;
+    }
+
+    auto it = samplers.find(infoIt->second);
+    it->second.refCount--;
+    if (it->second.refCount == 0)
+    {
+        vkDestroySampler(device, sampler, nullptr);
+        samplers.erase(it);
+        createInfos.erase(infoIt);
+    }
+}
+
+size_t SamplerCache::getSamplerCount() const
+{
+    std::lock_guard lock(mutex);
+    return samplers.size();
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <compare>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+
+#include <volk.h>
+
+/**
+ * The sampler settings an image can choose from. Everything else of
+ * the VkSamplerCreateInfo is fixed
+ */
+struct SamplerDesc
+{
+    VkFilter filter = VK_FILTER_LINEAR;
+    VkSamplerMipmapMode mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    VkSamplerAddressMode addressMode = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    /** values <= 1 disable anisotropic filtering */
+    float maxAnisotropy = 1.f;
+    VkBorderColor borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_BLACK;
+
+    VkSamplerCreateInfo toCreateInfo() const;
+
+    auto operator<=>(const SamplerDesc&) const = default;
+};
+
+/**
+ * Hands out shared, reference counted samplers. Identical create infos
+ * result in the same VkSampler, which keeps the number of live samplers far
+ * below maxSamplerAllocationCount. Extension structs in pNext are not supported.
+ * Thread safe
+ */
+class SamplerCache
+{
+public:
+    /**
+     * @param maxAnisotropy the device limit, requested anisotropy is clamped to it
+     */
+    SamplerCache(VkDevice device, float maxAnisotropy);
+    ~SamplerCache();
+
+    SamplerCache(const SamplerCache&) = delete;
+    SamplerCache& operator=(const SamplerCache&) = delete;
+
+    /**
+     * @returns a sampler for the create info, every call needs a matching release
+     */
+    VkSampler acquire(const VkSamplerCreateInfo& createInfo);
+    void release(VkSampler sampler);
+
+    /**
+     * @returns the number of distinct samplers currently alive
+     */
+    size_t getSamplerCount() const;
+
+private:
+    struct CreateInfoHash
+    {
+        size_t operator()(const VkSamplerCreateInfo& info) const;
+    };
+    struct CreateInfoEqual
+    {
+        bool operator()(const VkSamplerCreateInfo& a, const VkSamplerCreateInfo& b) const;
+    };
+
+    struct Entry
+    {
+        VkSampler sampler = VK_NULL_HANDLE;
+        uint32_t refCount = 0;
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    float maxAnisotropy = 1.f;
+
+    std::unordered_map<VkSamplerCreateInfo, Entry, CreateInfoHash, CreateInfoEqual> samplers;
+    /** reverse lookup for release */
+    std::unordered_map<VkSampler, VkSamplerCreateInfo> createInfos;
+    mutable std::mutex mutex;
+};
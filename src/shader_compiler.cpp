@@ -0,0 +1,215 @@
+#include "shader_compiler.h"
+
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+
+namespace
+{
+/**
+ * Resolves #include "..." next to the including file first, then in the include
+ * directories. #include <...> only looks in the include directories
+ */
+class FileIncluder : public shaderc::CompileOptions::IncluderInterface
+{
+public:
+    FileIncluder(const std::vector<std::filesystem::path>& includeDirectories)
+        : includeDirectories(includeDirectories)
+    {
+    }
+
+    shaderc_include_result* GetInclude(const char* requestedSource, shaderc_include_type type,
+        const char* requestingSource, size_t /*includeDepth*/) override
+    {
+        auto include = std::make_unique<Include>();
+
+        std::vector<std::filesystem::path> candidates;
+        if (type == shaderc_include_type_relative)
+        {
+            candidates.push_back(std::filesystem::path(requestingSource).parent_path() / requestedSource);
+        }
+        for (const std::filesystem::path& directory : includeDirectories)
+        {
+            candidates.push_back(directory / requestedSource);
+        }
+
+        for (const std::filesystem::path& candidate : candidates)
+        {
+            std::ifstream file(candidate, std::ios::binary);
+            if (file)
+            {
+                std::ostringstream content;
+                content << file.rdbuf();
+                include->name = candidate.string();
+                include->content = content.str();
+                break;
+            }
+        }
+        if (include->name.empty())
+        {
+            // an empty name tells shaderc that the content is the error message
+            include->content = std::string("could not find include ") + requestedSource;
+        }
+
+        include->result.source_name = include->name.c_str();
+        include->result.source_name_length = include->name.size();
+        include->result.content = include->content.c_str();
+        include->result.content_length = include->content.size();
+        include->result.user_data = include.get();
+        return &include.release()->result;
+    }
+
+    void ReleaseInclude(shaderc_include_result* result) override
+    {
+        delete static_cast<Include*>(result->user_data);
+    }
+
+private:
+    struct Include
+    {
+        shaderc_include_result result{};
+        std::string name;
+        std::string content;
+    };
+
+    std::vector<std::filesystem::path> includeDirectories;
+};
+}
+
+ShaderCompiler::ShaderCompiler(std::filesystem::path cacheDirectory,
+    std::vector<std::filesystem::path> includeDirectories, uint32_t threadCount)
+    : spirvCache(std::move(cacheDirectory)), includeDirectories(std::move(includeDirectories))
+{
+    if (threadCount == 0)
+    {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (uint32_t i = 0; i < threadCount; i++)
+    {
+        workers.emplace_back(&ShaderCompiler::workerLoop, this);
+    }
+}
+
+ShaderCompiler::~ShaderCompiler()
+{
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    condition.notify_all();
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+}
+
+std::shared_future<ShaderCompiler::Spirv> ShaderCompiler::compile(const ShaderCompileRequest& request)
+{
+    const uint64_t key = hashRequest(request);
+
+    std::lock_guard lock(mutex);
+    auto it = requests.find(key);
+    if (it != requests.end())
+    {
+        return it->second;
+    }
+
+    auto task = std::make_shared<std::packaged_task<Spirv()>>([this, request] { return run(request); });
+    std::shared_future<Spirv> future = task->get_future().share();
+    requests.emplace(key, future);
+    jobs.push_back([task] { (*task)(); });
+    condition.notify_one();
+    return future;
+}
+
+std::vector<std::shared_future<ShaderCompiler::Spirv>> ShaderCompiler::compilePermutations(
+    const ShaderCompileRequest& request, const std::vector<std::map<std::string, std::string>>& permutations)
+{
+    std::vector<std::shared_future<Spirv>> futures;
+    futures.reserve(permutations.size());
+    for (const std::map<std::string, std::string>& defines : permutations)
+    {
+        ShaderCompileRequest permutation = request;
+        for (const auto& [name, value] : defines)
+        {
+            permutation.defines[name] = value;
+        }
+        futures.push_back(compile(permutation));
+    }
+    return futures;
+}
+
+size_t ShaderCompiler::getRequestCount() const
+{
+    std::lock_guard lock(mutex);
+    return requests.size();
+}
+
+SpirvCache::Stats ShaderCompiler::getCacheStats() const
+{
+    return spirvCache.getStats();
+}
+
+uint64_t ShaderCompiler::hashRequest(const ShaderCompileRequest& request)
+{
+    // relative includes are resolved next to the name, so the same source under another name
+    // may include other files. The defines are sorted, so the same set always gives the same key
+    std::string key = request.name + '\0' + request.source;
+    for (const auto& [name, value] : request.defines)
+    {
+        key += '\0' + name + '=' + value;
+    }
+    return SpirvCache::hashSource(key, request.kind, request.entryPoint);
+}
+
+ShaderCompiler::Spirv ShaderCompiler::run(const ShaderCompileRequest& request)
+{
+    shaderc::CompileOptions options;
+    for (const auto& [name, value] : request.defines)
+    {
+        if (value.empty())
+        {
+            options.AddMacroDefinition(name);
+        }
+        else
+        {
+            options.AddMacroDefinition(name, value);
+        }
+    }
+    options.SetIncluder(std::make_unique<FileIncluder>(includeDirectories));
+
+    // resolve includes and macros first, so changed includes change the cache key as well
+    shaderc::Compiler compiler;
+    shaderc::PreprocessedSourceCompilationResult preprocessed = compiler.PreprocessGlsl(
+        request.source, request.kind, request.name.c_str(), options);
+    if (preprocessed.GetCompilationStatus() != shaderc_compilation_status_success)
+    {
+        throw std::runtime_error("Could not preprocess shader " + request.name + ": "
+            + preprocessed.GetErrorMessage());
+    }
+
+    return spirvCache.getOrCompile(request.name, std::string(preprocessed.cbegin(), preprocessed.cend()),
+        request.kind, request.entryPoint);
+}
+
+void ShaderCompiler::workerLoop()
+{
+    std::unique_lock lock(mutex);
+    while (true)
+    {
+        condition.wait(lock, [this] { return stopping || !jobs.empty(); });
+        if (jobs.empty())
+        {
+            // stopping, and every queued compilation is done
+            return;
+        }
+        std::function<void()> job = std::move(jobs.front());
+        jobs.pop_front();
+
+        lock.unlock();
+        job();
+        lock.lock();
+    }
+}
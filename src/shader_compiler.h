@@ -0,0 +1,93 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <shaderc/shaderc.hpp>
+
+#include "spirv_cache.h"
+
+struct ShaderCompileRequest
+{
+    /** shows up in compiler errors, relative includes are resolved next to it */
+    std::string name;
+    std::string source;
+    shaderc_shader_kind kind = shaderc_glsl_compute_shader;
+    std::string entryPoint = "main";
+    /** macro definitions, an empty value defines the macro without a value */
+    std::map<std::string, std::string> defines;
+};
+
+/**
+ * Compiles GLSL to SPIR-V on a pool of worker threads, so compilation can overlap with
+ * other startup work such as creating the Device. Needs no device, #includes are resolved
+ * next to the including file and in the include directories. Identical requests are only
+ * compiled once and share their future. Results go through a SpirvCache, so warm starts
+ * only preprocess. Thread safe
+ */
+class ShaderCompiler
+{
+public:
+    using Spirv = std::vector<uint32_t>;
+
+    /**
+     * @param cacheDirectory where the SPIR-V cache lives. Use
+     * ComputePipelines::getDefaultCacheDirectory() / "spirv" to share it with the compute pipelines
+     * @param threadCount number of worker threads, 0 uses all hardware threads
+     */
+    ShaderCompiler(std::filesystem::path cacheDirectory,
+        std::vector<std::filesystem::path> includeDirectories = {}, uint32_t threadCount = 0);
+    /**
+     * Finishes all queued compilations
+     */
+    ~ShaderCompiler();
+
+    ShaderCompiler(const ShaderCompiler&) = delete;
+    ShaderCompiler& operator=(const ShaderCompiler&) = delete;
+
+    /**
+     * Queues the compilation. The future throws if the shader does not compile
+     */
+    std::shared_future<Spirv> compile(const ShaderCompileRequest& request);
+    /**
+     * Queues one compilation per set of defines, each added to the defines of the request
+     * @returns the futures in the order of the permutations
+     */
+    std::vector<std::shared_future<Spirv>> compilePermutations(const ShaderCompileRequest& request,
+        const std::vector<std::map<std::string, std::string>>& permutations);
+
+    /**
+     * @returns the number of distinct compilations that have been queued
+     */
+    size_t getRequestCount() const;
+    SpirvCache::Stats getCacheStats() const;
+
+    static uint64_t hashRequest(const ShaderCompileRequest& request);
+
+private:
+    Spirv run(const ShaderCompileRequest& request);
+    void workerLoop();
+
+private:
+    SpirvCache spirvCache;
+    std::vector<std::filesystem::path> includeDirectories;
+
+    /** every request ever made, finished or not */
+    std::map<uint64_t, std::shared_future<Spirv>> requests;
+
+    std::deque<std::function<void()>> jobs;
+    std::vector<std::thread> workers;
+    bool stopping = false;
+
+    mutable std::mutex mutex;
+    std::condition_variable condition;
+};
@@ -0,0 +1,150 @@
+#include "spirv_cache.h"
+
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+namespace
+{
+/** bump whenever the compile options change, so old binaries are not picked up anymore */
+constexpr uint64_t SPIRV_CACHE_VERSION = 1;
+constexpr uint32_t SPIRV_MAGIC = 0x07230203;
+
+uint64_t fnv1a(uint64_t hash, const void* data, size_t size)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+}
+
+SpirvCache::SpirvCache(std::filesystem::path directory)
+    : directory(std::move(directory))
+{
+    std::error_code error;
+    std::filesystem::create_directories(this->directory, error);
+    isDiskCacheAvailable = !error;
+    if (!isDiskCacheAvailable)
+    {
+        std::cout << "Could not create shader cache directory " << this->directory.string()
+            << ", shaders are compiled on every start" << std::endl;
+    }
+}
+
+std::vector<uint32_t> SpirvCache::getOrCompile(const std::string& name, const std::string& source,
+    shaderc_shader_kind kind, const std::string& entryPoint)
+{
+    const std::filesystem::path path = getPath(hashSource(source, kind, entryPoint));
+    if (isDiskCacheAvailable)
+    {
+        std::vector<uint32_t> spirv = load(path);
+        if (!spirv.empty())
+        {
+            hits++;
+            return spirv;
+        }
+    }
+
+    misses++;
+    std::vector<uint32_t> spirv = compile(name, source, kind, entryPoint);
+    if (isDiskCacheAvailable)
+    {
+        store(path, spirv);
+    }
+    return spirv;
+}
+
+SpirvCache::Stats SpirvCache::getStats() const
+{
+    return { hits, misses };
+}
+
+uint64_t SpirvCache::hashSource(const std::string& source, shaderc_shader_kind kind,
+    const std::string& entryPoint)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    hash = fnv1a(hash, &SPIRV_CACHE_VERSION, sizeof(SPIRV_CACHE_VERSION));
+    hash = fnv1a(hash, &kind, sizeof(kind));
+    // include the length, so that source and entry point can not be shifted into each other
+    const uint64_t sourceSize = source.size();
+    hash = fnv1a(hash, &sourceSize, sizeof(sourceSize));
+    hash = fnv1a(hash, source.data(), source.size());
+    hash = fnv1a(hash, entryPoint.data(), entryPoint.size());
+    return hash;
+}
+
+std::filesystem::path SpirvCache::getPath(uint64_t key) const
+{
+    std::ostringstream fileName;
+    fileName << std::hex << key << ".spv";
+    return directory / fileName.str();
+}
+
+std::vector<uint32_t> SpirvCache::load(const std::filesystem::path& path) const
+{
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file)
+    {
+        return {};
+    }
+    const std::streamsize size = file.tellg();
+    if (size <= 0 || size % sizeof(uint32_t) != 0)
+    {
+        return {};
+    }
+
+    std::vector<uint32_t> spirv(size / sizeof(uint32_t));
+    file.seekg(0);
+    if (!file.read(reinterpret_cast<char*>(spirv.data()), size) || spirv[0] != SPIRV_MAGIC)
+    {
+        // truncated or garbage, compile again and overwrite it
+        return {};
+    }
+    return spirv;
+}
+
+void SpirvCache::store(const std::filesystem::path& path, const std::vector<uint32_t>& spirv) const
+{
+    // write to a file of our own and move it in place, readers never see half written files
+    std::filesystem::path tempPath = path;
+    tempPath += "." + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id())) + ".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(spirv.data()), spirv.size() * sizeof(uint32_t));
+        if (!file)
+        {
+            return;
+        }
+    }
+    std::error_code error;
+    std::filesystem::rename(tempPath, path, error);
+    if (error)
+    {
+        std::filesystem::remove(tempPath, error);
+    }
+}
+
+std::vector<uint32_t> SpirvCache::compile(const std::string& name, const std::string& source,
+    shaderc_shader_kind kind, const std::string& entryPoint)
+{
+    shaderc::CompileOptions options;
+    options.SetTargetEnvironment(shaderc_target_env_vulkan, shaderc_env_version_vulkan_1_3);
+    options.SetOptimizationLevel(shaderc_optimization_level_performance);
+
+    // a compiler per compilation, so compilations can run on several threads
+    shaderc::Compiler compiler;
+    shaderc::SpvCompilationResult result = compiler.CompileGlslToSpv(source, kind, name.c_str(),
+        entryPoint.c_str(), options);
+    if (result.GetCompilationStatus() != shaderc_compilation_status_success)
+    {
+        throw std::runtime_error("Could not compile shader " + name + ": " + result.GetErrorMessage());
+    }
+    return std::vector<uint32_t>(result.cbegin(), result.cend());
+}
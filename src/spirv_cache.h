@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include <shaderc/shaderc.hpp>
+
+/**
+ * Compiles GLSL to SPIR-V with shaderc and keeps the results on disk, keyed by a hash
+ * of everything that influences the compilation. A warm cache skips shaderc entirely.
+ * Thread safe, concurrent writers of the same entry are harmless since files are
+ * replaced atomically
+ */
+class SpirvCache
+{
+public:
+    struct Stats
+    {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+    };
+
+    /**
+     * @param directory where the .spv files go. If it can not be created,
+     * every request compiles
+     */
+    SpirvCache(std::filesystem::path directory);
+
+    /**
+     * @param name shows up in compiler errors
+     * @returns the SPIR-V of the source, loaded from disk if it has been compiled before.
+     * Throws on compilation errors
+     */
+    std::vector<uint32_t> getOrCompile(const std::string& name, const std::string& source,
+        shaderc_shader_kind kind, const std::string& entryPoint = "main");
+
+    Stats getStats() const;
+
+    /**
+     * @returns the cache key of a compilation
+     */
+    static uint64_t hashSource(const std::string& source, shaderc_shader_kind kind,
+        const std::string& entryPoint);
+
+private:
+    std::filesystem::path getPath(uint64_t key) const;
+    /** @returns an empty vector if there is no valid cache entry */
+    std::vector<uint32_t> load(const std::filesystem::path& path) const;
+    void store(const std::filesystem::path& path, const std::vector<uint32_t>& spirv) const;
+
+    static std::vector<uint32_t> compile(const std::string& name, const std::string& source,
+        shaderc_shader_kind kind, const std::string& entryPoint);
+
+private:
+    std::filesystem::path directory;
+    bool isDiskCacheAvailable = false;
+
+    std::atomic<uint64_t> hits = 0;
+    std::atomic<uint64_t> misses = 0;
+};
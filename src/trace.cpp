@@ -0,0 +1,192 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace Trace
+{
+namespace
+{
+struct Event
+{
+    const char* name = nullptr;
+    int64_t startNs = 0;
+    int64_t durationNs = 0;
+};
+
+struct ThreadBuffer
+{
+    static constexpr size_t CAPACITY = 16384;
+
+    uint32_t threadIndex = 0;
+    std::array<Event, CAPACITY> events;
+    /** number of events ever recorded, the ring position is count % CAPACITY */
+    std::atomic<uint64_t> count = 0;
+    /** set once the thread ended, the buffer is dropped after it was written. Guarded by the registry mutex */
+    bool exited = false;
+};
+
+/** buffers of ended threads that are kept until the next write, the oldest ones are dropped beyond that */
+constexpr size_t MAX_EXITED_BUFFERS = 64;
+
+/** owns the buffers, so their events survive the end of their threads */
+struct Registry
+{
+    std::mutex mutex;
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+    uint32_t nextThreadIndex = 0;
+    /** GPU regions come in from whichever thread resolves them, so they share one buffer */
+    std::shared_ptr<ThreadBuffer> gpuBuffer;
+    std::mutex gpuMutex;
+};
+
+/** the tid of the GPU track, far away from the thread indices */
+constexpr uint32_t GPU_TRACK = 1000000;
+
+Registry& getRegistry()
+{
+    static Registry registry;
+    return registry;
+}
+
+/**
+ * Drops the buffers of ended threads but the newest keep ones, registry mutex has to be locked
+ */
+void dropExitedBuffers(Registry& registry, size_t keep)
+{
+    size_t exited = static_cast<size_t>(std::count_if(registry.buffers.begin(), registry.buffers.end(),
+        [](const std::shared_ptr<ThreadBuffer>& buffer) { return buffer->exited; }));
+    // buffers are in creation order, so the oldest ones go first
+    std::erase_if(registry.buffers, [&](const std::shared_ptr<ThreadBuffer>& buffer)
+    {
+        if (!buffer->exited || exited <= keep)
+        {
+            return false;
+        }
+        exited--;
+        return true;
+    });
+}
+
+/** the thread's handle to its buffer, marks it as exited when the thread ends */
+struct ThreadBufferOwner
+{
+    std::shared_ptr<ThreadBuffer> buffer;
+
+    ThreadBufferOwner()
+        : buffer(std::make_shared<ThreadBuffer>())
+    {
+        Registry& registry = getRegistry();
+        std::lock_guard lock(registry.mutex);
+        buffer->threadIndex = registry.nextThreadIndex++;
+        registry.buffers.push_back(buffer);
+    }
+    ~ThreadBufferOwner()
+    {
+        Registry& registry = getRegistry();
+        std::lock_guard lock(registry.mutex);
+        buffer->exited = true;
+        dropExitedBuffers(registry, MAX_EXITED_BUFFERS);
+    }
+
+    ThreadBufferOwner(const ThreadBufferOwner&) = delete;
+    ThreadBufferOwner& operator=(const ThreadBufferOwner&) = delete;
+};
+
+ThreadBuffer& getThreadBuffer()
+{
+    thread_local ThreadBufferOwner owner;
+    return *owner.buffer;
+}
+
+void recordInto(ThreadBuffer& buffer, const char* name, std::chrono::steady_clock::time_point start,
+    std::chrono::steady_clock::time_point end)
+{
+    // only this thread writes the buffer, the atomic just publishes the event to writeChromeTrace
+    const uint64_t index = buffer.count.load(std::memory_order_relaxed);
+    Event& event = buffer.events[index % ThreadBuffer::CAPACITY];
+    event.name = name;
+    event.startNs = std::chrono::duration_cast<std::chrono::nanoseconds>(start.time_since_epoch()).count();
+    event.durationNs = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    buffer.count.store(index + 1, std::memory_order_release);
+}
+}
+
+void record(const char* name, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end)
+{
+    recordInto(getThreadBuffer(), name, start, end);
+}
+
+void recordGpu(const char* name, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end)
+{
+    Registry& registry = getRegistry();
+    std::lock_guard lock(registry.gpuMutex);
+    if (!registry.gpuBuffer)
+    {
+        auto buffer = std::make_shared<ThreadBuffer>();
+        buffer->threadIndex = GPU_TRACK;
+        std::lock_guard registryLock(registry.mutex);
+        registry.buffers.push_back(buffer);
+        registry.gpuBuffer = buffer;
+    }
+    recordInto(*registry.gpuBuffer, name, start, end);
+}
+
+bool writeChromeTrace(const std::filesystem::path& file)
+{
+    if (!isEnabled())
+    {
+        return false;
+    }
+
+    std::ofstream out(file, std::ios::trunc);
+    out << "{\"traceEvents\": [";
+    bool first = true;
+
+    Registry& registry = getRegistry();
+    std::lock_guard lock(registry.mutex);
+    for (const std::shared_ptr<ThreadBuffer>& buffer : registry.buffers)
+    {
+        const uint64_t count = buffer->count.load(std::memory_order_acquire);
+        const uint64_t begin = count > ThreadBuffer::CAPACITY ? count - ThreadBuffer::CAPACITY : 0;
+        for (uint64_t i = begin; i < count; i++)
+        {
+            const Event& event = buffer->events[i % ThreadBuffer::CAPACITY];
+            // complete events, timestamps in microseconds
+            out << (first ? "" : ",") << "\n{\"name\": \"" << event.name
+                << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << buffer->threadIndex
+                << ", \"ts\": " << event.startNs / 1000 << "." << event.startNs % 1000 / 100
+                << ", \"dur\": " << event.durationNs / 1000 << "." << event.durationNs % 1000 / 100 << "}";
+            first = false;
+        }
+    }
+    // names the GPU track in the viewer
+    out << (first ? "" : ",") << "\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": "
+        << GPU_TRACK << ", \"args\": {\"name\": \"GPU\"}}";
+    out << "\n], \"displayTimeUnit\": \"ns\"}\n";
+    if (!out)
+    {
+        return false;
+    }
+
+    // the events of ended threads are in the file now, nobody records into their buffers anymore
+    dropExitedBuffers(registry, 0);
+    return true;
+}
+
+void clear()
+{
+    Registry& registry = getRegistry();
+    std::lock_guard lock(registry.mutex);
+    for (const std::shared_ptr<ThreadBuffer>& buffer : registry.buffers)
+    {
+        // racy for threads that are recording right now, like writeChromeTrace
+        buffer->count.store(0, std::memory_order_release);
+    }
+}
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+
+/**
+ * Scoped timers for finding out where the time goes, e.g. in the device startup.
+ * Only compiled in with the VMA_INTEROP_TRACING option, otherwise TRACE_SCOPE expands to nothing.
+ *
+ * Every thread records into its own ring buffer, so a scope costs two clock reads and a store.
+ * Once a buffer is full the oldest events are overwritten. The buffers outlive their threads
+ * until they have been written once, only the newest 64 of ended threads are kept until then.
+ * They are written as Chrome trace_event JSON (chrome://tracing or ui.perfetto.dev)
+ */
+namespace Trace
+{
+/**
+ * @returns whether tracing has been compiled in
+ */
+constexpr bool isEnabled()
+{
+#ifdef VMA_INTEROP_TRACING
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ * Records a complete event, name has to be a string literal
+ */
+void record(const char* name, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end);
+
+/**
+ * Records a region that ran on the GPU, shown on its own track.
+ * The times have to be converted to the CPU clock by the caller
+ */
+void recordGpu(const char* name, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end);
+
+/**
+ * Writes the events of all threads. Threads that are still recording may tear
+ * the event they are writing, so it is best called once the traced work is done.
+ * Buffers of threads that have ended are released afterwards
+ * @returns false if the file could not be written or tracing is compiled out
+ */
+bool writeChromeTrace(const std::filesystem::path& file);
+
+/**
+ * Drops all recorded events
+ */
+void clear();
+
+class ScopedTimer
+{
+public:
+    explicit ScopedTimer(const char* name)
+        : name(name), start(std::chrono::steady_clock::now())
+    {
+    }
+    ~ScopedTimer()
+    {
+        record(name, start, std::chrono::steady_clock::now());
+    }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+    const char* name;
+    std::chrono::steady_clock::time_point start;
+};
+}
+
+#ifdef VMA_INTEROP_TRACING
+#define TRACE_CONCAT_IMPL(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_IMPL(a, b)
+#define TRACE_SCOPE(name) Trace::ScopedTimer TRACE_CONCAT(traceScope, __LINE__)(name)
+#else
+#define TRACE_SCOPE(name) do {} while (false)
+#endif
@@ -0,0 +1,404 @@
+#include "upload_engine.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "device.h"
+#include "image.h"
+#include "vulkan_utils.h"
+
+namespace
+{
+VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+}
+
+UploadEngine::UploadEngine(Device* device, VkDeviceSize ringSize, QueueType queueType)
+    : device(device), queueType(queueType), ringSize(ringSize)
+{
+    createRingBuffer();
+    createCommandPool();
+    createTimeline();
+}
+
+UploadEngine::~UploadEngine()
+{
+    try
+    {
+        {
+            std::lock_guard lock(mutex);
+            if (!pendingUploads.empty())
+            {
+                flushLocked();
+            }
+        }
+        wait(lastTicket);
+    }
+    catch (...)
+    {
+        // a failed submit or wait (e.g. device lost) must not escape the destructor,
+        // fall back to waiting for the whole device before releasing the ring buffer
+        vkDeviceWaitIdle(device->getDevice());
+    }
+
+    vkDestroyCommandPool(device->getDevice(), commandPool, nullptr);
+    vmaDestroyBuffer(device->getAllocator(), ringBuffer, ringAllocation);
+}
+
+uint64_t UploadEngine::upload(Image& image, const void* data, VkDeviceSize size)
+{
+    const ImageDesc& desc = image.getDesc();
+    if (!(desc.usageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT))
+    {
+        throw std::runtime_error("Uploads need images with VK_IMAGE_USAGE_TRANSFER_DST_BIT!");
+    }
+
+    const uint32_t texelSize = VulkanUtils::getFormatTexelSize(desc.format);
+    const VkDeviceSize imageSize = VkDeviceSize(desc.width) * desc.height * texelSize;
+    if (size != imageSize)
+    {
+        throw std::runtime_error("Upload size does not match the image size!");
+    }
+    if (size > ringSize)
+    {
+        throw std::runtime_error("Upload does not fit into the staging ring buffer!");
+    }
+
+    // buffer offsets of copies need to be a multiple of the texel size and of 4
+    const VkDeviceSize alignment = std::max<VkDeviceSize>({ texelSize, 4,
+        device->getPhysicalDeviceProperties().limits.optimalBufferCopyOffsetAlignment });
+
+    std::lock_guard lock(mutex);
+
+    std::optional<VkDeviceSize> offset = tryAllocate(size, alignment);
+    while (!offset)
+    {
+        // make room: submit what is staged and wait for the oldest work in flight
+        if (!pendingUploads.empty())
+        {
+            flushLocked();
+        }
+        const uint64_t oldest = inFlight.front().ticket;
+        VkSemaphoreWaitInfo waitInfo{};
+        waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+        waitInfo.semaphoreCount = 1;
+        waitInfo.pSemaphores = timeline.get();
+        waitInfo.pValues = &oldest;
+        VkResult result = vkWaitSemaphores(device->getDevice(), &waitInfo, UINT64_MAX);
+        if (result != VK_SUCCESS)
+        {
+            // nothing would ever free ring space, so do not spin
+            throw std::runtime_error("Could not wait for upload completion!");
+        }
+
+        retireCompleted();
+        offset = tryAllocate(size, alignment);
+    }
+
+    std::memcpy(ringData + *offset, data, size);
+    vmaFlushAllocation(device->getAllocator(), ringAllocation, *offset, size);
+
+    // copies into the same image would race within one submission, only the latest content counts
+    auto [pending, inserted] = pendingIndices.try_emplace(&image, pendingUploads.size());
+    if (inserted)
+    {
+        pendingUploads.push_back({ &image, *offset });
+    }
+    else
+    {
+        pendingUploads[pending->second].bufferOffset = *offset;
+    }
+    stats.uploads++;
+    stats.bytes += size;
+
+    // the ticket of the submission this upload will be part of
+    const uint64_t ticket = lastTicket + 1;
+    image.addPendingTransfer(timeline, ticket);
+    return ticket;
+}
+
+uint64_t UploadEngine::flush()
+{
+    std::lock_guard lock(mutex);
+    if (pendingUploads.empty())
+    {
+        return lastTicket;
+    }
+    return flushLocked();
+}
+
+VkSemaphore UploadEngine::getTimeline() const
+{
+    return *timeline;
+}
+
+bool UploadEngine::isComplete(uint64_t ticket) const
+{
+    uint64_t value = 0;
+    vkGetSemaphoreCounterValue(device->getDevice(), *timeline, &value);
+    return value >= ticket;
+}
+
+void UploadEngine::wait(uint64_t ticket)
+{
+    VkSemaphoreWaitInfo waitInfo{};
+    waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    waitInfo.semaphoreCount = 1;
+    waitInfo.pSemaphores = timeline.get();
+    waitInfo.pValues = &ticket;
+    VkResult result = vkWaitSemaphores(device->getDevice(), &waitInfo, UINT64_MAX);
+    if (result != VK_SUCCESS)
+    {
+        throw std::runtime_error("Could not wait for upload completion!");
+    }
+
+    std::lock_guard lock(mutex);
+    retireCompleted();
+}
+
+UploadEngine::Stats UploadEngine::getStats() const
+{
+    std::lock_guard lock(mutex);
+    return stats;
+}
+
+void UploadEngine::createRingBuffer()
+{
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = ringSize;
+    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    VmaAllocationCreateInfo allocInfo{};
+    allocInfo.usage = VMA_MEMORY_USAGE_AUTO;
+    allocInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT
+        | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+    VmaAllocationInfo allocationInfo;
+    VkResult result = vmaCreateBuffer(device->getAllocator(), &bufferInfo, &allocInfo,
+        &ringBuffer, &ringAllocation, &allocationInfo);
+    if (result != VK_SUCCESS)
+    {
+        throw std::runtime_error("VMA could not create the upload ring buffer!");
+    }
+    ringData = static_cast<std::byte*>(allocationInfo.pMappedData);
+    vmaSetAllocationName(device->getAllocator(), ringAllocation, "Upload Ring Buffer");
+}
+
+void UploadEngine::createCommandPool()
+{
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    // command buffers are recycled individually once their submission completed
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT
+        | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolInfo.queueFamilyIndex = device->getQueueFamily(queueType);
+
+    VkResult result = vkCreateCommandPool(device->getDevice(), &poolInfo, nullptr, &commandPool);
+    if (result != VK_SUCCESS)
+    {
+        throw std::runtime_error("Could not create command pool for uploads!");
+    }
+}
+
+void UploadEngine::createTimeline()
+{
+    VkSemaphoreTypeCreateInfo typeInfo{};
+    typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    typeInfo.initialValue = 0;
+
+    VkSemaphoreCreateInfo createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    createInfo.pNext = &typeInfo;
+
+    VkSemaphore semaphore = VK_NULL_HANDLE;
+    VkResult result = vkCreateSemaphore(device->getDevice(), &createInfo, nullptr, &semaphore);
+    if (result != VK_SUCCESS)
+    {
+        throw std::runtime_error("Could not create timeline semaphore for uploads!");
+    }
+    timeline = VulkanUtils::shareSemaphore(device->getDevice(), semaphore);
+}
+
+bool UploadEngine::isRingEmpty() const
+{
+    return pendingUploads.empty() && inFlight.empty();
+}
+
+std::optional<VkDeviceSize> UploadEngine::tryAllocate(VkDeviceSize size, VkDeviceSize alignment)
+{
+    if (isRingEmpty())
+    {
+        ringHead = 0;
+        ringTail = 0;
+    }
+
+    // the head never catches up with the tail exactly, so head == tail always means empty
+    const VkDeviceSize offset = alignUp(ringHead, alignment);
+    if (ringHead >= ringTail)
+    {
+        if (offset + size <= ringSize)
+        {
+            ringHead = offset + size;
+            return offset;
+        }
+        // wrap around to the start
+        if (size < ringTail)
+        {
+            ringHead = size;
+            return 0;
+        }
+    }
+    else if (offset + size < ringTail)
+    {
+        ringHead = offset + size;
+        return offset;
+    }
+    return std::nullopt;
+}
+
+void UploadEngine::retireCompleted()
+{
+    uint64_t completed = 0;
+    vkGetSemaphoreCounterValue(device->getDevice(), *timeline, &completed);
+
+    while (!inFlight.empty() && inFlight.front().ticket <= completed)
+    {
+        const Submission& submission = inFlight.front();
+        ringTail = submission.ringEnd;
+        freeCommandBuffers.push_back(submission.commandBuffer);
+        inFlight.pop_front();
+    }
+}
+
+uint64_t UploadEngine::flushLocked()
+{
+    retireCompleted();
+
+    VkCommandBuffer commandBuffer = getCommandBuffer();
+    recordUploads(commandBuffer);
+
+    const uint64_t ticket = lastTicket + 1;
+
+    VkTimelineSemaphoreSubmitInfo timelineInfo{};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineInfo.signalSemaphoreValueCount = 1;
+    timelineInfo.pSignalSemaphoreValues = &ticket;
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.pNext = &timelineInfo;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = timeline.get();
+
+    VkResult result = device->submit(queueType, submitInfo);
+    if (result != VK_SUCCESS)
+    {
+        throw std::runtime_error("Could not submit uploads!");
+    }
+
+    lastTicket = ticket;
+    inFlight.push_back({ ticket, commandBuffer, ringHead });
+    pendingUploads.clear();
+    pendingIndices.clear();
+    stats.submissions++;
+    return ticket;
+}
+
+VkCommandBuffer UploadEngine::getCommandBuffer()
+{
+    if (!freeCommandBuffers.empty())
+    {
+        VkCommandBuffer commandBuffer = freeCommandBuffers.back();
+        freeCommandBuffers.pop_back();
+        vkResetCommandBuffer(commandBuffer, 0);
+        return commandBuffer;
+    }
+
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = commandPool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = 1;
+
+    VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+    VkResult result = vkAllocateCommandBuffers(device->getDevice(), &allocInfo, &commandBuffer);
+    if (result != VK_SUCCESS)
+    {
+        throw std::runtime_error("Could not allocate command buffer for uploads!");
+    }
+    return commandBuffer;
+}
+
+void UploadEngine::recordUploads(VkCommandBuffer commandBuffer)
+{
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+    auto makeBarrier = [](Image* image, VkImageLayout oldLayout, VkImageLayout newLayout)
+    {
+        VkImageMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.oldLayout = oldLayout;
+        barrier.newLayout = newLayout;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = image->getImage();
+        barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+        return barrier;
+    };
+
+    // upload() keeps a single upload per image, so every image gets one copy and one transition each way
+    std::vector<VkImageMemoryBarrier> barriers;
+    for (const PendingUpload& upload : pendingUploads)
+    {
+        // the whole image is overwritten, so the old content can be discarded
+        VkImageMemoryBarrier& barrier = barriers.emplace_back(
+            makeBarrier(upload.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL));
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    }
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0, 0, nullptr, 0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data());
+
+    for (const PendingUpload& upload : pendingUploads)
+    {
+        const ImageDesc& desc = upload.image->getDesc();
+
+        VkBufferImageCopy region{};
+        region.bufferOffset = upload.bufferOffset;
+        // tightly packed
+        region.bufferRowLength = 0;
+        region.bufferImageHeight = 0;
+        region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+        region.imageOffset = { 0, 0, 0 };
+        region.imageExtent = { desc.width, desc.height, 1 };
+
+        vkCmdCopyBufferToImage(commandBuffer, ringBuffer, upload.image->getImage(),
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+    }
+
+    barriers.clear();
+    for (const PendingUpload& upload : pendingUploads)
+    {
+        VkImageMemoryBarrier& barrier = barriers.emplace_back(
+            makeBarrier(upload.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL));
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        // generic read access, transfer queues do not know about shaders
+        barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+        upload.image->setLayout(VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    }
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+        0, 0, nullptr, 0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data());
+
+    vkEndCommandBuffer(commandBuffer);
+}
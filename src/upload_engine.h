@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include <volk.h>
+#include <vk_mem_alloc.h>
+
+#include "vulkan_utils.h"
+
+class Device;
+class Image;
+
+/**
+ * Gets pixel data into images. Data is copied into a persistently mapped ring buffer,
+ * the copies are recorded and all uploads since the last flush are submitted together
+ * in a single command buffer, including the layout transitions of the images.
+ * Completion is tracked with a timeline semaphore, the returned tickets are its values.
+ * Uploads run on the transfer queue by default, so GPU work reading the images has to
+ * wait for the ticket on getTimeline().
+ *
+ * Images have to stay alive until their upload completed. Thread safe
+ */
+class UploadEngine
+{
+public:
+    struct Stats
+    {
+        uint64_t uploads = 0;
+        uint64_t submissions = 0;
+        uint64_t bytes = 0;
+    };
+
+    /**
+     * @param ringSize size of the staging ring buffer, the largest possible single upload
+     */
+    UploadEngine(Device* device, VkDeviceSize ringSize = 64 * 1024 * 1024,
+        QueueType queueType = QueueType::Transfer);
+    ~UploadEngine();
+
+    UploadEngine(const UploadEngine&) = delete;
+    UploadEngine& operator=(const UploadEngine&) = delete;
+
+    /**
+     * Stages the whole image content, tightly packed in the image's format.
+     * The image needs VK_IMAGE_USAGE_TRANSFER_DST_BIT and ends up in
+     * VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL. Uploading an image again before the flush
+     * replaces the content staged for it
+     * @returns the ticket that completes once the upload is done (after the next flush)
+     */
+    uint64_t upload(Image& image, const void* data, VkDeviceSize size);
+
+    /**
+     * Submits all staged uploads at once
+     * @returns the ticket of the submission, or the last ticket if there was nothing to submit
+     */
+    uint64_t flush();
+
+    VkSemaphore getTimeline() const;
+    bool isComplete(uint64_t ticket) const;
+    void wait(uint64_t ticket);
+
+    Stats getStats() const;
+
+private:
+    struct PendingUpload
+    {
+        Image* image = nullptr;
+        VkDeviceSize bufferOffset = 0;
+    };
+    struct Submission
+    {
+        uint64_t ticket = 0;
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        /** the ring buffer is free up to here once the submission completed */
+        VkDeviceSize ringEnd = 0;
+    };
+
+    void createRingBuffer();
+    void createCommandPool();
+    void createTimeline();
+
+    bool isRingEmpty() const;
+    std::optional<VkDeviceSize> tryAllocate(VkDeviceSize size, VkDeviceSize alignment);
+    /** reclaims the command buffers and ring space of completed submissions */
+    void retireCompleted();
+
+    uint64_t flushLocked();
+    VkCommandBuffer getCommandBuffer();
+    void recordUploads(VkCommandBuffer commandBuffer);
+
+private:
+    Device* device = nullptr;
+    QueueType queueType = QueueType::Transfer;
+
+    VkBuffer ringBuffer = VK_NULL_HANDLE;
+    VmaAllocation ringAllocation = VK_NULL_HANDLE;
+    std::byte* ringData = nullptr;
+    VkDeviceSize ringSize = 0;
+    /** next free byte and first byte still in use */
+    VkDeviceSize ringHead = 0;
+    VkDeviceSize ringTail = 0;
+
+    VkCommandPool commandPool = VK_NULL_HANDLE;
+    std::vector<VkCommandBuffer> freeCommandBuffers;
+
+    /** shared with the uploaded images, see Image::addPendingTransfer */
+    std::shared_ptr<const VkSemaphore> timeline;
+    uint64_t lastTicket = 0;
+
+    std::vector<PendingUpload> pendingUploads;
+    /** index into pendingUploads per image, an image is copied at most once per submission */
+    std::unordered_map<Image*, size_t> pendingIndices;
+    std::deque<Submission> inFlight;
+
+    Stats stats;
+    mutable std::mutex mutex;
+};
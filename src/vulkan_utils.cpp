@@ -1,9 +1,10 @@
 
 #include "vulkan_utils.h"
 
-#include <cstring>
 #include <iostream>
-#include <set>
+#include <stdexcept>
+
+#include "capability_registry.h"
 
 namespace VulkanUtils
 {
@@ -43,23 +44,41 @@ SwapchainSupportDetails getSwapchainSupportDetails(VkPhysicalDevice device,
 
 QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device, VkSurfaceKHR surface)
 {
-	QueueFamilyIndices indices;
-
 	uint32_t queueFamilyCount = 0;
 	vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
 
 	std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
 	vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
 
-	int32_t i = 0;
-	for (int32_t i = 0; i < queueFamilyCount; i++)
+	return findQueueFamilies(device, surface, queueFamilies);
+}
+
+QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device, VkSurfaceKHR surface,
+	const std::vector<VkQueueFamilyProperties>& queueFamilies)
+{
+	QueueFamilyIndices indices;
+
+	for (uint32_t i = 0; i < queueFamilies.size(); i++)
 	{
-		if (queueFamilies[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)
+		const VkQueueFlags flags = queueFamilies[i].queueFlags;
+		if ((flags & VK_QUEUE_GRAPHICS_BIT) && !indices.GraphicsFamily.has_value())
 		{
 			indices.GraphicsFamily = i;
 		}
 
-		if (surface != VK_NULL_HANDLE)
+		// dedicated families run in parallel to the graphics work
+		if ((flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT)
+			&& !indices.ComputeFamily.has_value())
+		{
+			indices.ComputeFamily = i;
+		}
+		if ((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))
+			&& !indices.TransferFamily.has_value())
+		{
+			indices.TransferFamily = i;
+		}
+
+		if (surface != VK_NULL_HANDLE && !indices.PresentFamily.has_value())
 		{
 			// for querying presentation support, a surface is needed
 			// but the surface is only created, if we're not only rendering off screen
@@ -71,101 +90,90 @@ QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device, VkSurfaceKHR surfa
 				indices.PresentFamily = i;
 			}
 		}
-
-		if (indices.IsComplete())
-		{
-			// no need to look for more
-			break;
-		}
 	}
 	return indices;
 }
 
-bool areInstanceLayersSupported(std::vector<const char*> layers)
+namespace
 {
-	uint32_t layerCount;
-	vkEnumerateInstanceLayerProperties(&layerCount, nullptr);
-
-	std::vector<VkLayerProperties> availableLayers(layerCount);
-	vkEnumerateInstanceLayerProperties(&layerCount, availableLayers.data());
-
-	for (const char* layerName : layers)
+void printMissing(const char* what, const std::vector<const char*>& missing)
+{
+	if (missing.empty())
 	{
-		bool layerFound = false;
-
-		for (const VkLayerProperties& layerProps : availableLayers)
-		{
-			if (strcmp(layerName, layerProps.layerName) == 0)
-			{
-				layerFound = true;
-				break;
-			}
-		}
-
-		if (!layerFound)
-		{
-			return false;
-		}
+		return;
+	}
+	std::cerr << "Missing " << what << ":" << std::endl;
+	for (const char* name : missing)
+	{
+		std::cerr << "\t" << name << std::endl;
 	}
+}
+}
 
-	return true;
+bool areInstanceLayersSupported(std::vector<const char*> layers)
+{
+	std::vector<const char*> missing = CapabilityRegistry::get().getInstanceLayers().findMissing(layers);
+	printMissing("layers", missing);
+	return missing.empty();
 }
 
 bool areInstanceExtensionsAvailable(const std::vector<const char*>& requestedExtensions)
 {
-	uint32_t extensionCount = 0;
-	vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
-
-	std::vector<VkExtensionProperties> extensions(extensionCount);
-	vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, extensions.data());
-
-	std::vector<const char*> missingExtensions;
-
-	for (const char* required : requestedExtensions)
-	{
-		bool found = false;
-		for (const VkExtensionProperties& extensionProp : extensions)
-		{
-			if (strcmp(required, extensionProp.extensionName) == 0)
-			{
-				found = true;
-				break;
-			}
-		}
+	std::vector<const char*> missing = CapabilityRegistry::get().getInstanceExtensions().findMissing(requestedExtensions);
+	printMissing("extensions", missing);
+	return missing.empty();
+}
 
-		if (!found)
-		{
-			missingExtensions.push_back(required);
-		}
-	}
+bool areDeviceExtensionsAvailable(VkPhysicalDevice device, const std::vector<const char*> requestedExtensions)
+{
+	return CapabilityRegistry::get().getDeviceExtensions(device).containsAll(requestedExtensions);
+}
 
-	if (missingExtensions.size() > 0)
+uint32_t getFormatTexelSize(VkFormat format)
+{
+	switch (format)
 	{
-		std::cerr << "Missing extensions:" << std::endl;
-		for (const char* extension : missingExtensions)
-		{
-			std::cerr << "\t" << extension << std::endl;
-		}
+	case VK_FORMAT_R8_UNORM:
+		return 1;
+	case VK_FORMAT_R8G8_UNORM:
+	case VK_FORMAT_R16_SFLOAT:
+		return 2;
+	case VK_FORMAT_R8G8B8A8_UNORM:
+	case VK_FORMAT_R8G8B8A8_SRGB:
+	case VK_FORMAT_B8G8R8A8_UNORM:
+	case VK_FORMAT_B8G8R8A8_SRGB:
+	case VK_FORMAT_R16G16_SFLOAT:
+	case VK_FORMAT_R32_SFLOAT:
+		return 4;
+	case VK_FORMAT_R16G16B16A16_SFLOAT:
+	case VK_FORMAT_R32G32_SFLOAT:
+		return 8;
+	case VK_FORMAT_R32G32B32A32_SFLOAT:
+		return 16;
+	default:
+		throw std::runtime_error("Unsupported format for texel size query!");
 	}
-	return true;
 }
 
-bool areDeviceExtensionsAvailable(VkPhysicalDevice device, const std::vector<const char*> requestedExtensions)
+std::optional<VkFormat> getSmallerFormat(VkFormat format)
 {
-	uint32_t extensionCount = 0;
-	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
-
-	std::vector<VkExtensionProperties> availableExtensions(extensionCount);
-	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
-
-	std::set<std::string> extensions(requestedExtensions.begin(), requestedExtensions.end());
-
-	for (const auto& extension : availableExtensions)
+	switch (format)
 	{
-		extensions.erase(extension.extensionName);
+	case VK_FORMAT_R32G32B32A32_SFLOAT:
+		return VK_FORMAT_R16G16B16A16_SFLOAT;
+	case VK_FORMAT_R16G16B16A16_SFLOAT:
+		return VK_FORMAT_R8G8B8A8_UNORM;
+	case VK_FORMAT_R32G32_SFLOAT:
+		return VK_FORMAT_R16G16_SFLOAT;
+	case VK_FORMAT_R16G16_SFLOAT:
+		return VK_FORMAT_R8G8_UNORM;
+	case VK_FORMAT_R32_SFLOAT:
+		return VK_FORMAT_R16_SFLOAT;
+	case VK_FORMAT_R16_SFLOAT:
+		return VK_FORMAT_R8_UNORM;
+	default:
+		return std::nullopt;
 	}
-
-	return extensions.empty();
 }
 
 QueueFamilyIndices fetchQueues(VkPhysicalDevice device, VkSurfaceKHR surface)
@@ -231,4 +239,13 @@ void setDebugName(VkDevice device, uint64_t objectHandle,
 #endif
 }
 
+std::shared_ptr<const VkSemaphore> shareSemaphore(VkDevice device, VkSemaphore semaphore)
+{
+	return std::shared_ptr<const VkSemaphore>(new VkSemaphore(semaphore), [device](const VkSemaphore* shared)
+	{
+		vkDestroySemaphore(device, *shared, nullptr);
+		delete shared;
+	});
+}
+
 }
@@ -3,6 +3,7 @@
 
 #include "volk.h"
 
+#include <memory>
 #include <optional>
 #include <string>
 #include <vector>
@@ -14,10 +15,21 @@ struct SwapchainSupportDetails
 	std::vector<VkPresentModeKHR> PresentModes;
 };
 
+enum class QueueType
+{
+	Graphics,
+	Compute,
+	Transfer,
+};
+
 struct QueueFamilyIndices
 {
 	std::optional<uint32_t> GraphicsFamily;
 	std::optional<uint32_t> PresentFamily;
+	/** a compute family without graphics support, if there is one */
+	std::optional<uint32_t> ComputeFamily;
+	/** a transfer family without graphics or compute support, if there is one */
+	std::optional<uint32_t> TransferFamily;
 
 	bool IsComplete() const
 	{
@@ -32,9 +44,15 @@ SwapchainSupportDetails getSwapchainSupportDetails(VkPhysicalDevice device,
 	VkSurfaceKHR surface);
 
 /**
-* Finds all queue families. If surface is null, then offscreen rendering is assumed
+* Finds all queue families. If surface is null, then offscreen rendering is assumed.
+* Dedicated compute and transfer families are only reported if the device has them
 */
 QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device, VkSurfaceKHR surface);
+/**
+* Same as above, but with queue family properties that have already been queried
+*/
+QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device, VkSurfaceKHR surface,
+	const std::vector<VkQueueFamilyProperties>& queueFamilies);
 
 bool areInstanceLayersSupported(std::vector<const char*> layers);
 
@@ -42,6 +60,18 @@ bool areInstanceExtensionsAvailable(const std::vector<const char*>& requestedExt
 
 bool areDeviceExtensionsAvailable(VkPhysicalDevice device, const std::vector<const char*> requestedExtensions);
 
+/**
+* @returns the size of a single texel of an uncompressed color format in bytes.
+* Throws for formats that are not supported for uploads and readbacks
+*/
+uint32_t getFormatTexelSize(VkFormat format);
+
+/**
+* @returns the format with the same channels but half the bits per channel,
+* if there is one that is still reasonable for color data
+*/
+std::optional<VkFormat> getSmallerFormat(VkFormat format);
+
 QueueFamilyIndices fetchQueues(VkPhysicalDevice device, VkSurfaceKHR surface);
 
 /**
@@ -52,4 +82,9 @@ QueueFamilyIndices fetchQueues(VkPhysicalDevice device, VkSurfaceKHR surface);
 void setDebugName(VkDevice device, uint64_t objectHandle,
     VkObjectType objectType, const std::string& name);
 
+/**
+* Takes over the semaphore, which is destroyed together with the last reference to it
+*/
+std::shared_ptr<const VkSemaphore> shareSemaphore(VkDevice device, VkSemaphore semaphore);
+
 }